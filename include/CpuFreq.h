@@ -0,0 +1,66 @@
+/*
+ * CpuFreq.h
+ * Copyright (C) 2015 xiehuc <xiehuc@gmail.com>
+ *
+ * Distributed under terms of the GPL license.
+ *
+ * function: get_cpu_freq
+ * return the cpu frequency in Hz, or 0 when it can not be found
+ *
+ * shared by the timing tools in src and the tsc time profiling runtime.
+ */
+#ifndef LLVM_PROF_CPU_FREQ_H
+#define LLVM_PROF_CPU_FREQ_H
+
+#include <stdio.h>
+
+/** @return Hz **/
+static unsigned long get_cpu_freq_by_sys()
+{
+   const char* file = "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq";
+   FILE* f = fopen(file,"r");
+   if(f==NULL){
+      perror("Unable Find CPU freq sys file:");
+      fprintf(stderr, "%s\n", file);
+      return 0;
+   }
+   unsigned long freq = 0;
+   if(fscanf(f, "%lu", &freq) != 1) freq = 0;
+   if(freq==0)
+      perror("Unable Read CPU freq:");
+   fclose(f);
+   return freq * 1E3; //convert KHz to Hz
+}
+
+static unsigned long get_cpu_freq_by_proc()
+{
+   const char* file = "/proc/cpuinfo";
+   FILE* f = fopen(file, "r");
+   if(f==NULL){
+      perror("Unable Find /proc/cpuinfo File:");
+      return 0;
+   }
+   char line[256] = {0};
+   unsigned long freq = 0L;
+   while(fgets(line, sizeof(line), f)){
+      double mhz = 0.0L;
+      if (sscanf(line, "cpu MHz\t: %lf", &mhz) == 1){
+         freq = mhz * 1E6; // convert MHz to Hz
+         break;
+      }
+   }
+   if(freq==0)
+      perror("Unable Read CPU freq:");
+   fclose(f);
+   return freq;
+}
+
+/** @return Hz **/
+static unsigned long get_cpu_freq()
+{
+   unsigned long freq = get_cpu_freq_by_sys();
+   if(freq == 0) freq = get_cpu_freq_by_proc();
+   return freq;
+}
+
+#endif
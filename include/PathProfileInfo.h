@@ -32,7 +32,7 @@ typedef std::vector<BasicBlock*>::iterator ProfilePathBlockIterator;
 typedef std::map<unsigned int,ProfilePath*> ProfilePathMap;
 typedef std::map<unsigned int,ProfilePath*>::iterator ProfilePathIterator;
 
-typedef std::map<Function*,unsigned int> FunctionPathCountMap;
+typedef std::map<Function*,uint64_t> FunctionPathCountMap;
 typedef std::map<Function*,ProfilePathMap> FunctionPathMap;
 typedef std::map<Function*,ProfilePathMap>::iterator FunctionPathIterator;
 
@@ -53,13 +53,13 @@ protected:
 
 class ProfilePath {
 public:
-  ProfilePath(unsigned int number, unsigned int count,
+  ProfilePath(unsigned int number, uint64_t count,
               double countStdDev, PathProfileInfo* ppi);
 
   double getFrequency() const;
 
   inline unsigned int getNumber() const { return _number; }
-  inline unsigned int getCount() const { return _count; }
+  inline uint64_t getCount() const { return _count; }
   inline double getCountStdDev() const { return _countStdDev; }
 
   ProfilePathEdgeVector* getPathEdges() const;
@@ -69,7 +69,7 @@ public:
 
 private:
   unsigned int _number;
-  unsigned int _count;
+  uint64_t _count;
   double _countStdDev;
 
   // double pointer back to the profiling info
@@ -38,15 +38,38 @@ enum ProfilingType {
    EdgeInfo64   = 105, /* Edge Profiling information with 64bit */
    BlockInfoDouble   = 106, /* Block Profiling information with double */
 	 MPITimeInfo					 = 107, /*MPI Time Profiling information*/
-	 RankInfo					 = 108 /*Rank of process Profiling information*/
+	 RankInfo					 = 108, /*Rank of process Profiling information*/
+   PaddingInfo  = 109, /* Filler keeping mmap'ed counters aligned, skipped */
+   SnapshotInfo = 110, /* Timestamped packets taken while the program runs */
+   ValueHistInfo = 111, /* Value profiling, most frequent values per site */
+   PathInfo64   = 112, /* Path profiling information with 64bit counters */
+   BBTraceDeltaInfo = 113, /* Basic block trace, zig-zag varint deltas */
+   MPITimeRangeInfo = 114, /* Minimum and maximum MPI time over all ranks */
+   MPITimeCycleInfo = 115, /* MPI time in TSC cycles, runtime only: always
+                              written out as MPITimeInfo seconds */
+   OptEdgeInfo64 = 116,    /* Optimal edge profiling with 64bit counters,
+                              ~0 marks the edges which are calculated */
+   IndexedInfo  = 117, /* Version 2: the counters of every function in a
+                          record keyed by its name and CFG checksum */
+   StatsInfo    = 118  /* Distribution of the counters of a kind over the
+                          ranks, written by llvm-prof -merge=stats */
 };
 
 // special flags used in value profiling
 enum ProfilingFlags {
 	CONSTANT_COMPRESS = 1<<0,
-	RUN_LENGTH_COMPRESS = 1<<1
+	RUN_LENGTH_COMPRESS = 1<<1,
+	VALUE_HISTOGRAM = 1<<2 /* other count, then value, count pairs */
 };
 
+// flags of a SnapshotInfo packet
+enum SnapshotFlags {
+   SNAPSHOT_DELTA = 1<<0 /* counts since the previous snapshot */
+};
+
+/* version of the IndexedInfo packet layout */
+#define INDEXED_PROFILE_VERSION 2
+
 #define FORTRAN_DATATYPE_MAP_SIZE 128
 
 #if defined(__cplusplus)
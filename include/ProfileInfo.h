@@ -21,6 +21,8 @@
 #ifndef LLVM_ANALYSIS_PROFILEINFO_H
 #define LLVM_ANALYSIS_PROFILEINFO_H
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/Format.h"
@@ -31,8 +33,10 @@
 #include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 namespace llvm {
+  class Module;
   class Pass;
   class raw_ostream;
 
@@ -51,6 +55,73 @@ namespace llvm {
   raw_ostream& operator<<(raw_ostream &O, const Function *F);
   raw_ostream& operator<<(raw_ostream &O, const MachineFunction *MF);
 
+  /// ValueRuns - The values traped at a value profiling site as runs of equal
+  /// values, read in place from the packed content: the (value, length) pairs
+  /// of run length compression, the (value, count) pairs of a histogram, runs
+  /// of one for uncompressed values, or a single run for a constant.
+  class ValueRuns {
+  public:
+    struct Run {
+      int Value;
+      uint64_t Count;
+    };
+    class iterator {
+      const int *P;
+      bool Paired;
+    public:
+      iterator(const int *P, bool Paired) : P(P), Paired(Paired) {}
+      Run operator*() const {
+        Run R = { P[0], Paired ? (unsigned)P[1] : 1U };
+        return R;
+      }
+      iterator &operator++() { P += Paired ? 2 : 1; return *this; }
+      bool operator==(const iterator &I) const { return P == I.P; }
+      bool operator!=(const iterator &I) const { return P != I.P; }
+    };
+
+    ValueRuns() : Begin(0), End(0), Paired(false) {
+      Constant[0] = Constant[1] = 0;
+    }
+    ValueRuns(ArrayRef<int> Contents, bool Paired)
+      : Begin(Contents.begin()), Paired(Paired) {
+      End = Begin + (Paired ? Contents.size() & ~(size_t)1 : Contents.size());
+      Constant[0] = Constant[1] = 0;
+    }
+    ValueRuns(int Value, unsigned Count) : Paired(true) {
+      Constant[0] = Value;
+      Constant[1] = Count;
+      Begin = Constant;
+      End = Count ? Constant + 2 : Constant;
+    }
+    ValueRuns(const ValueRuns &R) { *this = R; }
+    ValueRuns &operator=(const ValueRuns &R) {
+      Paired = R.Paired;
+      Constant[0] = R.Constant[0];
+      Constant[1] = R.Constant[1];
+      Begin = R.Begin == R.Constant ? Constant : R.Begin;
+      End = Begin + (R.End - R.Begin);
+      return *this;
+    }
+
+    iterator begin() const { return iterator(Begin, Paired); }
+    iterator end() const { return iterator(End, Paired); }
+    bool empty() const { return Begin == End; }
+
+    /// size - The number of values.
+    uint64_t size() const;
+    /// sum - The sum of the values.
+    double sum() const;
+    /// histogram - How many times every value occurs.
+    std::map<int, uint64_t> histogram() const;
+    /// distinct - The values which occur, in increasing order.
+    std::vector<int> distinct() const;
+
+  private:
+    const int *Begin, *End;
+    bool Paired;
+    int Constant[2];
+  };
+
   /// ProfileInfo Class - This class holds and maintains profiling
   /// information for some unit of code.
   template<class FType, class BType>
@@ -66,6 +137,7 @@ namespace llvm {
        unsigned Nums;
        enum ProfilingFlags flags;
        std::vector<int> Contents;
+       unsigned Other; // VALUE_HISTOGRAM: values which found no slot
     };
     typedef std::pair<unsigned, const Instruction*>
        SLGCounts;
@@ -98,6 +170,42 @@ namespace llvm {
     // MPICounts = count * size(fortran_type)
     std::map<const CallInst*, MPICounts> MPIFullInformation; // new mpi profiling format
 
+    // DenseIndex - A read only copy of the counts above in flat arrays, see
+    // buildDenseIndex.  The blocks and functions are numbered once.  The edges
+    // leaving a block are numbered consecutively from FirstEdge[block], and
+    // the entry edges of function f come from slot NumBlocks + f.
+    struct DenseIndex {
+      DenseMap<const FType*, unsigned> Functions;
+      DenseMap<const BType*, unsigned> Blocks;
+      std::vector<double> FunctionCounts;
+      std::vector<double> BlockCounts;
+      std::vector<unsigned> FirstEdge;
+      std::vector<const BType*> EdgeDests;
+      std::vector<double> EdgeCounts;
+
+      void clear() {
+        Functions.clear();
+        Blocks.clear();
+        FunctionCounts.clear();
+        BlockCounts.clear();
+        FirstEdge.clear();
+        EdgeDests.clear();
+        EdgeCounts.clear();
+      }
+    };
+    // Dense - Answers the queries while it is built, any update of the counts
+    // drops it.
+    DenseIndex Dense;
+
+    // TrapSites - The traped instructions of a profiling type sorted by
+    // counter index, or the mpi calls by decreasing time for MPITimeInfo, and
+    // the slot of each of them in that order.
+    struct TrapSites {
+      std::vector<const Instruction*> Sites;
+      DenseMap<const Instruction*, unsigned> Slots;
+    };
+    std::map<int, TrapSites> SortedTraps;
+
     ProfileInfoT<MachineFunction, MachineBasicBlock> *MachineProfile;
   public:
     static char ID; // Class identification, replacement for typeinfo
@@ -133,14 +241,47 @@ namespace llvm {
 
     double getMPITime(const CallInst* V);
 
+    /** return the index of the mpi time of V in the MPITimeInfo counters, -1
+     * if it has none. */
+    unsigned getMPITimeIndex(const CallInst* V);
+
 	int getRankValue(ProfilingType T);
 
-    const std::vector<int>& getValueContents(const CallInst* V);
-    /** return traped instructions.
+    /** return the traped values of V, expanded.  getValueRuns reads them
+     * without expanding.
+     */
+    std::vector<int> getValueContents(const CallInst* V);
+    /** return the traped values of V as runs of equal values.  The view is
+     * valid while the profile is.
+     */
+    ValueRuns getValueRuns(const CallInst* V);
+    /** return how many traped values of a VALUE_HISTOGRAM site are not
+     * part of getValueContents.
+     */
+    unsigned getValueOtherCount(const CallInst* V);
+    /// buildTrapSites - Sort the traped instructions of every type once the
+    /// profile is read, for getTrapSites and getTrapSlot.
+    void buildTrapSites();
+    /** return the traped instructions of type T, without copying or sorting
+     * them again.  They are sorted by counter index, the mpi calls of
+     * MPITimeInfo by decreasing time.  Empty until buildTrapSites.
      * if Instruction is CallInst it is ValueProfiling
      * if Instruction is LoadInst it is SLGProfiling
      */
-    std::vector<const Instruction*> getAllTrapedValues(ProfilingType T);
+    ArrayRef<const Instruction*> getTrapSites(ProfilingType T) const {
+      typename std::map<int, TrapSites>::const_iterator I = SortedTraps.find(T);
+      if (I == SortedTraps.end()) return ArrayRef<const Instruction*>();
+      return I->second.Sites;
+    }
+    /** return the position of V in getTrapSites(T), ~0U if it is not there.
+     */
+    unsigned getTrapSlot(ProfilingType T, const Instruction* V) const {
+      typename std::map<int, TrapSites>::const_iterator I = SortedTraps.find(T);
+      if (I == SortedTraps.end()) return ~0U;
+      typename DenseMap<const Instruction*, unsigned>::const_iterator S =
+        I->second.Slots.find(V);
+      return S == I->second.Slots.end() ? ~0U : S->second;
+    }
 
     /** return traped index with Instruction.
      * if Instruction is CallInst, it would directly return first arguments as
@@ -160,6 +301,21 @@ namespace llvm {
     void addExecutionCount(const BType *BB, double w);
 
     double getEdgeWeight(Edge e) const {
+      if (hasDenseIndex()) {
+        unsigned Slot = ~0U;
+        if (e.first) {
+          Slot = getBlockNumber(e.first);
+        } else if (e.second) {
+          Slot = getFunctionNumber(e.second->getParent());
+          if (Slot != ~0U) Slot += Dense.BlockCounts.size();
+        }
+        if (Slot != ~0U) {
+          for (unsigned i = Dense.FirstEdge[Slot], End = Dense.FirstEdge[Slot + 1];
+               i != End; ++i)
+            if (Dense.EdgeDests[i] == e.second) return Dense.EdgeCounts[i];
+          return MissingValue;
+        }
+      }
       typename std::map<const FType*, EdgeWeights>::const_iterator J =
         EdgeInformation.find(getFunction(e));
       if (J == EdgeInformation.end()) return MissingValue;
@@ -174,15 +330,49 @@ namespace llvm {
       DEBUG_WITH_TYPE("profile-info",
             dbgs() << "Creating Edge " << e
                    << " (weight: " << format("%.20g",w) << ")\n");
+      Dense.clear();
       EdgeInformation[getFunction(e)][e] = w;
     }
 
     void addEdgeWeight(Edge e, double w);
 
     EdgeWeights &getEdgeWeights (const FType *F) {
+      Dense.clear();
       return EdgeInformation[F];
     }
 
+    //===------------------------------------------------------------------===//
+    /// Dense Profile Information
+    ///
+    /// buildDenseIndex - Number the blocks and edges of the defined functions
+    /// of M and copy their counts into flat arrays, through which the queries
+    /// above then run in constant time.
+    void buildDenseIndex(Module &M);
+
+    bool hasDenseIndex() const { return !Dense.FirstEdge.empty(); }
+
+    /// getBlockNumber - The index of BB in getDenseBlockCounts, ~0U if it has
+    /// none.
+    unsigned getBlockNumber(const BType *BB) const {
+      typename DenseMap<const BType*, unsigned>::const_iterator I =
+        Dense.Blocks.find(BB);
+      return I == Dense.Blocks.end() ? ~0U : I->second;
+    }
+
+    /// getFunctionNumber - The index of F in getDenseFunctionCounts, ~0U if it
+    /// has none.  Its blocks are numbered consecutively from its entry block.
+    unsigned getFunctionNumber(const FType *F) const {
+      typename DenseMap<const FType*, unsigned>::const_iterator I =
+        Dense.Functions.find(F);
+      return I == Dense.Functions.end() ? ~0U : I->second;
+    }
+
+    ArrayRef<double> getDenseBlockCounts() const { return Dense.BlockCounts; }
+
+    ArrayRef<double> getDenseFunctionCounts() const {
+      return Dense.FunctionCounts;
+    }
+
     //===------------------------------------------------------------------===//
     /// Analysis Update Methods
     ///
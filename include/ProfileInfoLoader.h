@@ -16,6 +16,11 @@
 #ifndef LLVM_ANALYSIS_PROFILEINFOLOADER_H
 #define LLVM_ANALYSIS_PROFILEINFOLOADER_H
 
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include "ProfileInfoTypes.h"
+#include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -25,90 +30,271 @@ namespace llvm {
 class Module;
 class Function;
 class BasicBlock;
+class MemoryBuffer;
 
 raw_ostream& operator<<(raw_ostream& O,
                         std::pair<const BasicBlock*, const BasicBlock*> E);
 
+// FunctionCFGChecksum - A hash of the blocks and edges of F.  The records of
+// an indexed profile carry the checksum F had when it was instrumented, a
+// record with another checksum is out of date.
+uint64_t FunctionCFGChecksum(const Function *F);
+
+// MergeValueHistogram - Add the value histogram New of a site, laid out as
+// flags, other count, value/count pairs, to the histogram Data.
+void MergeValueHistogram(std::vector<int> &Data, const std::vector<int> &New);
+
+// ProfileCounters - The counters of one kind read from the profile.  While
+// they come from a single packet which can be used as it is, they are a view
+// of the mapped file.  They are copied only when several packets are summed
+// or a packet has to be byte swapped or realigned.
+template<class T>
+class ProfileCounters {
+  const T *Mapped;
+  size_t NumMapped;
+  std::vector<T> Owned;
+public:
+  ProfileCounters() : Mapped(0), NumMapped(0) {}
+
+  ArrayRef<T> get() const {
+    return Mapped ? ArrayRef<T>(Mapped, NumMapped) : ArrayRef<T>(Owned);
+  }
+  size_t size() const { return Mapped ? NumMapped : Owned.size(); }
+  bool empty() const { return size() == 0; }
+
+  // view - Refer to the NumEntries counters at Data, unless there are
+  // counters already.
+  bool view(const T *Data, size_t NumEntries) {
+    if (Mapped || !Owned.empty()) return false;
+    Mapped = Data;
+    NumMapped = NumEntries;
+    return true;
+  }
+  // own - The counters as a vector which may be changed, a view is copied.
+  std::vector<T> &own() {
+    if (Mapped) {
+      Owned.assign(Mapped, Mapped + NumMapped);
+      Mapped = 0;
+    }
+    return Owned;
+  }
+  void clear() {
+    Mapped = 0;
+    NumMapped = 0;
+    Owned.clear();
+  }
+};
+
 class ProfileInfoLoader {
+public:
+  // PathCountMap - The counts of the executed paths, by function number and
+  // path number, see PathProfiling.
+  typedef std::map<unsigned, std::map<unsigned, uint64_t> > PathCountMap;
+
+private:
   const std::string &Filename;
+  // the mapped file, shared with the copies made by useSnapshot
+  std::shared_ptr<MemoryBuffer> Buffer;
+  const char *ToolName;
   std::vector<std::string> CommandLines;
-  std::vector<unsigned>    FunctionCounts;
-  std::vector<uint64_t>    BlockCounts;
-  std::vector<double>      TimeMess;
-  std::vector<uint64_t>    EdgeCounts;
-  std::vector<unsigned>    OptimalEdgeCounts;
-  std::vector<unsigned>    BBTrace;
-  std::vector<unsigned>	   ValueCounts;
-  std::vector<std::vector<int> > ValueContents;
-  std::vector<unsigned>    SLGCounts;
-  std::vector<unsigned>    MPICounts;
-  std::vector<unsigned>    MPIFullCounters; // new mpi profiling format
-  std::vector<unsigned>    RankCounts;
+  ProfileCounters<unsigned> FunctionCounts;
+  // The counters which may come from an indexed profile are filled in from
+  // its records on first use.
+  mutable ProfileCounters<uint64_t> BlockCounts;
+  mutable ProfileCounters<double>   TimeMess;
+  ProfileCounters<double>   TimeMin;  // over all ranks, see MPITimeRangeInfo
+  ProfileCounters<double>   TimeMax;
+  mutable ProfileCounters<uint64_t> EdgeCounts;
+  ProfileCounters<uint64_t> OptimalEdgeCounts;
+  mutable ProfileCounters<unsigned> BBTrace;
+  // EncodedTrace - A BBTraceDeltaInfo packet, decoded into BBTrace on first
+  // use.
+  struct EncodedTrace {
+    const unsigned char *Bytes;
+    unsigned NumBytes;
+    unsigned NumBlocks;
+  };
+  mutable std::vector<EncodedTrace> EncodedBBTrace;
+  mutable ProfileCounters<unsigned> ValueCounts;
+  mutable std::vector<std::vector<int> > ValueContents;
+  mutable bool ValueHistograms;  // ValueContents are histograms
+  ProfileCounters<unsigned> SLGCounts;
+  ProfileCounters<unsigned> MPICounts;
+  mutable ProfileCounters<unsigned> MPIFullCounters; // new mpi profiling format
+  ProfileCounters<unsigned> RankCounts;
+  PathCountMap PathCounts;
+  // the StatsInfo packets, by the kind of their counters
+  std::map<int, ProfileCounters<CounterStats> > Stats;
+
+  // Snapshot - A SnapshotInfo packet, its counter packets are read on demand
+  // by useSnapshot.
+  struct Snapshot {
+    uint64_t Sequence;
+    double   Timestamp;
+    bool     Delta;
+    size_t   Offset;  // start of the counter packets in the file
+    uint64_t Size;
+  };
+  std::vector<Snapshot>    Snapshots;
+
+  // IndexedRecord - The record of a function in an IndexedInfo packet, a
+  // sequence of slices at Offset in the file.
+  struct IndexedRecord {
+    StringRef Name;
+    uint64_t  Checksum;
+    size_t    Offset;
+    uint64_t  Size;
+    bool      ByteSwapped;
+    bool operator<(const IndexedRecord &R) const { return Name < R.Name; }
+  };
+  // the records of every IndexedInfo packet, each packet sorted by name
+  std::vector<std::vector<IndexedRecord> > Indexed;
+  mutable bool IndexedPending;  // records not yet added to the counters
+
+  void readPackets(const char *ToolName, size_t Begin, size_t End);
+  void readIndexed(const char *ToolName, size_t Begin, size_t End);
+  bool readSnapshot(const char *ToolName, uint64_t Sequence);
+  void clearCounts();
+  void decodeBBTrace() const;
+  void addIndexedCounts() const;
+  void addIndexed() const { if (IndexedPending) addIndexedCounts(); }
 public:
-  // ProfileInfoLoader ctor - Read the specified profiling data file, exiting
-  // the program if the file is invalid or broken.
+  // ProfileInfoLoader ctor - Map the specified profiling data file and read
+  // its packets, exiting the program if the file is invalid or broken.  The
+  // counters returned by the getRaw methods are views of the file where
+  // possible, they stay valid as long as the loader.
   ProfileInfoLoader(const char *ToolName, const std::string &Filename);
 
   static const uint64_t Uncounted;
+  // Uncounted64 - Marks the optimal edge counts which are not counted but
+  // have to be calculated from the others.
+  static const uint64_t Uncounted64;
 
   unsigned getNumExecutions() const { return CommandLines.size(); }
   const std::string &getExecution(unsigned i) const { return CommandLines[i]; }
 
   const std::string &getFileName() const { return Filename; }
 
+  // Snapshots written by a running program, see LLVMPROF_SNAPSHOT_INTERVAL.
+  // The counts are those written at exit unless useSnapshot is called.
+  unsigned getNumSnapshots() const { return Snapshots.size(); }
+  uint64_t getSnapshotSequence(unsigned i) const {
+    return Snapshots[i].Sequence;
+  }
+  double getSnapshotTime(unsigned i) const { return Snapshots[i].Timestamp; }
+
+  // hasFunctionRecords - Whether the file is an indexed profile, whose counts
+  // can be read one function at a time by getFunctionCounts.
+  bool hasFunctionRecords() const { return !Indexed.empty(); }
+
+  enum RecordStatus { RecordMissing, RecordOutOfDate, RecordFound };
+
+  // getFunctionCounts - Set Counts to the Kind counters of the function Name,
+  // summed over every run whose record has the given CFG checksum.  Records
+  // with another checksum are out of date and ignored.  Kind is one of the
+  // integer counter kinds: EdgeInfo64, BlockInfo64, MPIFullInfo, ValueInfo or
+  // ValueHistInfo.
+  RecordStatus getFunctionCounts(StringRef Name, uint64_t Checksum, int Kind,
+                                 std::vector<uint64_t> &Counts) const;
+
+  // useSnapshot - Replace the counts with those of snapshot Sequence, summed
+  // over every process writing to the file.  If Base is not negative the
+  // counts of snapshot Base are subtracted, giving the counts of the interval
+  // in between.
+  void useSnapshot(const char *ToolName, uint64_t Sequence, int64_t Base = -1);
+
   // getRawFunctionCounts - This method is used by consumers of function
   // counting information.
   //
-  const std::vector<unsigned> &getRawFunctionCounts() const {
-    return FunctionCounts;
+  ArrayRef<unsigned> getRawFunctionCounts() const {
+    return FunctionCounts.get();
   }
 
   // getRawBlockCounts - This method is used by consumers of block counting
   // information.
   //
-  const std::vector<uint64_t> &getRawBlockCounts() const {
-    return BlockCounts;
+  ArrayRef<uint64_t> getRawBlockCounts() const {
+    addIndexed();
+    return BlockCounts.get();
   }
   // getRawTimeMess - This method is used by consumers of mpi time information
-  const std::vector<double> &getRawTimeMess() const{
-    return TimeMess;
+  ArrayRef<double> getRawTimeMess() const{
+    addIndexed();
+    return TimeMess.get();
   }
 
+  // getRawTimeMin/getRawTimeMax - The extremes of the mpi times over all
+  // ranks, only present in files reduced by libprofile_rt_mpi.
+  ArrayRef<double> getRawTimeMin() const { return TimeMin.get(); }
+  ArrayRef<double> getRawTimeMax() const { return TimeMax.get(); }
+
   // getEdgeCounts - This method is used by consumers of edge counting
   // information.
   //
-  const std::vector<uint64_t> &getRawEdgeCounts() const {
-    return EdgeCounts;
+  ArrayRef<uint64_t> getRawEdgeCounts() const {
+    addIndexed();
+    return EdgeCounts.get();
   }
 
   // getEdgeOptimalCounts - This method is used by consumers of optimal edge
   // counting information.
   //
-  const std::vector<unsigned> &getRawOptimalEdgeCounts() const {
-    return OptimalEdgeCounts;
+  ArrayRef<uint64_t> getRawOptimalEdgeCounts() const {
+    return OptimalEdgeCounts.get();
   }
 
-  const std::vector<unsigned> &getRawValueCounts() const {
-	  return ValueCounts;
+  // getRawBBTrace - The basic block numbers in the order they were executed.
+  //
+  ArrayRef<unsigned> getRawBBTrace() const {
+    if (!EncodedBBTrace.empty()) decodeBBTrace();
+    return BBTrace.get();
+  }
+
+  ArrayRef<unsigned> getRawValueCounts() const {
+	  addIndexed();
+	  return ValueCounts.get();
   }
 
   const std::vector<int> &getRawValueContent(int index) const {
+	  addIndexed();
 	  return ValueContents[index];
   }
 
-  const std::vector<unsigned> &getRawSLGCounts() const {
-     return SLGCounts;
+  // hasValueHistograms - Whether the value contents are the histograms of
+  // ValueHistInfo packets rather than every value.
+  bool hasValueHistograms() const {
+     addIndexed();
+     return ValueHistograms;
+  }
+
+  ArrayRef<unsigned> getRawSLGCounts() const {
+     return SLGCounts.get();
   }
 
-  const std::vector<unsigned> &getRawMPICounts() const {
-     return MPICounts;
+  ArrayRef<unsigned> getRawMPICounts() const {
+     return MPICounts.get();
   }
 
-  const std::vector<unsigned> &getRawMPIFullCounts() const {
-     return MPIFullCounters;
+  ArrayRef<unsigned> getRawMPIFullCounts() const {
+     addIndexed();
+     return MPIFullCounters.get();
   }
-  const std::vector<unsigned> &getRawRankCounts() const {
-     return RankCounts;
+  ArrayRef<unsigned> getRawRankCounts() const {
+     return RankCounts.get();
+  }
+
+  // getRawPathCounts - The counts of the PathInfo and PathInfo64 packets,
+  // summed.
+  const PathCountMap &getRawPathCounts() const { return PathCounts; }
+
+  // getRawStats - The distribution over the ranks of the Kind counters, one
+  // entry per counter, empty unless the profile was merged with
+  // -merge=stats.
+  ArrayRef<CounterStats> getRawStats(int Kind) const {
+     std::map<int, ProfileCounters<CounterStats> >::const_iterator Found =
+         Stats.find(Kind);
+     return Found == Stats.end() ? ArrayRef<CounterStats>()
+                                 : Found->second.get();
   }
 
 };
@@ -4,84 +4,98 @@
 #include "ProfileInfoLoader.h"
 #include "ProfileInfoTypes.h"
 #include "ProfileInfoWriter.h"
-#include <llvm/Support/raw_ostream.h>
+#include <string>
+#include <vector>
 
 namespace llvm {
 
+// ProfileInfoMerge - Accumulates the counters of profiles of the same program,
+// as read by ProfileInfoLoader, and writes them out as one profile.
+//
+// Counters are combined with the MergeMode, the uncounted ones of a profile
+// are left out.  They are accumulated in 64 bits and written with the width
+// of their packets, counters of 32 bit packets which overflow are capped.
+// Paths missing from a profile have not been executed.  The minimum and
+// maximum mpi times over all profiles are kept whatever the mode, in a
+// MPITimeRangeInfo packet.  Value contents are gathered: histograms are
+// merged, other values concatenated.  Basic block traces can not be merged
+// and are dropped.
+//
+// MergeStats sums the counters and besides keeps the distribution of every
+// block, edge, MPIFull and mpi time counter over the profiles, written in
+// StatsInfo packets.
+class ProfileInfoMerge {
+public:
+  enum MergeMode { MergeSum, MergeAvg, MergeMax, MergeMin, MergeStats };
 
-class ProfileInfoMerge
-{
-   std::string Filename;
-   std::string Toolname;
-   std::vector<std::string> CommandLines;
-   std::vector<unsigned> FunctionCounts;
-   std::vector<uint64_t> BlockCounts;
-   std::vector<uint64_t> EdgeCounts;
-   std::vector<unsigned> OptimalEdgeCounts;
-   std::vector<unsigned> BBTrace;
-   std::vector<unsigned> ValueCounts;
-   std::vector<unsigned> SLGCounts;
-   std::vector<std::vector<int> > ValueContents; 
-   public:
-   /*Create a initial total data*/
-   explicit ProfileInfoMerge(std::string toolName,std::string fileName,ProfileInfoLoader& AHS) {
-      this->Toolname = toolName;
-      this->Filename = fileName;
-      this->FunctionCounts = AHS.getRawFunctionCounts();
-      this->OptimalEdgeCounts = AHS.getRawOptimalEdgeCounts();
-      this->SLGCounts = AHS.getRawSLGCounts();
-      this->EdgeCounts = AHS.getRawEdgeCounts();
-      this->BlockCounts = AHS.getRawBlockCounts();
-      this->ValueCounts = AHS.getRawValueCounts();
-      for(unsigned i = 0;i < AHS.getNumExecutions();i++){
-         std::string tmp = AHS.getExecution(i);
-         this->CommandLines.push_back(tmp);
-      }
-   }
-   /*Merge the file*/
-   template<class F>
-   void  addProfileInfo(ProfileInfoLoader& THS, F acc) {
-#define MERGEVECTOR(what)                                                      \
-  assert(this->what.size() == THS.getRaw##what().size() && #what               \
-         " size should be equal.");                                            \
-  std::transform(this->what.begin(), this->what.end(),                         \
-                 THS.getRaw##what().begin(), this->what.begin(), acc);
-      MERGEVECTOR(BlockCounts);
-      MERGEVECTOR(OptimalEdgeCounts);
-      MERGEVECTOR(EdgeCounts);
-      MERGEVECTOR(FunctionCounts);
-      MERGEVECTOR(ValueCounts);
-      MERGEVECTOR(SLGCounts);
-#undef MERGEVECTOR
-   }
-   void addProfileInfo(ProfileInfoLoader& THS) {
-      addProfileInfo(THS, std::plus<unsigned>());
-   }
-   /*write totle merging file*/
-   template<class F>
-   void writeTotalFile(F distribution) {
-      ProfileInfoWriter totalFile((this->Toolname.c_str()),this->Filename);
-      std::vector<unsigned> counts;
-#define WRITEVECTOR(info, what)                                                \
-  counts.resize(what.size());                                                  \
-  std::transform(what.begin(), what.end(), counts.begin(), distribution);      \
-  totalFile.write(info, counts);
-      WRITEVECTOR(FunctionInfo, FunctionCounts);
-      WRITEVECTOR(BlockInfo, BlockCounts);
-      WRITEVECTOR(EdgeInfo, EdgeCounts);
-      WRITEVECTOR(OptEdgeInfo, OptimalEdgeCounts);
-      WRITEVECTOR(SLGInfo, SLGCounts);
-      for(unsigned i = 0;i < this->CommandLines.size();i++){
-         totalFile.write(this->CommandLines[i]);
-      }
-#undef WRITEVECTOR
-   }
-   void writeTotalFile() {
-      /** x + 0 --> x ; it doesn't make any distribution **/
-      writeTotalFile(std::bind2nd(std::plus<unsigned>(), 0));
-   }
+  // Distribution - The values of a counter over the profiles, in one
+  // streaming pass: their extremes, running mean and squared deviation, and
+  // how many fall in every quarter of an octave for the percentiles.
+  struct Distribution {
+    uint64_t N;
+    double Min, Max, Mean, M2;
+    unsigned MaxRank;
+    std::vector<std::pair<unsigned short, unsigned> > Buckets;
+
+    Distribution() : N(0), Min(0), Max(0), Mean(0), M2(0), MaxRank(0) {}
+    void add(double Value, unsigned Rank);
+    void add(const Distribution &D);
+    double percentile(double P) const;
+    CounterStats get() const;
+  };
+
+private:
+  MergeMode Mode;
+  unsigned NumProfiles;
+  std::vector<std::string> CommandLines;
+  std::vector<uint64_t> FunctionCounts;
+  std::vector<uint64_t> BlockCounts;
+  std::vector<uint64_t> EdgeCounts;
+  std::vector<uint64_t> OptimalEdgeCounts;
+  std::vector<uint64_t> ValueCounts;
+  std::vector<std::vector<int> > ValueContents;
+  bool ValueHistograms;
+  std::vector<uint64_t> SLGCounts;
+  std::vector<uint64_t> MPICounts;
+  std::vector<uint64_t> MPIFullCounts;
+  std::vector<unsigned> RankCounts;  // the lowest rank
+  ProfileInfoLoader::PathCountMap PathCounts;
+  std::vector<double> TimeMess;
+  std::vector<double> TimeMin;
+  std::vector<double> TimeMax;
+  bool HasBBTrace;
+  // only in MergeStats mode
+  std::vector<Distribution> BlockStats;
+  std::vector<Distribution> EdgeStats;
+  std::vector<Distribution> MPIFullStats;
+  std::vector<Distribution> TimeStats;
+
+public:
+  explicit ProfileInfoMerge(MergeMode Mode = MergeSum);
+
+  unsigned getNumProfiles() const { return NumProfiles; }
+
+  // addProfileInfo - Fold in the counters of a profile.  Rank identifies it in
+  // the distributions unless it has a RankInfo packet.
+  void addProfileInfo(const ProfileInfoLoader &PIL, unsigned Rank = 0);
+  // addProfileInfo - Fold in the profiles accumulated by another merge with
+  // the same mode, which come after those of this one.
+  void addProfileInfo(const ProfileInfoMerge &PIM);
+
+  // writeTotalFile - Write the merged counters to Filename, averaged over the
+  // profiles in MergeAvg mode.
+  void writeTotalFile(const char *ToolName, const std::string &Filename) const;
 };
 
+// mergeProfiles - Merge the profiles Inputs into Output.  The inputs are split
+// into NumThreads runs of files, each folded by its own thread into one
+// accumulator, so only NumThreads profiles are loaded at any time.  The
+// accumulators are then reduced pairwise in a tree.  NumThreads 0 uses a
+// thread per core.
+void mergeProfiles(const char *ToolName, const std::vector<std::string> &Inputs,
+                   const std::string &Output, ProfileInfoMerge::MergeMode Mode,
+                   unsigned NumThreads = 0);
+
 }
 
 #endif
@@ -16,6 +16,8 @@
 #ifndef LLVM_ANALYSIS_PROFILEINFOTYPES_H
 #define LLVM_ANALYSIS_PROFILEINFOTYPES_H
 
+#include <stdint.h>
+
 /* Included by libprofile. */
 #if defined(__cplusplus)
 extern "C" {
@@ -45,6 +47,80 @@ typedef struct {
   unsigned pathCounter;
 } PathProfileTableEntry;
 
+/*
+ * An entry of a PathInfo64 table.
+ */
+typedef struct {
+  unsigned pathNumber;
+  unsigned reserved;
+  uint64_t pathCounter;
+} PathProfileTableEntry64;
+
+/*
+ * An IndexedInfo packet keeps the counters of every function together in a
+ * record, so that one function can be looked up without reading the others
+ * and a function changed since the profile was taken is rejected alone:
+ *
+ *   int type, unsigned version, uint64_t size of the rest of the packet,
+ *   IndexedHeader, numFunctions IndexedFunction entries sorted by name,
+ *   the names (NUL terminated), the records
+ *
+ * A record is a sequence of slices, each an IndexedSlice followed by its
+ * counters.  All sizes are multiples of 8.
+ */
+typedef struct {
+  uint64_t numFunctions;
+  uint64_t namesSize;
+  uint64_t recordsSize;
+} IndexedHeader;
+
+typedef struct {
+  uint64_t checksum;      /* CFG checksum of the function */
+  uint64_t nameOffset;    /* into the names */
+  uint64_t recordOffset;  /* into the records */
+  uint64_t recordSize;
+} IndexedFunction;
+
+typedef struct {
+  int kind;               /* ProfilingType of the counter array */
+  unsigned reserved;
+  uint64_t first;         /* index of the first counter in the array */
+  uint64_t numEntries;
+  uint64_t size;          /* bytes of counters which follow */
+} IndexedSlice;
+
+/*
+ * Counters of a counter array which belong to one function, as described to
+ * the runtime by llvm_index_counter_array.
+ */
+typedef struct {
+  const char *name;
+  uint64_t checksum;
+  uint64_t first;
+  uint64_t numCounters;
+} IndexedCounters;
+
+/*
+ * A StatsInfo packet describes how the counters of one packet kind are
+ * distributed over the merged profiles, typically those of the ranks of a MPI
+ * job:
+ *
+ *   int type, int kind, uint64_t numEntries, numEntries CounterStats
+ *
+ * The percentiles are estimated to within a quarter of an octave.
+ */
+typedef struct {
+  double min;
+  double max;
+  double mean;
+  double stddev;
+  double p50;
+  double p90;
+  double p99;
+  unsigned argmaxRank;    /* first rank with the maximum */
+  unsigned numRanks;      /* ranks which counted it */
+} CounterStats;
+
 #if defined(__cplusplus)
 }
 #endif
@@ -3,6 +3,8 @@
 
 #include "ProfileInfoLoader.h"
 #include "ProfileInfoTypes.h"
+#include <string>
+#include <vector>
 
 namespace llvm {
 
@@ -21,6 +23,44 @@ class ProfileInfoWriter {
     * @param Counter: a Array of unsigned Counter
     */
    void write(ProfilingType Type, const std::vector<unsigned>& Counter);
+   /* write 64 bit counters, whose entry count is 64 bit as well
+    * @param Type: BlockInfo64, EdgeInfo64 or OptEdgeInfo64
+    */
+   void write(ProfilingType Type, const std::vector<uint64_t>& Counter);
+   /* write double counters
+    * @param Type: MPITimeInfo or BlockInfoDouble
+    */
+   void write(ProfilingType Type, const std::vector<double>& Counter);
+   /* write the minimum and maximum of every mpi time as a MPITimeRangeInfo
+    * packet, Min and Max have the same size */
+   void writeTimeRange(const std::vector<double>& Min,
+                       const std::vector<double>& Max);
+   /* write the counts of the value sites followed by their contents
+    * @param Type: ValueInfo or ValueHistInfo
+    */
+   void writeValues(ProfilingType Type, const std::vector<unsigned>& Counts,
+                    const std::vector<std::vector<int> >& Contents);
+   /* write the path counts as a PathInfo64 packet */
+   void writePaths(const ProfileInfoLoader::PathCountMap& Paths);
+   /* write the distribution of the Kind counters as a StatsInfo packet */
+   void writeStats(ProfilingType Kind, const std::vector<CounterStats>& Stats);
+
+   /* the 64 bit counters of one counter array which belong to a function,
+    * First is the index of the first one in the array */
+   struct IndexedSlice {
+      ProfilingType Kind;
+      uint64_t First;
+      std::vector<uint64_t> Counters;
+   };
+   struct IndexedRecord {
+      std::string Name;
+      uint64_t Checksum;  /* see FunctionCFGChecksum */
+      std::vector<IndexedSlice> Slices;
+   };
+   /* write the records as an IndexedInfo packet, see ProfileInfoTypes.h
+    * @param Records: at most one record per name and checksum, in any order
+    */
+   void writeIndexed(std::vector<IndexedRecord> Records);
 };
 
 }
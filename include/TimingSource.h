@@ -3,6 +3,7 @@
 
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/GlobalVariable.h>
 #include <llvm/Support/raw_ostream.h>
 
@@ -56,11 +57,17 @@ class TimingSource{
       init(std::bind(file_initializer, file, std::placeholders::_1));
    }
    Kind getKind() const { return kindof;}
+   /* the parameter file, given as kind@file or else taken from the
+    * positional arguments in order.
+    */
+   const std::string& getFile() const { return param_file; }
+   void setFile(llvm::StringRef File) { param_file = File.str(); }
 
    virtual void print(llvm::raw_ostream&) const;
 
    protected:
    Kind kindof;
+   std::string param_file;
    void (*file_initializer)(const char* file, double* data);
    std::vector<double> params;
 
@@ -72,6 +79,40 @@ class TimingSource{
    static void Register_(const char* Name, const char* Desc, std::function<TimingSource*()> &&);
 };
 
+/* the number of instructions of every group in every block of a module.
+ * the counts are kept by group, one column over all the blocks for every
+ * group, so costing all the blocks is a loop over the columns.  they are
+ * 32 bit, a module of millions of blocks still takes 4 bytes per block and
+ * group.
+ */
+class BlockHistogram
+{
+   public:
+   /* number the blocks of M in order, all their counts zero */
+   BlockHistogram(llvm::Module& M, unsigned NumGroups);
+
+   unsigned getNumBlocks() const { return Blocks.size(); }
+   unsigned getNumGroups() const { return NumGroups; }
+   /* ~0U for a block not of the module */
+   unsigned getBlockNumber(const llvm::BasicBlock* BB) const {
+      auto Found = Numbers.find(BB);
+      return Found == Numbers.end() ? ~0U : Found->second;
+   }
+   llvm::BasicBlock* getBlock(unsigned N) const { return Blocks[N]; }
+   uint32_t* column(unsigned Group) {
+      return Counts.data() + (size_t)Group * Blocks.size();
+   }
+   const uint32_t* column(unsigned Group) const {
+      return Counts.data() + (size_t)Group * Blocks.size();
+   }
+
+   private:
+   unsigned NumGroups;
+   std::vector<llvm::BasicBlock*> Blocks;
+   llvm::DenseMap<const llvm::BasicBlock*, unsigned> Numbers;
+   std::vector<uint32_t> Counts;
+};
+
 class BBlockTiming: public TimingSource
 {
    public:
@@ -81,8 +122,23 @@ class BBlockTiming: public TimingSource
              && S->getKind() > Kind::BBlock;
    }
    virtual double count(llvm::BasicBlock& BB) const = 0;
+
+   /* whether the cost of a block is the sum of the params of the groups of
+    * its instructions, so that it can be costed from a BlockHistogram.
+    */
+   virtual bool isLinear() const { return false; }
+   unsigned getNumGroups() const { return params.size(); }
+   /* count the instructions of every group in block N of H */
+   void countGroups(BlockHistogram& H, unsigned N) const;
+   /* the cost of every block of H, by block number */
+   void blockCosts(const BlockHistogram& H, std::vector<double>& Costs) const;
+   /* the cost of all the blocks of H, block N executed Freqs[N] times */
+   double count(const BlockHistogram& H, const std::vector<double>& Freqs) const;
+
    protected:
    BBlockTiming(Kind K, size_t N):TimingSource(K,N) {}
+   /* the group of the param costing I, for a linear timing source */
+   virtual unsigned group(llvm::Instruction& I) const { return params.size()-1; }
 };
 
 class MPITiming: public TimingSource
@@ -167,6 +223,10 @@ class LmbenchTiming : public BBlockTiming,
 
    double count(llvm::Instruction& I) const; // caculation part
    double count(llvm::BasicBlock& BB) const override; // caculation part
+   using BBlockTiming::count;
+   bool isLinear() const override { return true; }
+   protected:
+   unsigned group(llvm::Instruction& I) const override { return classify(&I); }
 };
 
 enum IrinstGroups {
@@ -195,11 +255,15 @@ class IrinstTiming : public BBlockTiming,
 
    double count(llvm::Instruction& I) const; // caculation part
    double count(llvm::BasicBlock& BB) const override; // caculation part
+   using BBlockTiming::count;
+   bool isLinear() const override { return true; }
 
    //add by haomeng, Calculate the num of instruction
    double ir_count(llvm::BasicBlock& BB) const;
    //add by haomeng, Calculate the num of instruction
    //double mpi_count(llvm::BasicBlock& BB) const;
+   protected:
+   unsigned group(llvm::Instruction& I) const override { return classify(&I); }
 };
 
 class IrinstMaxTiming: public IrinstTiming
@@ -211,6 +275,9 @@ class IrinstMaxTiming: public IrinstTiming
    }
    IrinstMaxTiming();
    double count(llvm::BasicBlock& BB) const override;
+   using BBlockTiming::count;
+   // the cost of the float and the fixed point instructions is a max
+   bool isLinear() const override { return false; }
 };
 
 class MPBenchReTiming : public MPITiming 
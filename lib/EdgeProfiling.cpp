@@ -26,8 +26,10 @@
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 #include "ProfilingUtils.h"
+#include "ProfileDataTypes.h"
 #include "InitializeProfilerPass.h"
 #include "ProfileInstrumentations.h"
+#include "ProfileInfoLoader.h"
 #include <set>
 using namespace llvm;
 
@@ -67,9 +69,11 @@ bool EdgeProfiler::runOnModule(Module &M) {
   }
 
   std::set<BasicBlock*> BlocksToInstrument;
+  std::vector<IndexedRange> Ranges;
   unsigned NumEdges = 0;
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
     if (F->isDeclaration()) continue;
+    unsigned First = NumEdges;
     // Reserve space for (0,entry) edge.
     ++NumEdges;
     for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -79,6 +83,8 @@ bool EdgeProfiler::runOnModule(Module &M) {
       BlocksToInstrument.insert(BB);
       NumEdges += BB->getTerminator()->getNumSuccessors();
     }
+    Ranges.push_back(IndexedRange(F, FunctionCFGChecksum(F), First,
+                                  NumEdges - First));
   }
 
   Type *ATy = ArrayType::get(Type::getInt64Ty(M.getContext()), NumEdges);
@@ -119,6 +125,10 @@ bool EdgeProfiler::runOnModule(Module &M) {
 
   // Add the initialization call to main.
   InsertProfilingInitCall(Main, "llvm_start_edge_profiling", Counters);
+  PromoteLoopCounters(Counters);
+  if (!ShardCounterArray(Counters, EdgeInfo64))
+    MapCounterArray(Counters, EdgeInfo64);
+  IndexCounterArray(Counters, EdgeInfo64, Ranges);
   return true;
 }
 
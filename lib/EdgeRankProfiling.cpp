@@ -146,6 +146,8 @@ bool EdgeRankProfiler::runOnModule(Module &M) {
    // Add the initialization call to main.
    // InsertPredMPIProfilingInitCall
    InsertPredMPIProfilingInitCall(Main, "llvm_start_edge_rank_profiling", Counters, RankCounters);
+   if (!ShardCounterArray(Counters, EdgeInfo64))
+     MapCounterArray(Counters, EdgeInfo64);
    return true;
 }
 
@@ -9,6 +9,7 @@
 #include "ProfilingUtils.h"
 #include "ProfileInstrumentations.h"
 #include "ProfileDataTypes.h"
+#include "ProfileInfoLoader.h"
 
 namespace {
    class MPIProfiler : public llvm::ModulePass
@@ -53,13 +54,19 @@ bool MPIProfiler::runOnModule(llvm::Module &M)
   }
 
   std::vector<std::pair<CallInst*,unsigned> > Traped;
+  std::vector<IndexedRange> Ranges;
   for(auto F = M.begin(), E = M.end(); F!=E; ++F){
+     unsigned First = Traped.size();
      for(auto I = inst_begin(*F), IE = inst_end(*F); I!=IE; ++I){
         CallInst* CI = dyn_cast<CallInst>(&*I);
         if(CI == NULL) continue;
         if(unsigned idx = get_mpi_count_idx(CI)) // idx > 0
            Traped.emplace_back(CI, idx);
      }
+     // the datatype tables behind the traps are not written out
+     if(Traped.size() != First)
+        Ranges.push_back(IndexedRange(F, FunctionCFGChecksum(F), First,
+                                      Traped.size() - First));
   }
 
   IRBuilder<> Builder(M.getContext());
@@ -89,5 +96,6 @@ bool MPIProfiler::runOnModule(llvm::Module &M)
   }
 
   InsertProfilingInitCall(Main, "llvm_start_mpi_profiling", Counters);
+  IndexCounterArray(Counters, MPIFullInfo, Ranges);
   return true;
 }
@@ -26,6 +26,7 @@ using namespace std;
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 #include "ProfilingUtils.h"
+#include "ProfileDataTypes.h"
 #include "ProfileInfo.h"
 #include "ProfileInfoLoader.h"
 #include "InitializeProfilerPass.h"
@@ -122,16 +123,16 @@ bool OptimalEdgeProfiler::runOnModule(Module &M) {
   // be calculated from other edge counters on reading the profile info back
   // in.
 
-  Type *Int32 = Type::getInt32Ty(M.getContext());
-  ArrayType *ATy = ArrayType::get(Int32, NumEdges);
+  Type *Int64 = Type::getInt64Ty(M.getContext());
+  ArrayType *ATy = ArrayType::get(Int64, NumEdges);
   GlobalVariable *Counters =
     new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
                        Constant::getNullValue(ATy), "OptEdgeProfCounters");
   NumEdgesInserted = 0;
 
   std::vector<Constant*> Initializer(NumEdges);
-  Constant *Zero = ConstantInt::get(Int32, 0);
-  Constant *Uncounted = ConstantInt::get(Int32, ProfileInfoLoader::Uncounted);
+  Constant *Zero = ConstantInt::get(Int64, 0);
+  Constant *Uncounted = ConstantInt::get(Int64, ProfileInfoLoader::Uncounted64);
 
   // Instrument all of the edges not in MST...
   unsigned i = 0;
@@ -230,6 +231,10 @@ bool OptimalEdgeProfiler::runOnModule(Module &M) {
 
   // Add the initialization call to main.
   InsertProfilingInitCall(Main, "llvm_start_opt_edge_profiling", Counters);
+  PromoteLoopCounters(Counters);
+  // Not sharded: every per thread copy would start with the -1 of the edges
+  // which are not counted.
+  MapCounterArray(Counters, OptEdgeInfo64);
   return true;
 }
 
@@ -70,8 +70,10 @@ namespace {
     // process argument info of a program from the input file
     void handleArgumentInfo();
 
-    // process path number information from the input file
-    void handlePathInfo();
+    // process path number information from the input file, EntryT is
+    // PathProfileTableEntry for PathInfo and PathProfileTableEntry64 for
+    // PathInfo64
+    template<class EntryT> void handlePathInfo();
 
     // array of references to the functions in the module
     std::vector<Function*> _functions;
@@ -113,7 +115,7 @@ ProfilePathEdge::ProfilePathEdge (BasicBlock* source, BasicBlock* target,
 // Path implementation
 //
 
-ProfilePath::ProfilePath (unsigned int number, unsigned int count,
+ProfilePath::ProfilePath (unsigned int number, uint64_t count,
                           double countStdDev,   PathProfileInfo* ppi)
   : _number(number) , _count(count), _countStdDev(countStdDev), _ppi(ppi) {}
 
@@ -309,7 +311,10 @@ bool PathProfileLoaderPass::runOnModule(Module &M) {
       handleArgumentInfo ();
       break;
     case PathInfo:
-      handlePathInfo ();
+      handlePathInfo<PathProfileTableEntry> ();
+      break;
+    case PathInfo64:
+      handlePathInfo<PathProfileTableEntry64> ();
       break;
     default:
       errs () << "error: bad path profiling file syntax, " << profType << "\n";
@@ -358,6 +363,7 @@ void PathProfileLoaderPass::handleArgumentInfo() {
 }
 
 // Handle path profile information in the output file
+template<class EntryT>
 void PathProfileLoaderPass::handlePathInfo () {
   // get the number of functions in this profile
   unsigned functionCount;
@@ -377,10 +383,9 @@ void PathProfileLoaderPass::handlePathInfo () {
     Function* f = _functions[pathHeader.fnNumber];
 
     // dynamically allocate a table to store path numbers
-    PathProfileTableEntry* pathTable =
-      new PathProfileTableEntry[pathHeader.numEntries];
+    EntryT* pathTable = new EntryT[pathHeader.numEntries];
 
-    if( fread(pathTable, sizeof(PathProfileTableEntry),
+    if( fread(pathTable, sizeof(EntryT),
               pathHeader.numEntries, _file) != pathHeader.numEntries) {
       delete [] pathTable;
       errs() << "warning: path function info header/data mismatch\n";
@@ -388,7 +393,7 @@ void PathProfileLoaderPass::handlePathInfo () {
     }
 
     // Build a new path for the current function
-    unsigned int totalPaths = 0;
+    uint64_t totalPaths = 0;
     for (unsigned int j = 0; j < pathHeader.numEntries; j++) {
       totalPaths += pathTable[j].pathCounter;
       _functionPaths[f][pathTable[j].pathNumber]
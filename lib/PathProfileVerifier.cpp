@@ -109,7 +109,7 @@ bool PathProfileVerifier::runOnModule (Module &M) {
     }
   }
 
-  std::vector<unsigned> edgeArray(i);
+  std::vector<uint64_t> edgeArray(i);
 
   // iterate through each path and increment the edge counters as needed
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
@@ -197,15 +197,15 @@ bool PathProfileVerifier::runOnModule (Module &M) {
   if (num&3)
     fwrite(&zeros, 1, 4-(num&3), edgeFile);
 
-  type = EdgeInfo;
-  num = edgeArray.size();
+  // path counts are 64 bit, so are the edge counts derived from them
+  type = EdgeInfo64;
+  uint64_t numEdges = edgeArray.size();
   fwrite(&type,sizeof(unsigned),1,edgeFile);
-  fwrite(&num,sizeof(unsigned),1,edgeFile);
+  fwrite(&numEdges,sizeof(uint64_t),1,edgeFile);
 
   // write each edge to the file
-  for( std::vector<unsigned>::iterator s = edgeArray.begin(),
-         e = edgeArray.end(); s != e; s++)
-    fwrite(&*s, sizeof (unsigned), 1, edgeFile);
+  if (numEdges)
+    fwrite(&edgeArray[0], sizeof (uint64_t), numEdges, edgeFile);
 
   fclose (edgeFile);
 
@@ -1,6 +1,8 @@
 #include "preheader.h"
 #include "PredBlockDoubleProfiling.h"
 #include "ProfilingUtils.h"
+#include "ProfileDataTypes.h"
+#include "ProfileInfoLoader.h"
 
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
@@ -52,8 +54,13 @@ bool PredBlockDoubleProfiler::runOnModule(Module& M)
    IRBuilder<> Builder(M.getContext());
 
    unsigned NumBlocks = 0;
-   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+   std::vector<IndexedRange> Ranges;
+   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+      if (!F->isDeclaration())
+         Ranges.push_back(IndexedRange(F, FunctionCFGChecksum(F), NumBlocks,
+                                       F->size()));
       NumBlocks += F->size();
+   }
 
 	Type*ATy = ArrayType::get(Type::getDoubleTy(M.getContext()),NumBlocks);
 	GlobalVariable* Counters = new GlobalVariable(M, ATy, false,
@@ -80,5 +87,8 @@ bool PredBlockDoubleProfiler::runOnModule(Module& M)
 
 	Function* Main = M.getFunction("main");
 	InsertPredProfilingInitCall(Main, "llvm_start_pred_double_block_profiling", Counters);
+	PromoteLoopCounters(Counters);
+	MapCounterArray(Counters, BlockInfoDouble);
+	IndexCounterArray(Counters, BlockInfoDouble, Ranges);
 	return true;
 }
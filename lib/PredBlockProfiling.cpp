@@ -1,6 +1,8 @@
 #include "preheader.h"
 #include "PredBlockProfiling.h"
 #include "ProfilingUtils.h"
+#include "ProfileDataTypes.h"
+#include "ProfileInfoLoader.h"
 
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
@@ -48,8 +50,13 @@ bool PredBlockProfiler::runOnModule(Module& M)
    IRBuilder<> Builder(M.getContext());
 
    unsigned NumBlocks = 0;
-   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+   std::vector<IndexedRange> Ranges;
+   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+      if (!F->isDeclaration())
+         Ranges.push_back(IndexedRange(F, FunctionCFGChecksum(F), NumBlocks,
+                                       F->size()));
       NumBlocks += F->size();
+   }
 
   Type*ATy = ArrayType::get(Type::getInt64Ty(M.getContext()),NumBlocks);
 	GlobalVariable* Counters = new GlobalVariable(M, ATy, false,
@@ -76,5 +83,9 @@ bool PredBlockProfiler::runOnModule(Module& M)
 
 	Function* Main = M.getFunction("main");
 	InsertProfilingInitCall(Main, "llvm_start_pred_block_profiling", Counters);
+	PromoteLoopCounters(Counters);
+	if (!ShardCounterArray(Counters, BlockInfo64))
+	   MapCounterArray(Counters, BlockInfo64);
+	IndexCounterArray(Counters, BlockInfo64, Ranges);
 	return true;
 }
@@ -328,6 +328,7 @@ bool ProfileEstimatorPass::runOnFunction(Function &F) {
 
   // Fetch LoopInfo and clear ProfileInfo for this function.
   LI = &getAnalysis<LoopInfo>();
+  Dense.clear();
   FunctionInformation.erase(&F);
   BlockInformation[&F].clear();
   EdgeInformation[&F].clear();
@@ -18,6 +18,7 @@
 #include <llvm/CodeGen/MachineBasicBlock.h>
 #include <llvm/CodeGen/MachineFunction.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
 #include "ProfileInfo.h"
 #include "InitializeProfilerPass.h"
@@ -82,6 +83,13 @@ ProfileInfoT<Function,BasicBlock>::getMPITime(const CallInst* V) {
 	return MissingValue;
 }
 
+template<> unsigned
+ProfileInfoT<Function,BasicBlock>::getMPITimeIndex(const CallInst* V) {
+   auto T = MPITimeInformation.find(V);
+   if(T != MPITimeInformation.end()) return T->second.first;
+   return -1;
+}
+
 template<> const Value*
 ProfileInfoT<Function,BasicBlock>::getTrapedTarget(const Instruction* V)
 {
@@ -95,35 +103,65 @@ ProfileInfoT<Function,BasicBlock>::getTrapedTarget(const Instruction* V)
    return NULL;
 }
 
-template<> const std::vector<int>&
+uint64_t ValueRuns::size() const {
+	uint64_t N = 0;
+	for(iterator I = begin(), E = end(); I != E; ++I) N += (*I).Count;
+	return N;
+}
+
+double ValueRuns::sum() const {
+	double Sum = 0;
+	for(iterator I = begin(), E = end(); I != E; ++I)
+		Sum += (double)(*I).Value * (*I).Count;
+	return Sum;
+}
+
+std::map<int, uint64_t> ValueRuns::histogram() const {
+	std::map<int, uint64_t> Counts;
+	for(iterator I = begin(), E = end(); I != E; ++I)
+		Counts[(*I).Value] += (*I).Count;
+	return Counts;
+}
+
+std::vector<int> ValueRuns::distinct() const {
+	std::vector<int> Values;
+	for(iterator I = begin(), E = end(); I != E; ++I)
+		if((*I).Count) Values.push_back((*I).Value);
+	std::sort(Values.begin(), Values.end());
+	Values.erase(std::unique(Values.begin(), Values.end()), Values.end());
+	return Values;
+}
+
+template<> ValueRuns
+ProfileInfoT<Function,BasicBlock>::getValueRuns(const CallInst* V) {
+	std::map<const CallInst*,ValueCounts>::iterator J =
+		ValueInformation.find(V);
+	if(J == ValueInformation.end()) return ValueRuns();
+	if(J->second.flags & CONSTANT_COMPRESS)
+		return ValueRuns(cast<ConstantInt>(getTrapedTarget(V))->getZExtValue(),
+		                 J->second.Nums);
+	// value, count pairs, for a histogram the most frequent value first
+	return ValueRuns(J->second.Contents,
+	                 J->second.flags & (RUN_LENGTH_COMPRESS | VALUE_HISTOGRAM));
+}
+
+template<> std::vector<int>
 ProfileInfoT<Function,BasicBlock>::getValueContents(const CallInst* V) {
-	static std::vector<int> MissingContent(0);
-	static std::vector<int> ConstantContent;
-	static std::vector<int> UnCompress;
+	ValueRuns Runs = getValueRuns(V);
+	std::vector<int> Contents;
+	Contents.reserve(Runs.size());
+	for(ValueRuns::iterator I = Runs.begin(), E = Runs.end(); I != E; ++I)
+		Contents.insert(Contents.end(), (*I).Count, (*I).Value);
+	return Contents;
+}
+
+template<> unsigned
+ProfileInfoT<Function,BasicBlock>::getValueOtherCount(const CallInst* V) {
 	std::map<const CallInst*,ValueCounts>::iterator J =
 		ValueInformation.find(V);
-	if(J != ValueInformation.end()){
-		if(J->second.flags & CONSTANT_COMPRESS){
-			ConstantContent.resize(J->second.Nums);
-			int filled = cast<ConstantInt>(getTrapedTarget(V))->getZExtValue();
-			std::fill(ConstantContent.begin(), ConstantContent.end(), filled);
-			return ConstantContent;
-		}else if(J->second.flags & RUN_LENGTH_COMPRESS){
-			UnCompress.resize(J->second.Nums);
-			std::vector<int>::iterator write = UnCompress.begin();
-			for(std::vector<int>::const_iterator I = J->second.Contents.begin(),
-					E = J->second.Contents.end();I<E;I+=2){
-				int value = *I;
-				size_t len = *(I+1);
-				std::fill(write,write+len,value);
-				write+=len;
-			}
-			return UnCompress;
-
-		}
-		return J->second.Contents;
-	}
-	return MissingContent;
+	if(J != ValueInformation.end() && J->second.flags & VALUE_HISTOGRAM)
+		return J->second.Other;
+	return 0;
 }
 
 template<> unsigned
@@ -147,49 +185,37 @@ ProfileInfoT<Function,BasicBlock>::getTrapedIndex(const Instruction* V)
    return -1;
 }
 
-struct SortBasedIndex{
-   ProfileInfo& PI;
-   SortBasedIndex(ProfileInfo& PI):PI(PI) {}
-   int operator()(const Instruction* a, const Instruction* b)
-   {
-      return PI.getTrapedIndex(a) < PI.getTrapedIndex(b);
-   }
-};
-
-struct SortBasedTime{
-   ProfileInfo& PI;
-   SortBasedTime(ProfileInfo& PI):PI(PI){}
-   int operator()(const Instruction* a, const Instruction* b)
-   {
-      const CallInst* aC = cast<CallInst>(a);
-      const CallInst* bC = cast<CallInst>(b);
-      if(aC != NULL && bC != NULL)
-          return PI.getMPITime(aC) > PI.getMPITime(bC);
-      return 0;
-   }
-};
-
-template<> std::vector<const Instruction*>
-ProfileInfoT<Function,BasicBlock>::getAllTrapedValues(ProfilingType PT) {
-	std::vector<const Instruction*> ret;
+// SortKey - Orders the traped instructions by counter index, and the mpi
+// calls with a time by decreasing time.
+typedef std::pair<std::pair<double, unsigned>, const Instruction*> SortKey;
+
+template<> void
+ProfileInfoT<Function,BasicBlock>::buildTrapSites() {
+   SortedTraps.clear();
+   std::vector<SortKey> Keys;
+   auto Sort = [&](ProfilingType PT) {
+      if(Keys.empty()) return;
+      std::sort(Keys.begin(), Keys.end());
+      TrapSites& T = SortedTraps[PT];
+      T.Sites.reserve(Keys.size());
+      for(unsigned i = 0, e = Keys.size(); i != e; ++i){
+         T.Sites.push_back(Keys[i].second);
+         T.Slots[Keys[i].second] = i;
+      }
+      Keys.clear();
+   };
 #define SELECT(what) \
-   if(PT == what##Info){\
-      ret.reserve(what##Information.size());\
-      auto J = what##Information.begin(),\
-      E = what##Information.end();\
-      for(;J!=E;++J) ret.push_back(J->first);\
-   }
+   for(auto J = what##Information.begin(), E = what##Information.end(); J != E; ++J)\
+      Keys.push_back(SortKey(std::make_pair(0., getTrapedIndex(J->first)), J->first));\
+   Sort(what##Info);
    SELECT(Value);
    SELECT(SLG);
    SELECT(MP);
    SELECT(MPIFull);
-   SELECT(MPITime);
-  if(PT != MPITimeInfo)
-	   std::sort(ret.begin(), ret.end(), SortBasedIndex(*this));
-  else
-     std::sort(ret.begin(), ret.end(), SortBasedTime(*this));
 #undef SELECT
-	return ret;
+   for(auto J = MPITimeInformation.begin(), E = MPITimeInformation.end(); J != E; ++J)
+      Keys.push_back(SortKey(std::make_pair(-J->second.second, J->second.first), J->first));
+   Sort(MPITimeInfo);
 }
 
 template<> int
@@ -201,6 +227,11 @@ ProfileInfoT<Function, BasicBlock>::getRankValue(ProfilingType PT){
 
 template<> double
 ProfileInfoT<Function,BasicBlock>::getExecutionCount(const BasicBlock *BB) {
+  if (hasDenseIndex()) {
+    unsigned N = getBlockNumber(BB);
+    if (N != ~0U) return Dense.BlockCounts[N];
+  }
+
   std::map<const Function*, BlockCounts>::iterator J =
     BlockInformation.find(BB->getParent());
   if (J != BlockInformation.end()) {
@@ -279,6 +310,11 @@ double ProfileInfoT<MachineFunction, MachineBasicBlock>::
 
 template<>
 double ProfileInfoT<Function,BasicBlock>::getExecutionCount(const Function *F) {
+  if (hasDenseIndex()) {
+    unsigned N = getFunctionNumber(F);
+    if (N != ~0U) return Dense.FunctionCounts[N];
+  }
+
   std::map<const Function*, double>::iterator J =
     FunctionInformation.find(F);
   if (J != FunctionInformation.end())
@@ -306,11 +342,144 @@ double ProfileInfoT<MachineFunction, MachineBasicBlock>::
   return Count;
 }
 
+template<>
+void ProfileInfoT<Function,BasicBlock>::buildDenseIndex(Module &M) {
+  Dense.clear();
+  DenseIndex Index;
+  for (Module::const_iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+    if (F->isDeclaration()) continue;
+    Index.Functions[F] = Index.FunctionCounts.size();
+    Index.FunctionCounts.push_back(MissingValue);
+    for (Function::const_iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+      Index.Blocks[BB] = Index.BlockCounts.size();
+      Index.BlockCounts.push_back(MissingValue);
+    }
+  }
+  unsigned NumBlocks = Index.BlockCounts.size();
+
+  // The edges of a function are ordered by their source in EdgeInformation,
+  // so those leaving a block, or entering the function, are adjacent.
+  auto AddEdges = [&](const Function *F, const BasicBlock *Src) {
+    Index.FirstEdge.push_back(Index.EdgeDests.size());
+    std::map<const Function*, EdgeWeights>::const_iterator J =
+      EdgeInformation.find(F);
+    if (J == EdgeInformation.end()) return;
+    for (EdgeWeights::const_iterator I = J->second.lower_bound(getEdge(Src, 0)),
+         E = J->second.end(); I != E && I->first.first == Src; ++I) {
+      Index.EdgeDests.push_back(I->first.second);
+      Index.EdgeCounts.push_back(I->second);
+    }
+  };
+  for (Module::const_iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+    if (F->isDeclaration()) continue;
+    for (Function::const_iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+      AddEdges(F, BB);
+  }
+  for (Module::const_iterator F = M.begin(), FE = M.end(); F != FE; ++F)
+    if (!F->isDeclaration()) AddEdges(F, 0);
+  Index.FirstEdge.push_back(Index.EdgeDests.size());
+
+  auto FindEdge = [&](unsigned Slot, const BasicBlock *Dest) -> double {
+    for (unsigned i = Index.FirstEdge[Slot], E = Index.FirstEdge[Slot + 1];
+         i != E; ++i)
+      if (Index.EdgeDests[i] == Dest) return Index.EdgeCounts[i];
+    return MissingValue;
+  };
+
+  // Derive the counts missing from BlockInformation in one sweep over the
+  // blocks of every function, the same way getExecutionCount does one block
+  // at a time: from the edges of all predecessors, or of the entry edge if
+  // there is none, otherwise from the edges to all successors, or the exit
+  // edge if there is none.
+  std::vector<double> InCount, OutCount;
+  std::vector<unsigned> NumPreds, InEdges;
+  std::vector<bool> OutKnown;
+  SmallVector<const BasicBlock*, 8> Succs;
+  unsigned Uncounted = 0, UncountedFunctions = 0, Unbalanced = 0;
+  for (Module::const_iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+    if (F->isDeclaration()) continue;
+    unsigned FunctionNumber = Index.Functions[F];
+    unsigned First = Index.Blocks[&F->getEntryBlock()], N = F->size();
+    InCount.assign(N, 0);
+    OutCount.assign(N, 0);
+    NumPreds.assign(N, 0);
+    InEdges.assign(N, 0);
+    OutKnown.assign(N, true);
+    unsigned i = 0;
+    for (Function::const_iterator BB = F->begin(), BE = F->end(); BB != BE;
+         ++BB, ++i) {
+      Succs.clear();
+      const TerminatorInst *TI = BB->getTerminator();
+      for (unsigned s = 0, e = TI ? TI->getNumSuccessors() : 0; s != e; ++s)
+        if (std::find(Succs.begin(), Succs.end(), TI->getSuccessor(s)) == Succs.end())
+          Succs.push_back(TI->getSuccessor(s));
+      if (Succs.empty()) {
+        OutCount[i] = FindEdge(First + i, 0);
+        OutKnown[i] = OutCount[i] != MissingValue;
+        continue;
+      }
+      for (unsigned s = 0, e = Succs.size(); s != e; ++s) {
+        unsigned Succ = Index.Blocks[Succs[s]] - First;
+        ++NumPreds[Succ];
+        double w = FindEdge(First + i, Succs[s]);
+        if (w == MissingValue) {
+          OutKnown[i] = false;
+          continue;
+        }
+        OutCount[i] += w;
+        InCount[Succ] += w;
+        ++InEdges[Succ];
+      }
+    }
+
+    bool HasEdges = EdgeInformation.count(F);
+    std::map<const Function*, BlockCounts>::const_iterator Blocks =
+      BlockInformation.find(F);
+    unsigned FunctionUncounted = 0;
+    i = 0;
+    for (Function::const_iterator BB = F->begin(), BE = F->end(); BB != BE;
+         ++BB, ++i) {
+      double Count = MissingValue;
+      BlockCounts::const_iterator Found;
+      if (Blocks != BlockInformation.end() &&
+          (Found = Blocks->second.find(BB)) != Blocks->second.end())
+        Count = Found->second;
+      else if (NumPreds[i] == 0)
+        Count = FindEdge(NumBlocks + FunctionNumber, BB);
+      else if (InEdges[i] == NumPreds[i])
+        Count = InCount[i];
+      if (Count == MissingValue && OutKnown[i])
+        Count = OutCount[i];
+      Index.BlockCounts[First + i] = Count;
+
+      if (Count == MissingValue && HasEdges) ++FunctionUncounted;
+      if (NumPreds[i] && InEdges[i] == NumPreds[i] && OutKnown[i] &&
+          InCount[i] != OutCount[i])
+        ++Unbalanced;
+    }
+    Uncounted += FunctionUncounted;
+    if (FunctionUncounted) ++UncountedFunctions;
+
+    std::map<const Function*, double>::const_iterator Count =
+      FunctionInformation.find(F);
+    Index.FunctionCounts[FunctionNumber] = Count != FunctionInformation.end()
+      ? Count->second : Index.BlockCounts[First];
+  }
+  if (Uncounted)
+    errs() << "WARNING: " << Uncounted << " blocks of " << UncountedFunctions
+           << " functions have no count in the profile!\n";
+  if (Unbalanced)
+    errs() << "WARNING: " << Unbalanced << " blocks are left more or less "
+           << "often than they are entered in the profile!\n";
+  std::swap(Dense, Index);
+}
+
 template<>
 void ProfileInfoT<Function,BasicBlock>::
         setExecutionCount(const BasicBlock *BB, double w) {
   DEBUG(dbgs() << "Creating Block " << BB->getName()
                << " (weight: " << format("%.20g",w) << ")\n");
+  Dense.clear();
   BlockInformation[BB->getParent()][BB] = w;
 }
 
@@ -328,6 +497,7 @@ void ProfileInfoT<Function,BasicBlock>::addEdgeWeight(Edge e, double w) {
   assert (oldw != MissingValue && "Adding weight to Edge with no previous weight");
   DEBUG(dbgs() << "Adding to Edge " << e
                << " (new weight: " << format("%.20g",oldw + w) << ")\n");
+  Dense.clear();
   EdgeInformation[getFunction(e)][e] = oldw + w;
 }
 
@@ -338,11 +508,13 @@ void ProfileInfoT<Function,BasicBlock>::
   assert (oldw != MissingValue && "Adding weight to Block with no previous weight");
   DEBUG(dbgs() << "Adding to Block " << BB->getName()
                << " (new weight: " << format("%.20g",oldw + w) << ")\n");
+  Dense.clear();
   BlockInformation[BB->getParent()][BB] = oldw + w;
 }
 
 template<>
 void ProfileInfoT<Function,BasicBlock>::removeBlock(const BasicBlock *BB) {
+  Dense.clear();
   std::map<const Function*, BlockCounts>::iterator J =
     BlockInformation.find(BB->getParent());
   if (J == BlockInformation.end()) return;
@@ -353,6 +525,7 @@ void ProfileInfoT<Function,BasicBlock>::removeBlock(const BasicBlock *BB) {
 
 template<>
 void ProfileInfoT<Function,BasicBlock>::removeEdge(Edge e) {
+  Dense.clear();
   std::map<const Function*, EdgeWeights>::iterator J =
     EdgeInformation.find(getFunction(e));
   if (J == EdgeInformation.end()) return;
@@ -460,6 +633,7 @@ void ProfileInfoT<Function,BasicBlock>::
         replaceAllUses(const BasicBlock *RmBB, const BasicBlock *DestBB) {
   DEBUG(dbgs() << "Replacing " << RmBB->getName()
                << " with " << DestBB->getName() << "\n");
+  Dense.clear();
   const Function *F = DestBB->getParent();
   std::map<const Function*, EdgeWeights>::iterator J =
     EdgeInformation.find(F);
@@ -510,6 +684,7 @@ void ProfileInfoT<Function,BasicBlock>::splitEdge(const BasicBlock *FirstBB,
                                                   const BasicBlock *SecondBB,
                                                   const BasicBlock *NewBB,
                                                   bool MergeIdenticalEdges) {
+  Dense.clear();
   const Function *F = FirstBB->getParent();
   std::map<const Function*, EdgeWeights>::iterator J =
     EdgeInformation.find(F);
@@ -622,6 +797,7 @@ void ProfileInfoT<Function,BasicBlock>::transfer(const Function *Old,
                                                  const Function *New) {
   DEBUG(dbgs() << "Replacing Function " << Old->getName() << " with "
                << New->getName() << "\n");
+  Dense.clear();
   std::map<const Function*, EdgeWeights>::iterator J =
     EdgeInformation.find(Old);
   if(J != EdgeInformation.end()) {
@@ -647,6 +823,7 @@ template<>
 bool ProfileInfoT<Function,BasicBlock>::
         CalculateMissingEdge(const BasicBlock *BB, Edge &removed,
                              bool assumeEmptySelf) {
+  Dense.clear();
   Edge edgetocalc;
   unsigned uncalculated = 0;
 
@@ -776,6 +953,7 @@ bool ProfileInfoT<Function,BasicBlock>::EstimateMissingEdges(const BasicBlock *B
 
 template<>
 void ProfileInfoT<Function,BasicBlock>::repair(const Function *F) {
+  Dense.clear();
 //  if (getExecutionCount(&(F->getEntryBlock())) == 0) {
 //    for (Function::const_iterator FI = F->begin(), FE = F->end();
 //         FI != FE; ++FI) {
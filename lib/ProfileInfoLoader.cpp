@@ -13,17 +13,40 @@
 //===----------------------------------------------------------------------===//
 
 #include "preheader.h"
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/InstrTypes.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/raw_ostream.h>
 #include "ProfileInfoLoader.h"
 #include "ProfileInfoTypes.h"
 #include <cstdio>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <assert.h>
+#include <map>
+#include <memory>
 #include <vector>
+
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 4
+#include <llvm/ADT/OwningPtr.h>
+#endif
 using namespace llvm;
 
+static cl::opt<int>
+ProfileSnapshot("profile-snapshot", cl::init(-1), cl::value_desc("sequence"),
+                cl::desc("Use the counts of a snapshot instead of those "
+                         "written at exit"));
+
+static cl::opt<int>
+ProfileSnapshotBase("profile-snapshot-base", cl::init(-1),
+                    cl::value_desc("sequence"),
+                    cl::desc("Subtract the counts of this snapshot from "
+                             "those of -profile-snapshot"));
+
 raw_ostream &llvm::operator<<(raw_ostream &O, std::pair<const BasicBlock *,
                                                         const BasicBlock *> E) {
   O << "(";
@@ -43,6 +66,31 @@ raw_ostream &llvm::operator<<(raw_ostream &O, std::pair<const BasicBlock *,
   return O << ")";
 }
 
+// FunctionCFGChecksum - FNV-1a over the number of blocks of F and the
+// successor numbers of every block, in the order of the blocks.
+//
+uint64_t llvm::FunctionCFGChecksum(const Function *F) {
+  DenseMap<const BasicBlock*, uint64_t> Numbers;
+  uint64_t NumBlocks = 0;
+  for (Function::const_iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+    Numbers[&*BB] = NumBlocks++;
+
+  uint64_t Hash = 14695981039346656037ULL;
+  for (unsigned b = 0; b != 8; ++b)
+    Hash = (Hash ^ ((NumBlocks >> 8 * b) & 255)) * 1099511628211ULL;
+  for (Function::const_iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+    const TerminatorInst *TI = BB->getTerminator();
+    unsigned NumSuccs = TI ? TI->getNumSuccessors() : 0;
+    for (unsigned s = 0; s <= NumSuccs; ++s) {
+      // the number of successors, then the successors
+      uint64_t Word = s == 0 ? NumSuccs : Numbers.lookup(TI->getSuccessor(s-1));
+      for (unsigned b = 0; b != 8; ++b)
+        Hash = (Hash ^ ((Word >> 8 * b) & 255)) * 1099511628211ULL;
+    }
+  }
+  return Hash;
+}
+
 // ByteSwap - Byteswap 'Var' if 'Really' is true.
 //
 static inline unsigned ByteSwap(unsigned Var, bool Really) {
@@ -69,6 +117,29 @@ static inline uint64_t ByteSwap(uint64_t Var, bool Really)
 static inline double ByteSwap(double Var, bool Really)
 {
    if (!Really) return Var;
+   uint64_t Bits;
+   memcpy(&Bits, &Var, sizeof(double));
+   Bits = ByteSwap(Bits, true);
+   memcpy(&Var, &Bits, sizeof(double));
+   return Var;
+}
+
+static inline int ByteSwap(int Var, bool Really) {
+  return (int)ByteSwap((unsigned)Var, Really);
+}
+
+static inline CounterStats ByteSwap(CounterStats Var, bool Really) {
+  if (!Really) return Var;
+  Var.min = ByteSwap(Var.min, true);
+  Var.max = ByteSwap(Var.max, true);
+  Var.mean = ByteSwap(Var.mean, true);
+  Var.stddev = ByteSwap(Var.stddev, true);
+  Var.p50 = ByteSwap(Var.p50, true);
+  Var.p90 = ByteSwap(Var.p90, true);
+  Var.p99 = ByteSwap(Var.p99, true);
+  Var.argmaxRank = ByteSwap(Var.argmaxRank, true);
+  Var.numRanks = ByteSwap(Var.numRanks, true);
+  return Var;
 }
 
 static uint64_t AddCounts(uint64_t A, uint64_t B) {
@@ -78,251 +149,778 @@ static uint64_t AddCounts(uint64_t A, uint64_t B) {
   return A + B;
 }
 
-template<class IntT>
-static void ReadProfilingBlock(const char *ToolName, FILE *F,
-                               bool ShouldByteSwap,
-                               std::vector<IntT> &Data) {
-  // Read the number of entries...
-  IntT NumEntries;
-  if (fread(&NumEntries, sizeof(IntT), 1, F) != 1) {
-    errs() << ToolName << ": data packet truncated!\n";
-    perror(0);
+namespace {
+// PacketReader - Reads the packets between Pos and End of the mapped profile,
+// exiting the program if a packet is truncated.
+struct PacketReader {
+  const char *ToolName;
+  const char *Start;  // of the file
+  const char *Pos;
+  const char *End;
+  bool ShouldByteSwap;
+
+  PacketReader(const char *ToolName, const MemoryBuffer &Buffer,
+               size_t Begin, size_t End)
+    : ToolName(ToolName), Start(Buffer.getBufferStart()), Pos(Start + Begin),
+      End(Start + End), ShouldByteSwap(false) {}
+
+  size_t left() const { return End - Pos; }
+  size_t offset() const { return Pos - Start; }
+
+  void truncated(const char *What) {
+    errs() << ToolName << ": " << What << " packet truncated!\n";
     exit(1);
   }
-  NumEntries = ByteSwap(NumEntries, ShouldByteSwap);
 
-  // Read the counts...
-  std::vector<IntT> TempSpace(NumEntries);
+  // take - Skip Size bytes, returning where they start.
+  const char *take(uint64_t Size, const char *What = "data") {
+    if (Size > left()) truncated(What);
+    const char *P = Pos;
+    Pos += Size;
+    return P;
+  }
 
-  // Read in the block of data...
-  if (fread(&TempSpace[0], sizeof(IntT)*NumEntries, 1, F) != 1) {
-    errs() << ToolName << ": data packet truncated!\n";
-    perror(0);
-    exit(1);
+  template<class T>
+  T read(const char *What = "data") {
+    T Var;
+    memcpy(&Var, take(sizeof(T), What), sizeof(T));
+    return ByteSwap(Var, ShouldByteSwap);
   }
 
-  // Make sure we have enough space... The space is initialised to -1 to
-  // facitiltate the loading of missing values for OptimalEdgeProfiling.
-  if (Data.size() < NumEntries)
-    Data.resize(NumEntries, ProfileInfoLoader::Uncounted);
+  // counters - Skip NumEntries counters of type T, returning them in place if
+  // they need no byte swapping and are aligned, otherwise copied into Temp.
+  template<class T>
+  const T *counters(uint64_t NumEntries, std::vector<T> &Temp) {
+    if (NumEntries > left() / sizeof(T)) truncated("data");
+    const char *P = take(NumEntries * sizeof(T));
+    if (!ShouldByteSwap && (uintptr_t)P % alignof(T) == 0)
+      return (const T*)P;
+    Temp.resize(NumEntries);
+    if (NumEntries) memcpy(&Temp[0], P, NumEntries * sizeof(T));
+    for (uint64_t i = 0; ShouldByteSwap && i != NumEntries; ++i)
+      Temp[i] = ByteSwap(Temp[i], true);
+    return Temp.data();
+  }
 
-  // Accumulate the data we just read into the data.
-  if (!ShouldByteSwap) {
-    for (IntT i = 0; i != NumEntries; ++i) {
-      Data[i] = AddCounts(TempSpace[i], Data[i]);
-    }
-  } else {
-    for (IntT i = 0; i != NumEntries; ++i) {
-      Data[i] = AddCounts(ByteSwap(TempSpace[i], true), Data[i]);
-    }
+  bool inFile(const void *P) const {
+    return (const char*)P >= Start && (const char*)P <= End;
   }
+};
+}
+
+// AccumulateCounts - Add the NumEntries counters at New to Data.  The space is
+// initialised to -1 to facitiltate the loading of missing values.
+template<class T, class FileT>
+static void AccumulateCounts(ProfileCounters<T> &Data, const FileT *New,
+                             uint64_t NumEntries, bool InFile) {
+  std::vector<T> &Counts = Data.own();
+  if (Counts.size() < NumEntries)
+    Counts.resize(NumEntries, ProfileInfoLoader::Uncounted);
+  for (uint64_t i = 0; i != NumEntries; ++i)
+    Counts[i] = AddCounts(New[i], Counts[i]);
 }
+
+// The first packet of a kind is used in place.
 template<class T>
-static void ReadProfilingBlockDouble(const char *ToolName, FILE *F,
-                               bool ShouldByteSwap,
-                               std::vector<T> &Data) {
-  // Read the number of entries...
-  uint64_t NumEntries;
-  if (fread(&NumEntries, sizeof(uint64_t), 1, F) != 1) {
-    errs() << ToolName << ": data packet truncated!\n";
-    perror(0);
-    exit(1);
-  }
-  NumEntries = ByteSwap(NumEntries, ShouldByteSwap);
+static void AccumulateCounts(ProfileCounters<T> &Data, const T *New,
+                             uint64_t NumEntries, bool InFile) {
+  if (InFile && Data.view(New, NumEntries)) return;
+  AccumulateCounts<T, T>(Data, New, NumEntries, false);
+}
 
-  // Read the counts...
-  std::vector<double> TempSpace(NumEntries);
+// AssignCounts - Overwrite the first NumEntries counters of Data, the way the
+// double packets are read.
+template<class T>
+static void AssignCounts(ProfileCounters<T> &Data, const double *New,
+                         uint64_t NumEntries, bool InFile) {
+  std::vector<T> &Counts = Data.own();
+  if (Counts.size() < NumEntries)
+    Counts.resize(NumEntries, 0);
+  for (uint64_t i = 0; i != NumEntries; ++i)
+    Counts[i] = (T)New[i];
+}
 
-  // Read in the block of data...
-  if (fread(&TempSpace[0], sizeof(double)*NumEntries, 1, F) != 1) {
-    errs() << ToolName << ": data packet truncated!\n";
-    perror(0);
-    exit(1);
+static void AssignCounts(ProfileCounters<double> &Data, const double *New,
+                         uint64_t NumEntries, bool InFile) {
+  if (InFile && NumEntries >= Data.size()) {
+    Data.clear();
+    Data.view(New, NumEntries);
+    return;
   }
+  AssignCounts<double>(Data, New, NumEntries, false);
+}
 
-  // Make sure we have enough space... The space is initialised to -1 to
-  // facitiltate the loading of missing values for OptimalEdgeProfiling.
-  if (Data.size() < NumEntries)
-    Data.resize(NumEntries, 0);
+// ReadCounts - Read a packet of counters, which is an entry count of type
+// FileT followed by the counters, and accumulate it into Data.
+template<class FileT, class T>
+static void ReadCounts(PacketReader &R, ProfileCounters<T> &Data,
+                       std::vector<FileT> &Temp) {
+  uint64_t NumEntries = R.read<FileT>();
+  const FileT *New = R.counters(NumEntries, Temp);
+  AccumulateCounts(Data, New, NumEntries, R.inFile(New));
+}
 
-  for (uint64_t i = 0; i != NumEntries; ++i) {
-     Data[i] = (T)TempSpace[i];
-  }
+// ReadDoubles - Read a packet of double counters, which is an uint64_t entry
+// count followed by the counters, and assign it to Data.
+template<class T>
+static void ReadDoubles(PacketReader &R, ProfileCounters<T> &Data,
+                        std::vector<double> &Temp) {
+  uint64_t NumEntries = R.read<uint64_t>();
+  const double *New = R.counters(NumEntries, Temp);
+  AssignCounts(Data, New, NumEntries, R.inFile(New));
 }
 
-static void ReadValueProfilingContents(const char* ToolName, FILE* F,
-		bool ShouldByteSwap, const size_t Counts,
+static void ReadValueProfilingContents(PacketReader &R, const size_t Counts,
 		std::vector<std::vector<int> >& Data)
 {
-#define EXIT_IF_ERROR {\
-    errs() << ToolName << ": data packet truncated!\n";\
-    perror(0);\
-    exit(1);}
-
 	if(Data.size() < Counts)
 		Data.resize(Counts);
    std::vector<int> TempSpace;
    for(unsigned i=0;i<Counts;++i){
-		unsigned count = 0;
-		if(fread(&count,sizeof(unsigned),1,F) != 1) EXIT_IF_ERROR;
-		count = ByteSwap(count, ShouldByteSwap);
+		unsigned count = R.read<unsigned>();
 		if(count==0) continue;
-		TempSpace.clear();
-		TempSpace.resize(count);
-		if(fread(&TempSpace[0],sizeof(int)*count,1,F) != 1){
-			EXIT_IF_ERROR;
-		}
-		Data[i].resize(TempSpace.size());
-      uint64_t (*BS)(uint64_t, bool) = ByteSwap;
-
-		//tranverse TempSpace with ByteSwap and write to Data[i]
-		std::transform(TempSpace.begin(), TempSpace.end(), Data[i].begin(),
-				std::bind(BS, std::placeholders::_1, ShouldByteSwap));
+		const int *Content = R.counters(count, TempSpace);
+		Data[i].assign(Content, Content + count);
 	}
-#undef EXIT_IF_ERROR
+}
+
+// MergeValueHistogram - Add the VALUE_HISTOGRAM contents in New, laid out as
+// flags, other count, value/count pairs, to those in Data.  The pairs stay
+// sorted by decreasing count.
+void llvm::MergeValueHistogram(std::vector<int> &Data,
+                               const std::vector<int> &New) {
+  if (New.size() < 2) return;
+  if (Data.size() < 2) {
+    Data = New;
+    return;
+  }
+  std::map<int, unsigned> Counts;
+  for (size_t j = 2; j + 1 < Data.size(); j += 2)
+    Counts[Data[j]] += Data[j+1];
+  for (size_t j = 2; j + 1 < New.size(); j += 2)
+    Counts[New[j]] += New[j+1];
+
+  std::vector<std::pair<unsigned, int> > Sorted;
+  for (std::map<int, unsigned>::iterator I = Counts.begin(),
+       E = Counts.end(); I != E; ++I)
+    Sorted.push_back(std::make_pair(I->second, I->first));
+  std::sort(Sorted.begin(), Sorted.end(),
+            std::greater<std::pair<unsigned, int> >());
+
+  Data[0] |= New[0];
+  Data[1] += New[1];
+  Data.resize(2);
+  for (size_t j = 0, je = Sorted.size(); j != je; ++j) {
+    Data.push_back(Sorted[j].second);
+    Data.push_back(Sorted[j].first);
+  }
+}
+
+static void MergeValueHistograms(std::vector<std::vector<int> > &Data,
+                                 const std::vector<std::vector<int> > &New) {
+  if (Data.size() < New.size())
+    Data.resize(New.size());
+  for (size_t i = 0, e = New.size(); i != e; ++i)
+    MergeValueHistogram(Data[i], New[i]);
+}
+
+template<class T>
+static void SubtractCounts(std::vector<T> &Data, ArrayRef<T> Base,
+                           T Uncounted = (T)ProfileInfoLoader::Uncounted) {
+  for (size_t i = 0, e = std::min(Data.size(), Base.size()); i != e; ++i)
+    if (Data[i] != Uncounted && Base[i] != Uncounted)
+      Data[i] -= Base[i];
+}
+
+// AddOptimalCounts - Accumulate optimal edge counts, where Uncounted64 marks
+// the edges which are calculated instead of counted.
+static void AddOptimalCounts(ProfileCounters<uint64_t> &Data,
+                             const uint64_t *New, uint64_t NumEntries,
+                             bool InFile) {
+  if (InFile && Data.view(New, NumEntries)) return;
+  std::vector<uint64_t> &Counts = Data.own();
+  if (Counts.size() < NumEntries)
+    Counts.resize(NumEntries, ProfileInfoLoader::Uncounted64);
+  for (uint64_t i = 0; i != NumEntries; ++i)
+    if (New[i] != ProfileInfoLoader::Uncounted64)
+      Counts[i] = Counts[i] == ProfileInfoLoader::Uncounted64
+                      ? New[i] : Counts[i] + New[i];
 }
 
 const uint64_t ProfileInfoLoader::Uncounted = ~0U;
+const uint64_t ProfileInfoLoader::Uncounted64 = ~0ULL;
 
-// ProfileInfoLoader ctor - Read the specified profiling data file, exiting the
-// program if the file is invalid or broken.
+// ProfileInfoLoader ctor - Map the specified profiling data file and read its
+// packets, exiting the program if the file is invalid or broken.
 //
 ProfileInfoLoader::ProfileInfoLoader(const char *ToolName,
                                      const std::string &Filename)
-  : Filename(Filename) {
-  FILE *F = fopen(Filename.c_str(), "rb");
-  if (F == 0) {
-    errs() << ToolName << ": Error opening '" << Filename << "': ";
-    perror(0);
+  : Filename(Filename), ToolName(ToolName), ValueHistograms(false),
+    IndexedPending(false) {
+  // The file is mapped if it is large enough, no null terminator is needed.
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+  OwningPtr<MemoryBuffer> File;
+  if (error_code ec = MemoryBuffer::getFile(Filename, File, -1, false)) {
+    errs() << ToolName << ": Error opening '" << Filename << "': "
+           << ec.message() << "\n";
+    exit(1);
+  }
+  Buffer.reset(File.take());
+#else
+  ErrorOr<std::unique_ptr<MemoryBuffer> > File =
+      MemoryBuffer::getFile(Filename, -1, false);
+  if (std::error_code ec = File.getError()) {
+    errs() << ToolName << ": Error opening '" << Filename << "': "
+           << ec.message() << "\n";
     exit(1);
   }
-  if (0 == (fseek(F, 0, SEEK_END), ftell(F))) {
+  Buffer.reset(File->release());
+#endif
+  if (Buffer->getBufferSize() == 0) {
     // end == begin == 0, then it is empty
     errs() << " Warnning '" << Filename << "' seems empty\n";
   }
-  fseek(F, 0, SEEK_SET);
+  readPackets(ToolName, 0, Buffer->getBufferSize());
+
+  if (ProfileSnapshot >= 0)
+    useSnapshot(ToolName, ProfileSnapshot, ProfileSnapshotBase);
+}
+
+// readPackets - Accumulate the packets between the offsets Begin and End of
+// the file.  Counters are read in place where possible.
+//
+void ProfileInfoLoader::readPackets(const char *ToolName, size_t Begin,
+                                    size_t End) {
+  PacketReader R(ToolName, *Buffer, Begin, End);
   std::vector<unsigned> TempCounters32;
+  std::vector<uint64_t> TempCounters64;
+  std::vector<double> TempDoubles;
 
   // Keep reading packets until we run out of them.
-  unsigned PacketType;
-  while (fread(&PacketType, sizeof(unsigned), 1, F) == 1) {
+  while (R.left() >= sizeof(unsigned)) {
+    unsigned PacketType;
+    memcpy(&PacketType, R.take(sizeof(unsigned)), sizeof(unsigned));
     // If the low eight bits of the packet are zero, we must be dealing with an
     // endianness mismatch.  Byteswap all words read from the profiling
     // information.
-    bool ShouldByteSwap = (char)PacketType == 0;
-    PacketType = ByteSwap(PacketType, ShouldByteSwap);
+    R.ShouldByteSwap = (char)PacketType == 0;
+    PacketType = ByteSwap(PacketType, R.ShouldByteSwap);
 
     switch (PacketType) {
     case ArgumentInfo: {
-      unsigned ArgLength;
-      if (fread(&ArgLength, sizeof(unsigned), 1, F) != 1) {
-        errs() << ToolName << ": arguments packet truncated!\n";
-        errs() << "  " << Filename << ": ";
-        perror(0);
-        exit(1);
-      }
-      ArgLength = ByteSwap(ArgLength, ShouldByteSwap);
-
-      // Read in the arguments...
-      std::vector<char> Chars(ArgLength+4);
-
-      if (ArgLength)
-        if (fread(&Chars[0], (ArgLength+3) & ~3, 1, F) != 1) {
-          errs() << ToolName << ": arguments packet truncated!\n";
-          perror(0);
-          exit(1);
-        }
-      CommandLines.push_back(std::string(&Chars[0], &Chars[ArgLength]));
+      unsigned ArgLength = R.read<unsigned>("arguments");
+      const char *Chars = R.take((ArgLength + 3ULL) & ~3ULL, "arguments");
+      CommandLines.push_back(std::string(Chars, ArgLength));
       break;
     }
 
     case FunctionInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, FunctionCounts);
+      ReadCounts(R, FunctionCounts, TempCounters32);
       break;
 
     case BlockInfo:
-       ReadProfilingBlock(ToolName, F, ShouldByteSwap, TempCounters32);
-       if (BlockCounts.size() < TempCounters32.size())
-          BlockCounts.resize(TempCounters32.size(), Uncounted);
-       std::transform(TempCounters32.begin(), TempCounters32.end(),
-                      BlockCounts.begin(), BlockCounts.begin(),
-                      AddCounts);
-       TempCounters32.clear();
+      ReadCounts(R, BlockCounts, TempCounters32);
       break;
 
     case EdgeInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, TempCounters32);
-       if (EdgeCounts.size() < TempCounters32.size())
-          EdgeCounts.resize(TempCounters32.size(), Uncounted);
-       std::transform(TempCounters32.begin(), TempCounters32.end(),
-                      EdgeCounts.begin(), EdgeCounts.begin(),
-                      AddCounts);
-       TempCounters32.clear();
+      ReadCounts(R, EdgeCounts, TempCounters32);
       break;
 
-    case OptEdgeInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, OptimalEdgeCounts);
+    case OptEdgeInfo: {
+      unsigned NumEntries = R.read<unsigned>();
+      const unsigned *New = R.counters(NumEntries, TempCounters32);
+      TempCounters64.resize(NumEntries);
+      for (unsigned i = 0; i != NumEntries; ++i)
+        TempCounters64[i] = New[i] == ~0U ? Uncounted64 : New[i];
+      AddOptimalCounts(OptimalEdgeCounts, TempCounters64.data(), NumEntries,
+                       false);
       break;
+    }
+
+    case OptEdgeInfo64: {
+      uint64_t NumEntries = R.read<uint64_t>();
+      const uint64_t *New = R.counters(NumEntries, TempCounters64);
+      AddOptimalCounts(OptimalEdgeCounts, New, NumEntries, R.inFile(New));
+      break;
+    }
 
     case BBTraceInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, BBTrace);
+      ReadCounts(R, BBTrace, TempCounters32);
       break;
 
+    case BBTraceDeltaInfo: {
+      // Keep the encoded bytes, they are a quarter of the decoded size.
+      EncodedTrace T;
+      T.NumBlocks = R.read<unsigned>("trace");
+      T.NumBytes = R.read<unsigned>("trace");
+      T.Bytes = (const unsigned char*)R.take((T.NumBytes + 3ULL) & ~3ULL,
+                                             "trace");
+      EncodedBBTrace.push_back(T);
+      break;
+    }
+
 	case ValueInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, ValueCounts);
-      ReadValueProfilingContents(ToolName, F, ShouldByteSwap, ValueCounts.size(), ValueContents);
+      ReadCounts(R, ValueCounts, TempCounters32);
+      ReadValueProfilingContents(R, ValueCounts.size(), ValueContents);
+      break;
+
+   case ValueHistInfo: {
+      std::vector<std::vector<int> > Histograms;
+      ReadCounts(R, ValueCounts, TempCounters32);
+      ReadValueProfilingContents(R, ValueCounts.size(), Histograms);
+      MergeValueHistograms(ValueContents, Histograms);
+      ValueHistograms = true;
       break;
+   }
 
    case SLGInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, SLGCounts);
+      ReadCounts(R, SLGCounts, TempCounters32);
       break;
 
    case MPInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, MPICounts);
+      ReadCounts(R, MPICounts, TempCounters32);
       break;
 
    case MPIFullInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, MPIFullCounters);
+      ReadCounts(R, MPIFullCounters, TempCounters32);
       break;
 
    case BlockInfo64:
-      ReadProfilingBlock<uint64_t>(ToolName, F, ShouldByteSwap, BlockCounts);
+      ReadCounts(R, BlockCounts, TempCounters64);
       break;
 
    case EdgeInfo64:
-	  {
-      ReadProfilingBlock<uint64_t>(ToolName, F, ShouldByteSwap, EdgeCounts);
-	  uint64_t totalCount = 0;
-	  for(int i = 0; i < EdgeCounts.size();i++)
-	  {
-		  totalCount+=EdgeCounts[i];
-	  }
-	  outs()<<"total instrumented ins:\t" << totalCount<<"\n";
-	  outs()<<"Helo world\n";
+      ReadCounts(R, EdgeCounts, TempCounters64);
       break;
 
-	  }
    //add by haomeng
    case BlockInfoDouble:
-      ReadProfilingBlockDouble(ToolName, F, ShouldByteSwap, BlockCounts);
+      ReadDoubles(R, BlockCounts, TempDoubles);
       break;
    //add by haomeng
    case MPITimeInfo:
-      ReadProfilingBlockDouble(ToolName, F, ShouldByteSwap, TimeMess);
+      ReadDoubles(R, TimeMess, TempDoubles);
+      break;
+   case MPITimeRangeInfo: {
+      // the minimums, laid out like MPITimeInfo, then as many maximums
+      TimeMin.clear();
+      TimeMax.clear();
+      ReadDoubles(R, TimeMin, TempDoubles);
+      const double *Max = R.counters(TimeMin.size(), TempDoubles);
+      AssignCounts(TimeMax, Max, TimeMin.size(), R.inFile(Max));
       break;
+   }
    case RankInfo:
-      ReadProfilingBlock(ToolName, F, ShouldByteSwap, RankCounts);
+      ReadCounts(R, RankCounts, TempCounters32);
+      break;
+
+   case PathInfo:
+   case PathInfo64: {
+      // function headers, each followed by its path table
+      unsigned NumFunctions = R.read<unsigned>("path");
+      for (unsigned f = 0; f != NumFunctions; ++f) {
+        unsigned FnNumber = R.read<unsigned>("path");
+        unsigned NumEntries = R.read<unsigned>("path");
+        std::map<unsigned, uint64_t> &Paths = PathCounts[FnNumber];
+        for (unsigned i = 0; i != NumEntries; ++i) {
+          unsigned Path = R.read<unsigned>("path");
+          if (PacketType == PathInfo) {
+            Paths[Path] += R.read<unsigned>("path");
+          } else {
+            R.read<unsigned>("path");
+            Paths[Path] += R.read<uint64_t>("path");
+          }
+        }
+      }
+      break;
+   }
+
+   case StatsInfo: {
+      // a later packet of the same kind replaces the earlier one
+      std::vector<CounterStats> Temp;
+      ProfileCounters<CounterStats> &Data = Stats[R.read<int>("stats")];
+      uint64_t NumEntries = R.read<uint64_t>("stats");
+      const CounterStats *New = R.counters(NumEntries, Temp);
+      Data.clear();
+      if (R.inFile(New))
+        Data.view(New, NumEntries);
+      else
+        Data.own().assign(New, New + NumEntries);
+      break;
+   }
+
+   case PaddingInfo:
+      R.take(R.read<unsigned>("padding"), "padding");
       break;
 
+   case IndexedInfo: {
+      unsigned Version = R.read<unsigned>("indexed");
+      uint64_t Size = R.read<uint64_t>("indexed");
+      if (Version != INDEXED_PROFILE_VERSION) {
+        errs() << ToolName << ": indexed profile version " << Version
+               << " is not supported!\n";
+        exit(1);
+      }
+      size_t At = R.offset();
+      R.take(Size, "indexed");
+      readIndexed(ToolName, At, At + Size);
+      break;
+   }
+
+   case SnapshotInfo: {
+      // Only remember where the snapshot is, the counts read by default are
+      // the final ones.
+      Snapshot S;
+      S.Delta = R.read<unsigned>("snapshot") & SNAPSHOT_DELTA;
+      S.Sequence = R.read<uint64_t>("snapshot");
+      S.Timestamp = R.read<double>("snapshot");
+      S.Size = R.read<uint64_t>("snapshot");
+      S.Offset = R.offset();
+      R.take(S.Size, "snapshot");
+      Snapshots.push_back(S);
+      break;
+   }
+
    default:
       errs() << ToolName << ": Unknown packet type #" << PacketType << "!\n";
-      errs() << "at position "<<ftell(F) <<"/";
-      fseek(F,0,SEEK_END);
-      errs() << ftell(F) <<"\n";
-      fclose(F);
+      errs() << "at position " << R.offset() << "/"
+             << Buffer->getBufferSize() << "\n";
+      exit(1);
+    }
+  }
+}
+
+// SliceEntrySize - The size of an entry of a Kind slice, 0 if slices of Kind
+// are not understood and skipped.  The value slices are followed by the
+// contents of their sites.
+static uint64_t SliceEntrySize(int Kind) {
+  switch (Kind) {
+  case EdgeInfo64:
+  case BlockInfo64:
+  case BlockInfoDouble:
+  case MPITimeInfo:
+    return 8;
+  case MPIFullInfo:
+  case ValueInfo:
+  case ValueHistInfo:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+namespace {
+// SliceReader - Walks the slices of an indexed record.
+struct SliceReader : PacketReader {
+  int Kind;
+  uint64_t First, NumEntries, Size;
+  const char *Next;
+
+  SliceReader(const char *ToolName, const MemoryBuffer &Buffer,
+              size_t Offset, uint64_t RecordSize, bool ByteSwapped)
+    : PacketReader(ToolName, Buffer, Offset, Offset + RecordSize),
+      Next(Pos) {
+    ShouldByteSwap = ByteSwapped;
+  }
+
+  // next - Move to the next slice, false at the end of the record.
+  bool next() {
+    Pos = Next;
+    if (left() == 0) return false;
+    Kind = read<int>("indexed");
+    read<unsigned>("indexed");
+    First = read<uint64_t>("indexed");
+    NumEntries = read<uint64_t>("indexed");
+    Size = read<uint64_t>("indexed");
+    if (Size > left() || NumEntries > Size / std::max<uint64_t>(
+                                                 SliceEntrySize(Kind), 1))
+      truncated("indexed");
+    Next = Pos + Size;
+    return true;
+  }
+};
+}
+
+// readIndexed - Read the table of contents of the IndexedInfo packet between
+// Begin and End, see ProfileInfoTypes.h.  The records are only checked, they
+// are read on demand.
+//
+void ProfileInfoLoader::readIndexed(const char *ToolName, size_t Begin,
+                                    size_t End) {
+  PacketReader R(ToolName, *Buffer, Begin, End);
+  uint64_t NumFunctions = R.read<uint64_t>("indexed");
+  uint64_t NamesSize = R.read<uint64_t>("indexed");
+  uint64_t RecordsSize = R.read<uint64_t>("indexed");
+  if (NumFunctions > R.left() / sizeof(IndexedFunction))
+    R.truncated("indexed");
+  const char *Table = R.take(NumFunctions * sizeof(IndexedFunction));
+  const char *Names = R.take(NamesSize, "indexed");
+  size_t Records = R.offset();
+  R.take(RecordsSize, "indexed");
+
+  std::vector<IndexedRecord> Functions(NumFunctions);
+  PacketReader T(ToolName, *Buffer, Table - Buffer->getBufferStart(),
+                 Names - Buffer->getBufferStart());
+  T.ShouldByteSwap = R.ShouldByteSwap;
+  for (uint64_t i = 0; i != NumFunctions; ++i) {
+    IndexedRecord &F = Functions[i];
+    F.Checksum = T.read<uint64_t>();
+    uint64_t NameOffset = T.read<uint64_t>();
+    uint64_t RecordOffset = T.read<uint64_t>();
+    F.Size = T.read<uint64_t>();
+    const char *Nul = NameOffset < NamesSize ? (const char*)
+        memchr(Names + NameOffset, 0, NamesSize - NameOffset) : 0;
+    if (!Nul || RecordOffset > RecordsSize ||
+        F.Size > RecordsSize - RecordOffset)
+      R.truncated("indexed");
+    F.Name = StringRef(Names + NameOffset, Nul - Names - NameOffset);
+    F.Offset = Records + RecordOffset;
+    F.ByteSwapped = R.ShouldByteSwap;
+
+    SliceReader S(ToolName, *Buffer, F.Offset, F.Size, F.ByteSwapped);
+    while (S.next())
+      ;
+  }
+  std::stable_sort(Functions.begin(), Functions.end());
+  Indexed.push_back(Functions);
+  IndexedPending = true;
+}
+
+// AddSlice - Add the NumEntries counters at New to those of Data from First
+// on.
+template<class T, class FileT>
+static void AddSlice(ProfileCounters<T> &Data, uint64_t First,
+                     const FileT *New, uint64_t NumEntries) {
+  std::vector<T> &Counts = Data.own();
+  if (Counts.size() < First + NumEntries)
+    Counts.resize(First + NumEntries, ProfileInfoLoader::Uncounted);
+  for (uint64_t i = 0; i != NumEntries; ++i)
+    Counts[First + i] = AddCounts(New[i], Counts[First + i]);
+}
+
+// AssignSlice - Overwrite the counters of Data from First on, like double
+// packets are read.
+static void AssignSlice(ProfileCounters<double> &Data, uint64_t First,
+                        const double *New, uint64_t NumEntries) {
+  std::vector<double> &Counts = Data.own();
+  if (Counts.size() < First + NumEntries)
+    Counts.resize(First + NumEntries, 0);
+  std::copy(New, New + NumEntries, Counts.begin() + First);
+}
+
+static void AssignSlice(ProfileCounters<uint64_t> &Data, uint64_t First,
+                        const double *New, uint64_t NumEntries) {
+  std::vector<uint64_t> &Counts = Data.own();
+  if (Counts.size() < First + NumEntries)
+    Counts.resize(First + NumEntries, 0);
+  for (uint64_t i = 0; i != NumEntries; ++i)
+    Counts[First + i] = (uint64_t)New[i];
+}
+
+// addIndexedCounts - Add the records of the indexed profiles to the counters,
+// laid out as if they had been written as ordinary packets.
+//
+void ProfileInfoLoader::addIndexedCounts() const {
+  std::vector<unsigned> TempCounters32;
+  std::vector<uint64_t> TempCounters64;
+  std::vector<double> TempDoubles;
+  IndexedPending = false;
+  for (unsigned p = 0, pe = Indexed.size(); p != pe; ++p)
+    for (unsigned f = 0, fe = Indexed[p].size(); f != fe; ++f) {
+      const IndexedRecord &F = Indexed[p][f];
+      SliceReader S(ToolName, *Buffer, F.Offset, F.Size, F.ByteSwapped);
+      while (S.next()) {
+        switch (S.Kind) {
+        case EdgeInfo64:
+          AddSlice(EdgeCounts, S.First,
+                   S.counters(S.NumEntries, TempCounters64), S.NumEntries);
+          break;
+        case BlockInfo64:
+          AddSlice(BlockCounts, S.First,
+                   S.counters(S.NumEntries, TempCounters64), S.NumEntries);
+          break;
+        case MPIFullInfo:
+          AddSlice(MPIFullCounters, S.First,
+                   S.counters(S.NumEntries, TempCounters32), S.NumEntries);
+          break;
+        case BlockInfoDouble:
+          AssignSlice(BlockCounts, S.First,
+                      S.counters(S.NumEntries, TempDoubles), S.NumEntries);
+          break;
+        case MPITimeInfo:
+          AssignSlice(TimeMess, S.First,
+                      S.counters(S.NumEntries, TempDoubles), S.NumEntries);
+          break;
+        case ValueInfo:
+        case ValueHistInfo: {
+          std::vector<int> TempContent, Content;
+          AddSlice(ValueCounts, S.First,
+                   S.counters(S.NumEntries, TempCounters32), S.NumEntries);
+          if (ValueContents.size() < S.First + S.NumEntries)
+            ValueContents.resize(S.First + S.NumEntries);
+          for (uint64_t i = S.First; i != S.First + S.NumEntries; ++i) {
+            unsigned Count = S.read<unsigned>("indexed");
+            const int *New = S.counters(Count, TempContent);
+            if (Count == 0) continue;
+            Content.assign(New, New + Count);
+            if (S.Kind == ValueHistInfo) {
+              MergeValueHistogram(ValueContents[i], Content);
+              ValueHistograms = true;
+            }
+            else
+              ValueContents[i].swap(Content);
+          }
+          break;
+        }
+        default:
+          break;
+        }
+      }
+    }
+  // The value contents are indexed by the sites of the counts.
+  if (ValueContents.size() < ValueCounts.size())
+    ValueContents.resize(ValueCounts.size());
+}
+
+ProfileInfoLoader::RecordStatus
+ProfileInfoLoader::getFunctionCounts(StringRef Name, uint64_t Checksum,
+                                     int Kind,
+                                     std::vector<uint64_t> &Counts) const {
+  RecordStatus Status = RecordMissing;
+  std::vector<unsigned> TempCounters32;
+  std::vector<uint64_t> TempCounters64;
+  IndexedRecord Key;
+  Key.Name = Name;
+  Counts.clear();
+  for (unsigned p = 0, pe = Indexed.size(); p != pe; ++p) {
+    std::pair<std::vector<IndexedRecord>::const_iterator,
+              std::vector<IndexedRecord>::const_iterator> Range =
+        std::equal_range(Indexed[p].begin(), Indexed[p].end(), Key);
+    for (; Range.first != Range.second; ++Range.first) {
+      const IndexedRecord &F = *Range.first;
+      if (F.Checksum != Checksum) {
+        if (Status == RecordMissing) Status = RecordOutOfDate;
+        continue;
+      }
+      Status = RecordFound;
+      // Slices of the same kind follow each other in the order of their
+      // counters.
+      SliceReader S(ToolName, *Buffer, F.Offset, F.Size, F.ByteSwapped);
+      uint64_t At = 0;
+      while (S.next()) {
+        if (S.Kind != Kind) continue;
+        if (Counts.size() < At + S.NumEntries)
+          Counts.resize(At + S.NumEntries, 0);
+        if (Kind == EdgeInfo64 || Kind == BlockInfo64) {
+          const uint64_t *New = S.counters(S.NumEntries, TempCounters64);
+          for (uint64_t i = 0; i != S.NumEntries; ++i)
+            Counts[At + i] += New[i];
+        } else if (SliceEntrySize(Kind) == 4) {
+          const unsigned *New = S.counters(S.NumEntries, TempCounters32);
+          for (uint64_t i = 0; i != S.NumEntries; ++i)
+            Counts[At + i] += New[i];
+        }
+        At += S.NumEntries;
+      }
+    }
+  }
+  return Status;
+}
+
+// decodeBBTrace - Append the block numbers of the BBTraceDeltaInfo packets to
+// BBTrace.  Every packet holds zig-zag varint deltas, starting from block 0.
+//
+void ProfileInfoLoader::decodeBBTrace() const {
+  std::vector<unsigned> &Trace = BBTrace.own();
+  for (unsigned i = 0, e = EncodedBBTrace.size(); i != e; ++i) {
+    const unsigned char *P = EncodedBBTrace[i].Bytes;
+    const unsigned char *End = P + EncodedBBTrace[i].NumBytes;
+    unsigned Prev = 0, n = EncodedBBTrace[i].NumBlocks;
+    for (; n != 0 && P != End; --n) {
+      unsigned ZigZag = 0, Shift = 0;
+      while (P != End && (*P & 0x80)) {
+        ZigZag |= (unsigned)(*P++ & 0x7f) << Shift;
+        Shift += 7;
+      }
+      if (P == End) break;
+      ZigZag |= (unsigned)*P++ << Shift;
+      Prev += (ZigZag >> 1) ^ -(ZigZag & 1);
+      Trace.push_back(Prev);
+    }
+    if (n != 0) {
+      errs() << "WARNING: basic block trace of '" << Filename
+             << "' is truncated\n";
+      break;
+    }
+  }
+  EncodedBBTrace.clear();
+}
+
+void ProfileInfoLoader::clearCounts() {
+  FunctionCounts.clear();
+  BlockCounts.clear();
+  TimeMess.clear();
+  TimeMin.clear();
+  TimeMax.clear();
+  EdgeCounts.clear();
+  OptimalEdgeCounts.clear();
+  BBTrace.clear();
+  EncodedBBTrace.clear();
+  ValueCounts.clear();
+  ValueContents.clear();
+  ValueHistograms = false;
+  SLGCounts.clear();
+  MPICounts.clear();
+  MPIFullCounters.clear();
+  RankCounts.clear();
+  PathCounts.clear();
+  Stats.clear();
+  Indexed.clear();
+  IndexedPending = false;
+}
+
+// readSnapshot - Load the counts of snapshot Sequence: the sum of the
+// cumulative snapshots with that sequence number, or of the delta snapshots up
+// to it.  Returns false if the file has no such snapshot.
+//
+bool ProfileInfoLoader::readSnapshot(const char *ToolName, uint64_t Sequence) {
+  bool Found = false;
+  clearCounts();
+  for (unsigned i = 0, e = Snapshots.size(); i != e; ++i) {
+    const Snapshot &S = Snapshots[i];
+    if (S.Delta ? S.Sequence > Sequence : S.Sequence != Sequence)
+      continue;
+    readPackets(ToolName, S.Offset, S.Offset + S.Size);
+    Found |= S.Sequence == Sequence;
+  }
+  return Found;
+}
+
+void ProfileInfoLoader::useSnapshot(const char *ToolName, uint64_t Sequence,
+                                    int64_t Base) {
+  std::unique_ptr<ProfileInfoLoader> Prev;
+  if (Base >= 0) {
+    if (!readSnapshot(ToolName, Base)) {
+      errs() << ToolName << ": '" << Filename << "' has no snapshot #" << Base
+             << "\n";
       exit(1);
     }
+    Prev.reset(new ProfileInfoLoader(*this));
+  }
+  if (!readSnapshot(ToolName, Sequence)) {
+    errs() << ToolName << ": '" << Filename << "' has no snapshot #"
+           << Sequence << "\n";
+    exit(1);
   }
 
-  fclose(F);
+  if (Prev) {
+    SubtractCounts(FunctionCounts.own(), Prev->FunctionCounts.get());
+    SubtractCounts(BlockCounts.own(), Prev->BlockCounts.get());
+    SubtractCounts(TimeMess.own(), Prev->TimeMess.get());
+    SubtractCounts(EdgeCounts.own(), Prev->EdgeCounts.get());
+    SubtractCounts(OptimalEdgeCounts.own(), Prev->OptimalEdgeCounts.get(),
+                   Uncounted64);
+    SubtractCounts(MPIFullCounters.own(), Prev->MPIFullCounters.get());
+    SubtractCounts(RankCounts.own(), Prev->RankCounts.get());
+  }
 }
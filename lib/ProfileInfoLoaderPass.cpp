@@ -24,6 +24,7 @@
 #include <llvm/Support/Format.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/IR/Constants.h>
+#include "ProfileDataTypes.h"
 #include "ProfileInfo.h"
 #include "ProfileInfoLoader.h"
 #include "InitializeProfilerPass.h"
@@ -43,10 +44,20 @@ ProfileInfoFilename("profile-info-file", cl::init("llvmprof.out"),
                     cl::desc("Profile file loaded by -profile-loader"));
 
 namespace {
+  // InstructionIndex - The instructions of the module the profile counters
+  // map to, in program order, see indexInstructions.
+  struct InstructionIndex {
+    std::vector<CallInst*> Traps;         // calls of llvm_profiling_trap_value
+    std::vector<CallInst*> MPICalls;      // mpi calls with a count argument
+    std::vector<CallInst*> MPITimeCalls;  // the mpi calls which are timed
+    std::vector<Instruction*> LoadsAndStores;
+    unsigned NumIndirectCalls;
+  };
+
   class LoaderPass : public ModulePass, public ProfileInfo {
     std::string Filename;
     std::set<Edge> SpanningTree;
-    std::set<const BasicBlock*> BBisUnvisited;
+    std::set<const Function*> OutOfDate;
     unsigned ReadCount;
   public:
     static char ID; // Class identification, replacement for typeinfo
@@ -64,11 +75,15 @@ namespace {
       return "Profiling information loader";
     }
 
-    // recurseBasicBlock() - Calculates the edge weights for as much basic
-    // blocks as possbile.
-    virtual void recurseBasicBlock(const BasicBlock *BB);
+    // calculateSpanningTree() - Calculates the weights of the edges in
+    // SpanningTree from the weights of the other edges of their function.
+    virtual bool calculateSpanningTree();
     virtual void readEdgeOrRemember(Edge, Edge&, unsigned &, double &);
-    virtual void readEdge(ProfileInfo::Edge, std::vector<uint64_t>&);
+    virtual void readEdge(ProfileInfo::Edge, ArrayRef<uint64_t>,
+                          uint64_t Uncounted = ProfileInfoLoader::Uncounted);
+    bool readFunctionRecords(Module &M, const ProfileInfoLoader &PIL,
+                             int Kind);
+    void indexInstructions(Module &M, InstructionIndex &Index);
 
     /// getAdjustedAnalysisPointer - This method is used when a pass implements
     /// an analysis interface through multiple inheritance.  If needed, it
@@ -115,35 +130,46 @@ void LoaderPass::readEdgeOrRemember(Edge edge, Edge &tocalc,
   }
 }
 
-// recurseBasicBlock - Visits all neighbours of a block and then tries to
-// calculate the missing edge values.
-void LoaderPass::recurseBasicBlock(const BasicBlock *BB) {
-
-  // break recursion if already visited
-  if (BBisUnvisited.find(BB) == BBisUnvisited.end()) return;
-  BBisUnvisited.erase(BB);
-  if (!BB) return;
-
-  for (succ_const_iterator bbi = succ_begin(BB), bbe = succ_end(BB);
-       bbi != bbe; ++bbi) {
-    recurseBasicBlock(*bbi);
+// calculateSpanningTree - Flow conservation: once all but one of the edges
+// entering and leaving a block are known, the last one is their difference.
+// The uncounted edges form a spanning tree, so starting from its leaves every
+// edge is reached. Works with a worklist, deep CFGs do not exhaust the stack.
+// Returns false if some edges could not be calculated.
+bool LoaderPass::calculateSpanningTree() {
+  std::vector<const BasicBlock*> Worklist;
+  for (std::set<Edge>::iterator ei = SpanningTree.begin(),
+       ee = SpanningTree.end(); ei != ee; ++ei) {
+    if (ei->first) Worklist.push_back(ei->first);
+    if (ei->second) Worklist.push_back(ei->second);
   }
-  for (const_pred_iterator bbi = pred_begin(BB), bbe = pred_end(BB);
-       bbi != bbe; ++bbi) {
-    recurseBasicBlock(*bbi);
+
+  while (!Worklist.empty() && !SpanningTree.empty()) {
+    const BasicBlock *BB = Worklist.back();
+    Worklist.pop_back();
+    Edge tocalc;
+    if (!CalculateMissingEdge(BB, tocalc) || !SpanningTree.erase(tocalc))
+      continue;
+    // The blocks at both ends may have become solvable.
+    if (tocalc.first) Worklist.push_back(tocalc.first);
+    if (tocalc.second) Worklist.push_back(tocalc.second);
   }
 
-  Edge tocalc;
-  if (CalculateMissingEdge(BB, tocalc)) {
-    SpanningTree.erase(tocalc);
+  if (SpanningTree.empty()) return true;
+  DEBUG(dbgs() << "{");
+  for (std::set<Edge>::iterator ei = SpanningTree.begin(),
+       ee = SpanningTree.end(); ei != ee; ++ei) {
+    DEBUG(dbgs() << *ei << ",");
   }
+  DEBUG(dbgs() << "}\n");
+  SpanningTree.clear();
+  return false;
 }
 
 void LoaderPass::readEdge(ProfileInfo::Edge e,
-                          std::vector<uint64_t> &ECs) {
+                          ArrayRef<uint64_t> ECs, uint64_t Uncounted) {
   if (ReadCount < ECs.size()) {
-    double weight = ECs[ReadCount++];
-    if (weight != ProfileInfoLoader::Uncounted) {
+    uint64_t weight = ECs[ReadCount++];
+    if (weight != Uncounted) {
       // Here the data realm changes from the unsigned of the file to the
       // double of the ProfileInfo. This conversion is save because we know
       // that everything thats representable in unsinged is also representable
@@ -161,6 +187,87 @@ void LoaderPass::readEdge(ProfileInfo::Edge e,
   }
 }
 
+// readFunctionRecords - Read the EdgeInfo64 or BlockInfo64 counts of an
+// indexed profile one function at a time.  A function changed since it was
+// profiled is left without counts.  Returns false if there are no Kind
+// records, the counts are then read from ordinary packets.
+bool LoaderPass::readFunctionRecords(Module &M, const ProfileInfoLoader &PIL,
+                                     int Kind) {
+  std::vector<uint64_t> Counts;
+  bool Found = false;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    ProfileInfoLoader::RecordStatus Status =
+        PIL.getFunctionCounts(F->getName(), FunctionCFGChecksum(F), Kind,
+                              Counts);
+    if (Status == ProfileInfoLoader::RecordOutOfDate &&
+        OutOfDate.insert(F).second)
+      errs() << "WARNING: profile of " << F->getName()
+             << " is out of date, ignored!\n";
+    if (Status != ProfileInfoLoader::RecordFound || Counts.empty()) continue;
+
+    Found = true;
+    ReadCount = 0;
+    if (Kind == EdgeInfo64) {
+      readEdge(getEdge(0,&F->getEntryBlock()), Counts);
+      for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+        TerminatorInst *TI = BB->getTerminator();
+        for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s)
+          readEdge(getEdge(BB,TI->getSuccessor(s)), Counts);
+      }
+      NumEdgesRead += ReadCount;
+    } else {
+      for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+        if (ReadCount < Counts.size())
+          BlockInformation[F][BB] = (double)Counts[ReadCount++];
+    }
+    if (ReadCount != Counts.size())
+      errs() << "WARNING: profile information of " << F->getName()
+             << " is inconsistent with the current program!\n";
+  }
+  return Found;
+}
+
+// indexInstructions - Gather in one walk over the module the instructions
+// the value, SLG, MPI and mpi time counters map to.  The callees are told
+// apart by name once each, not at every call.
+void LoaderPass::indexInstructions(Module &M, InstructionIndex &Index) {
+  enum { TrapCallee = 1, MPICallee = 2, MPITimeCallee = 4, IndirectCallee = 8 };
+  DenseMap<const Value*, unsigned> Callees;
+  Index.NumIndirectCalls = 0;
+  for(Module::iterator F = M.begin(), E = M.end(); F != E; ++F){
+     for(inst_iterator I = inst_begin(F), IE = inst_end(F); I != IE; ++I){
+        if(isa<LoadInst>(&*I) || isa<StoreInst>(&*I)){
+           Index.LoadsAndStores.push_back(&*I);
+           continue;
+        }
+        CallInst* CI = dyn_cast<CallInst>(&*I);
+        if(CI == NULL) continue;
+        Value* CV = CI->getCalledValue();
+        std::pair<DenseMap<const Value*, unsigned>::iterator, bool> Found =
+           Callees.insert(std::make_pair(CV, 0U));
+        unsigned &Kind = Found.first->second;
+        if(Found.second){
+           if(CV->getName() == "llvm_profiling_trap_value") Kind |= TrapCallee;
+           if(lle::get_mpi_count_idx(CI)) Kind |= MPICallee;
+           Function* func = dyn_cast<Function>(lle::castoff(CV));
+           if(func == NULL) Kind |= IndirectCallee;
+           else{
+              StringRef str = func->getName();
+              if((str.startswith("mpi_")||str.startswith("MPI_")) &&
+                 !str.startswith("mpi_init_") && !str.startswith("mpi_comm_rank_") &&
+                 !str.startswith("mpi_comm_size_"))
+                 Kind |= MPITimeCallee;
+           }
+        }
+        if(Kind & TrapCallee) Index.Traps.push_back(CI);
+        if(Kind & MPICallee) Index.MPICalls.push_back(CI);
+        if(Kind & MPITimeCallee) Index.MPITimeCalls.push_back(CI);
+        if(Kind & IndirectCallee) ++Index.NumIndirectCalls;
+     }
+  }
+}
+
 /** signal max **/
 inline unsigned sig_max(unsigned acc, unsigned b)
 {
@@ -172,11 +279,17 @@ inline unsigned sig_max(unsigned acc, unsigned b)
 bool LoaderPass::runOnModule(Module &M) {
   ProfileInfoLoader PIL("profile-loader", Filename);
 
+  Dense.clear();
+  SortedTraps.clear();
   EdgeInformation.clear();
-  std::vector<uint64_t> Counters64 = PIL.getRawEdgeCounts();
+  OutOfDate.clear();
+  bool IndexedEdges = PIL.hasFunctionRecords() &&
+                      readFunctionRecords(M, PIL, EdgeInfo64);
+  ArrayRef<uint64_t> Counters64;
+  if (!IndexedEdges) Counters64 = PIL.getRawEdgeCounts();
   if (Counters64.size() > 0) {
     ReadCount = 0;
-    std::vector<uint64_t>& Counters = Counters64;
+    ArrayRef<uint64_t> Counters = Counters64;
     for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
       if (F->isDeclaration()) continue;
       DEBUG(dbgs() << "Working on " << F->getName() << "\n");
@@ -195,46 +308,28 @@ bool LoaderPass::runOnModule(Module &M) {
     NumEdgesRead = ReadCount;
   }
 
-#if 0
-  std::vector<unsigned> Counters = PIL.getRawOptimalEdgeCounts();
-  if (Counters.size() > 0) {
+  Counters64 = PIL.getRawOptimalEdgeCounts();
+  if (Counters64.size() > 0) {
     ReadCount = 0;
+    ArrayRef<uint64_t> Counters = Counters64;
+    const uint64_t Uncounted = ProfileInfoLoader::Uncounted64;
     for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
       if (F->isDeclaration()) continue;
       DEBUG(dbgs() << "Working on " << F->getName() << "\n");
-      readEdge(getEdge(0,&F->getEntryBlock()), Counters);
+      SpanningTree.clear();
+      readEdge(getEdge(0,&F->getEntryBlock()), Counters, Uncounted);
       for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
         TerminatorInst *TI = BB->getTerminator();
         if (TI->getNumSuccessors() == 0) {
-          readEdge(getEdge(BB,0), Counters);
+          readEdge(getEdge(BB,0), Counters, Uncounted);
         }
         for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s) {
-          readEdge(getEdge(BB,TI->getSuccessor(s)), Counters);
+          readEdge(getEdge(BB,TI->getSuccessor(s)), Counters, Uncounted);
         }
       }
-      while (SpanningTree.size() > 0) {
-
-        unsigned size = SpanningTree.size();
-
-        BBisUnvisited.clear();
-        for (std::set<Edge>::iterator ei = SpanningTree.begin(),
-             ee = SpanningTree.end(); ei != ee; ++ei) {
-          BBisUnvisited.insert(ei->first);
-          BBisUnvisited.insert(ei->second);
-        }
-        while (BBisUnvisited.size() > 0) {
-          recurseBasicBlock(*BBisUnvisited.begin());
-        }
-
-        if (SpanningTree.size() == size) {
-          DEBUG(dbgs()<<"{");
-          for (std::set<Edge>::iterator ei = SpanningTree.begin(),
-               ee = SpanningTree.end(); ei != ee; ++ei) {
-            DEBUG(dbgs()<< *ei <<",");
-          }
-          assert(0 && "No edge calculated!");
-        }
-
+      if (!calculateSpanningTree()) {
+        errs() << "WARNING: unable to calculate all edge counts of "
+               << F->getName() << " from the optimal edge profile!\n";
       }
     }
     if (ReadCount != Counters.size()) {
@@ -243,12 +338,13 @@ bool LoaderPass::runOnModule(Module &M) {
     }
     NumEdgesRead = ReadCount;
   }
-#endif
 
   BlockInformation.clear();
-  Counters64 = PIL.getRawBlockCounts();
+  bool IndexedBlocks = PIL.hasFunctionRecords() &&
+                       readFunctionRecords(M, PIL, BlockInfo64);
+  Counters64 = IndexedBlocks ? ArrayRef<uint64_t>() : PIL.getRawBlockCounts();
   if (Counters64.size() > 0) {
-    std::vector<uint64_t>& Counters = Counters64;
+    ArrayRef<uint64_t> Counters = Counters64;
     ReadCount = 0;
     for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
       if (F->isDeclaration()) continue;
@@ -267,7 +363,7 @@ bool LoaderPass::runOnModule(Module &M) {
   }
 
   FunctionInformation.clear();
-  std::vector<unsigned> Counters = PIL.getRawFunctionCounts();
+  ArrayRef<unsigned> Counters = PIL.getRawFunctionCounts();
   if (Counters.size() > 0) {
     ReadCount = 0;
     for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
@@ -285,27 +381,25 @@ bool LoaderPass::runOnModule(Module &M) {
     }
   }
 
+  InstructionIndex Index;
+  indexInstructions(M, Index);
+
   ValueInformation.clear();
   Counters = PIL.getRawValueCounts();
   if(Counters.size() > 0) {
-	  ReadCount = 0;
-	  for(Module::iterator F = M.begin(),E = M.end(); F!= E; ++F) {
-		  if (F->isDeclaration()) continue;
-		  for(inst_iterator I = inst_begin(F),IE = inst_end(F); I!=IE; ++I){
-			  CallInst* Call = dyn_cast<CallInst>(&*I);
-           if(!Call) continue;
-			  if(Call->getCalledValue()->getName() != "llvm_profiling_trap_value") continue;
-			  unsigned index = getTrapedIndex(Call);
-			  ValueCounts Ins;
-			  Ins.Nums = Counters[index];
-			  const std::vector<int>& content = PIL.getRawValueContent(index);
-			  Ins.flags = (ProfilingFlags)content.front();
-			  Ins.Contents.resize(content.size()-1);
-			  copy(content.begin()+1,content.end(),Ins.Contents.begin());
-			  //should NOT insert two values into one cell.
-			  ValueInformation[Call] = Ins;
-		  }
-	  }
+     for(auto Call : Index.Traps){
+        unsigned index = getTrapedIndex(Call);
+        ValueCounts Ins;
+        Ins.Nums = Counters[index];
+        const std::vector<int>& content = PIL.getRawValueContent(index);
+        Ins.flags = (ProfilingFlags)content.front();
+        Ins.Other = 0;
+        std::vector<int>::const_iterator First = content.begin()+1;
+        if(Ins.flags & VALUE_HISTOGRAM) Ins.Other = *First++;
+        Ins.Contents.assign(First,content.end());
+        //should NOT insert two values into one cell.
+        ValueInformation[Call] = Ins;
+     }
   }
 
   SLGInformation.clear();
@@ -315,31 +409,28 @@ bool LoaderPass::runOnModule(Module &M) {
      std::vector<const Instruction*> Cache(MaxStore+1);
      ReadCount = 0;
      unsigned load_idx = 0, store_idx = 1;
-     for(Module::iterator F = M.begin(), E = M.end(); F!=E; ++F){
-        for(inst_iterator I = inst_begin(F), IE = inst_end(F); I!=IE; ++I){
-           if(!isa<StoreInst>(&*I) && !isa<LoadInst>(&*I)) continue;
-           if(lle::access_global_variable(&*I)){
-              unsigned index = 0;
-              Instruction* SLI = &*I;
-              if(isa<StoreInst>(&*I)){
-                 index = store_idx++;
-              }else if(LoadInst* LI = dyn_cast<LoadInst>(&*I)){
-                 SLGInformation[LI] = std::make_pair(load_idx, (Instruction*)NULL);
-                 index = Counters[load_idx++];
-                 if(index == 0 || index == ~0U/*unsigned -1*/){
-                    continue;
-                 }
+     for(auto I : Index.LoadsAndStores){
+        if(lle::access_global_variable(I)){
+           unsigned index = 0;
+           Instruction* SLI = I;
+           if(isa<StoreInst>(I)){
+              index = store_idx++;
+           }else if(LoadInst* LI = dyn_cast<LoadInst>(I)){
+              SLGInformation[LI] = std::make_pair(load_idx, (Instruction*)NULL);
+              index = Counters[load_idx++];
+              if(index == 0 || index == ~0U/*unsigned -1*/){
+                 continue;
               }
-              if(index >= Cache.size()) continue;
-              if(Cache[index]){
-                 const Instruction* SLJ = Cache[index];
-                 if(isa<StoreInst>(SLJ) && isa<LoadInst>(SLI)) SLGInformation[SLI].second = SLJ;
-                 else if(isa<StoreInst>(SLI) && isa<LoadInst>(SLJ)) SLGInformation[SLJ].second = SLI;
-                 else
-                    assert(0 && "It shouldn't happen");
-              }else
-                 Cache[index] = &*I;
            }
+           if(index >= Cache.size()) continue;
+           if(Cache[index]){
+              const Instruction* SLJ = Cache[index];
+              if(isa<StoreInst>(SLJ) && isa<LoadInst>(SLI)) SLGInformation[SLI].second = SLJ;
+              else if(isa<StoreInst>(SLI) && isa<LoadInst>(SLJ)) SLGInformation[SLJ].second = SLI;
+              else
+                 assert(0 && "It shouldn't happen");
+           }else
+              Cache[index] = I;
         }
      }
   }
@@ -353,15 +444,9 @@ bool LoaderPass::runOnModule(Module &M) {
   Counters = PIL.getRawMPICounts();
   if(Counters.size() > 0) {
      ReadCount = 0;
-     for(auto F = M.begin(), E = M.end(); F!=E; ++F){
-        for(auto I = inst_begin(F), IE = inst_end(F); I!=IE; ++I){
-           CallInst* CI = dyn_cast<CallInst>(&*I);
-           if(CI == NULL) continue;
-           if(lle::get_mpi_count_idx(CI)){
-              MPInformation[CI] = std::make_pair(ReadCount, Counters[ReadCount]);
-              ++ReadCount;
-           }
-        }
+     for(auto CI : Index.MPICalls){
+        MPInformation[CI] = std::make_pair(ReadCount, Counters[ReadCount]);
+        ++ReadCount;
      }
   }
 
@@ -369,43 +454,26 @@ bool LoaderPass::runOnModule(Module &M) {
   Counters = PIL.getRawMPIFullCounts();
   if(Counters.size() > 0) {
      ReadCount = 0;
-     for(auto F = M.begin(), E = M.end(); F!=E; ++F){
-        for(auto I = inst_begin(F), IE = inst_end(F); I!=IE; ++I){
-           CallInst* CI = dyn_cast<CallInst>(&*I);
-           if(CI == NULL) continue;
-           if(lle::get_mpi_count_idx(CI)){
-              MPIFullInformation[CI] = std::make_pair(ReadCount, Counters[ReadCount]);
-              ++ReadCount;
-           }
-        }
+     for(auto CI : Index.MPICalls){
+        MPIFullInformation[CI] = std::make_pair(ReadCount, Counters[ReadCount]);
+        ++ReadCount;
      }
   }
 
   MPITimeInformation.clear();
-  std::vector<double> MPITimeCounters = PIL.getRawTimeMess();
+  ArrayRef<double> MPITimeCounters = PIL.getRawTimeMess();
   if(MPITimeCounters.size() > 0) {
+     if(Index.NumIndirectCalls)
+        errs()<<"No func! "<<Index.NumIndirectCalls
+              <<" indirect calls are not timed\n";
      ReadCount = 0;
-     for(auto F = M.begin(), E = M.end(); F!=E; ++F){
-        for(auto I = inst_begin(F), IE = inst_end(F); I!=IE; ++I){
-           CallInst* CI = dyn_cast<CallInst>(&*I);
-           if(CI == NULL) continue;
-           Value* CV = const_cast<CallInst*>(CI)->getCalledValue();
-           Function* func = dyn_cast<Function>(lle::castoff(CV));
-           if(func == NULL)
-           {
-             errs()<<"No func!\n";
-	     continue;
-	   }
-           StringRef str = func->getName();
-           if(str.startswith("mpi_")||str.startswith("MPI_"))
-           {
-              if(str.startswith("mpi_init_")||str.startswith("mpi_comm_rank_")||str.startswith("mpi_comm_size_"))
-                 continue;
-              MPITimeInformation[CI] = std::make_pair(ReadCount, MPITimeCounters[ReadCount]);
-              ++ReadCount;
-           }
-        }
+     for(auto CI : Index.MPITimeCalls){
+        MPITimeInformation[CI] = std::make_pair(ReadCount, MPITimeCounters[ReadCount]);
+        ++ReadCount;
      }
   }
+
+  buildDenseIndex(M);
+  buildTrapSites();
   return false;
 }
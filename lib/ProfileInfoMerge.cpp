@@ -0,0 +1,473 @@
+//===- ProfileInfoMerge.cpp - Merge the profiles of several runs ----------===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements ProfileInfoMerge and the parallel merge of profile
+// files, typically the per rank profiles of a MPI job.
+//
+//===----------------------------------------------------------------------===//
+
+#include "preheader.h"
+#include <llvm/Support/raw_ostream.h>
+#include "ProfileInfoMerge.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <memory>
+#include <thread>
+
+using namespace llvm;
+
+ProfileInfoMerge::ProfileInfoMerge(MergeMode Mode)
+  : Mode(Mode), NumProfiles(0), ValueHistograms(false), HasBBTrace(false) {}
+
+template<class T>
+static T Combine(ProfileInfoMerge::MergeMode Mode, T A, T B) {
+  switch (Mode) {
+  case ProfileInfoMerge::MergeMax:
+    return std::max(A, B);
+  case ProfileInfoMerge::MergeMin:
+    return std::min(A, B);
+  default:
+    return A + B;
+  }
+}
+
+// MergeCounts - Combine the counters New into Data, leaving out those equal to
+// Uncounted.  The counters only one side has are taken as they are.
+template<class T, class NewT>
+static void MergeCounts(std::vector<T> &Data, ArrayRef<NewT> New,
+                        ProfileInfoMerge::MergeMode Mode, uint64_t Uncounted) {
+  size_t Common = std::min(Data.size(), New.size());
+  for (size_t i = 0; i != Common; ++i) {
+    if (New[i] == Uncounted) continue;
+    Data[i] = Data[i] == Uncounted ? New[i] : Combine<T>(Mode, Data[i], New[i]);
+  }
+  Data.insert(Data.end(), New.begin() + Common, New.end());
+}
+
+// MergeTimes - MergeCounts for times, which are all counted.
+static void MergeTimes(std::vector<double> &Data, ArrayRef<double> New,
+                       ProfileInfoMerge::MergeMode Mode) {
+  size_t Common = std::min(Data.size(), New.size());
+  for (size_t i = 0; i != Common; ++i)
+    Data[i] = Combine(Mode, Data[i], New[i]);
+  Data.insert(Data.end(), New.begin() + Common, New.end());
+}
+
+// MergePaths - Combine the path counts of a profile into Paths, which holds
+// those of NumProfiles profiles.
+static void MergePaths(ProfileInfoLoader::PathCountMap &Paths,
+                       const ProfileInfoLoader::PathCountMap &New,
+                       ProfileInfoMerge::MergeMode Mode, unsigned NumProfiles) {
+  typedef ProfileInfoLoader::PathCountMap::const_iterator FunctionIterator;
+  typedef std::map<unsigned, uint64_t>::const_iterator PathIterator;
+  if (NumProfiles == 0) {
+    Paths = New;
+    return;
+  }
+  if (Mode == ProfileInfoMerge::MergeMin) {
+    // only the paths executed in every profile have a minimum above 0
+    ProfileInfoLoader::PathCountMap Common;
+    for (FunctionIterator F = New.begin(), FE = New.end(); F != FE; ++F) {
+      FunctionIterator Old = Paths.find(F->first);
+      if (Old == Paths.end()) continue;
+      for (PathIterator P = F->second.begin(), PE = F->second.end(); P != PE;
+           ++P) {
+        PathIterator OldPath = Old->second.find(P->first);
+        if (OldPath != Old->second.end())
+          Common[F->first][P->first] = std::min(OldPath->second, P->second);
+      }
+    }
+    Paths.swap(Common);
+    return;
+  }
+  for (FunctionIterator F = New.begin(), FE = New.end(); F != FE; ++F) {
+    std::map<unsigned, uint64_t> &Counts = Paths[F->first];
+    for (PathIterator P = F->second.begin(), PE = F->second.end(); P != PE;
+         ++P) {
+      std::pair<std::map<unsigned, uint64_t>::iterator, bool> Inserted =
+          Counts.insert(*P);
+      if (!Inserted.second)
+        Inserted.first->second =
+            Combine(Mode, Inserted.first->second, P->second);
+    }
+  }
+}
+
+// MergeValueContent - Gather the contents New of a value site into Data.
+// Plain contents are the flags followed by the values.
+static void MergeValueContent(std::vector<int> &Data,
+                              const std::vector<int> &New, bool Histogram) {
+  if (New.empty()) return;
+  if (Histogram) {
+    MergeValueHistogram(Data, New);
+  } else if (Data.empty()) {
+    Data = New;
+  } else {
+    Data[0] |= New[0];
+    Data.insert(Data.end(), New.begin() + 1, New.end());
+  }
+}
+
+// The buckets of a distribution are quarters of an octave, bucket 0 holds
+// the values which are not positive.
+static const int BucketBias = 4400;
+
+static unsigned short Bucket(double Value) {
+  if (!(Value > 0)) return 0;
+  int B = (int)std::floor(std::log2(Value) * 4) + BucketBias;
+  return std::max(1, std::min(B, 65535));
+}
+
+static double BucketValue(unsigned short B) {
+  return B == 0 ? 0 : std::exp2((B - BucketBias + 0.5) / 4);
+}
+
+typedef std::pair<unsigned short, unsigned> BucketCount;
+
+static bool BucketLess(const BucketCount &L, const BucketCount &R) {
+  return L.first < R.first;
+}
+
+void ProfileInfoMerge::Distribution::add(double Value, unsigned Rank) {
+  if (N == 0 || Value < Min) Min = Value;
+  if (N == 0 || Value > Max || (Value == Max && Rank < MaxRank)) {
+    Max = Value;
+    MaxRank = Rank;
+  }
+  ++N;
+  double Delta = Value - Mean;
+  Mean += Delta / N;
+  M2 += Delta * (Value - Mean);
+
+  BucketCount Key(Bucket(Value), 1);
+  std::vector<BucketCount>::iterator I =
+      std::lower_bound(Buckets.begin(), Buckets.end(), Key, BucketLess);
+  if (I != Buckets.end() && I->first == Key.first)
+    ++I->second;
+  else
+    Buckets.insert(I, Key);
+}
+
+void ProfileInfoMerge::Distribution::add(const Distribution &D) {
+  if (D.N == 0) return;
+  if (N == 0) {
+    *this = D;
+    return;
+  }
+  Min = std::min(Min, D.Min);
+  if (D.Max > Max || (D.Max == Max && D.MaxRank < MaxRank)) {
+    Max = D.Max;
+    MaxRank = D.MaxRank;
+  }
+  // the parallel variant of the running variance
+  double Delta = D.Mean - Mean;
+  uint64_t Total = N + D.N;
+  Mean += Delta * D.N / Total;
+  M2 += D.M2 + Delta * Delta * ((double)N * D.N / Total);
+  N = Total;
+
+  std::vector<BucketCount> Merged;
+  Merged.reserve(Buckets.size() + D.Buckets.size());
+  std::vector<BucketCount>::const_iterator I = Buckets.begin(),
+      E = Buckets.end(), DI = D.Buckets.begin(), DE = D.Buckets.end();
+  while (I != E || DI != DE) {
+    if (DI == DE || (I != E && I->first < DI->first)) {
+      Merged.push_back(*I++);
+    } else if (I == E || DI->first < I->first) {
+      Merged.push_back(*DI++);
+    } else {
+      Merged.push_back(BucketCount(I->first, I->second + DI->second));
+      ++I;
+      ++DI;
+    }
+  }
+  Buckets.swap(Merged);
+}
+
+// percentile - The value below which a fraction P of the values fall, the
+// middle of its bucket kept within the extremes.
+double ProfileInfoMerge::Distribution::percentile(double P) const {
+  uint64_t Target = std::max<uint64_t>(1, (uint64_t)std::ceil(P * N));
+  uint64_t Seen = 0;
+  for (size_t i = 0, e = Buckets.size(); i != e; ++i) {
+    Seen += Buckets[i].second;
+    if (Seen >= Target)
+      return std::min(Max, std::max(Min, BucketValue(Buckets[i].first)));
+  }
+  return Max;
+}
+
+CounterStats ProfileInfoMerge::Distribution::get() const {
+  CounterStats S;
+  S.min = Min;
+  S.max = Max;
+  S.mean = Mean;
+  S.stddev = N ? std::sqrt(M2 / N) : 0;
+  S.p50 = percentile(0.5);
+  S.p90 = percentile(0.9);
+  S.p99 = percentile(0.99);
+  S.argmaxRank = MaxRank;
+  S.numRanks = N;
+  return S;
+}
+
+// AddValues - Add the counters of the profile Rank to their distributions,
+// except the uncounted ones.
+template<class T>
+static void AddValues(std::vector<ProfileInfoMerge::Distribution> &Stats,
+                      ArrayRef<T> New, unsigned Rank, bool MayBeUncounted) {
+  if (Stats.size() < New.size()) Stats.resize(New.size());
+  for (size_t i = 0, e = New.size(); i != e; ++i)
+    if (!MayBeUncounted || New[i] != ProfileInfoLoader::Uncounted)
+      Stats[i].add((double)New[i], Rank);
+}
+
+static void AddDistributions(std::vector<ProfileInfoMerge::Distribution> &Stats,
+                             const std::vector<ProfileInfoMerge::Distribution>
+                                 &New) {
+  if (Stats.size() < New.size()) Stats.resize(New.size());
+  for (size_t i = 0, e = New.size(); i != e; ++i)
+    Stats[i].add(New[i]);
+}
+
+static std::vector<CounterStats>
+GetStats(const std::vector<ProfileInfoMerge::Distribution> &Stats) {
+  std::vector<CounterStats> Result(Stats.size());
+  for (size_t i = 0, e = Stats.size(); i != e; ++i)
+    Result[i] = Stats[i].get();
+  return Result;
+}
+
+void ProfileInfoMerge::addProfileInfo(const ProfileInfoLoader &PIL,
+                                      unsigned Rank) {
+  const uint64_t Uncounted = ProfileInfoLoader::Uncounted;
+  MergePaths(PathCounts, PIL.getRawPathCounts(), Mode, NumProfiles);
+  ++NumProfiles;
+  for (unsigned i = 0, e = PIL.getNumExecutions(); i != e; ++i)
+    CommandLines.push_back(PIL.getExecution(i));
+
+  MergeCounts(FunctionCounts, PIL.getRawFunctionCounts(), Mode, ~0U);
+  MergeCounts(BlockCounts, PIL.getRawBlockCounts(), Mode, Uncounted);
+  MergeCounts(EdgeCounts, PIL.getRawEdgeCounts(), Mode, Uncounted);
+  MergeCounts(OptimalEdgeCounts, PIL.getRawOptimalEdgeCounts(), Mode,
+              ProfileInfoLoader::Uncounted64);
+  MergeCounts(SLGCounts, PIL.getRawSLGCounts(), Mode, ~0U);
+  MergeCounts(MPICounts, PIL.getRawMPICounts(), Mode, ~0U);
+  MergeCounts(MPIFullCounts, PIL.getRawMPIFullCounts(), Mode, ~0U);
+  MergeCounts(RankCounts, PIL.getRawRankCounts(), MergeMin, ~0U);
+
+  // A profile of a single rank has no time range, its times are both the
+  // minimum and the maximum.
+  ArrayRef<double> Times = PIL.getRawTimeMess();
+  bool HasRange = !PIL.getRawTimeMin().empty();
+  MergeTimes(TimeMess, Times, Mode);
+  MergeTimes(TimeMin, HasRange ? PIL.getRawTimeMin() : Times, MergeMin);
+  MergeTimes(TimeMax, HasRange ? PIL.getRawTimeMax() : Times, MergeMax);
+
+  // Contents of the other kind than those merged so far are left out, there
+  // is no way to combine histograms with values.
+  ArrayRef<unsigned> Values = PIL.getRawValueCounts();
+  if (ValueCounts.empty()) ValueHistograms = PIL.hasValueHistograms();
+  if (ValueHistograms == PIL.hasValueHistograms()) {
+    if (ValueContents.size() < Values.size())
+      ValueContents.resize(Values.size());
+    for (unsigned i = 0, e = Values.size(); i != e; ++i)
+      MergeValueContent(ValueContents[i], PIL.getRawValueContent(i),
+                        ValueHistograms);
+  }
+  MergeCounts(ValueCounts, Values, Mode, ~0U);
+
+  HasBBTrace |= !PIL.getRawBBTrace().empty();
+
+  if (Mode == MergeStats) {
+    if (!PIL.getRawRankCounts().empty()) Rank = PIL.getRawRankCounts()[0];
+    AddValues(BlockStats, PIL.getRawBlockCounts(), Rank, true);
+    AddValues(EdgeStats, PIL.getRawEdgeCounts(), Rank, true);
+    AddValues(MPIFullStats, PIL.getRawMPIFullCounts(), Rank, true);
+    AddValues(TimeStats, Times, Rank, false);
+  }
+}
+
+void ProfileInfoMerge::addProfileInfo(const ProfileInfoMerge &PIM) {
+  const uint64_t Uncounted = ProfileInfoLoader::Uncounted;
+  assert(Mode == PIM.Mode && "merges of different modes");
+  if (PIM.NumProfiles == 0) return;
+  MergePaths(PathCounts, PIM.PathCounts, Mode, NumProfiles);
+  NumProfiles += PIM.NumProfiles;
+  CommandLines.insert(CommandLines.end(), PIM.CommandLines.begin(),
+                      PIM.CommandLines.end());
+
+  MergeCounts(FunctionCounts, makeArrayRef(PIM.FunctionCounts), Mode,
+              Uncounted);
+  MergeCounts(BlockCounts, makeArrayRef(PIM.BlockCounts), Mode, Uncounted);
+  MergeCounts(EdgeCounts, makeArrayRef(PIM.EdgeCounts), Mode, Uncounted);
+  MergeCounts(OptimalEdgeCounts, makeArrayRef(PIM.OptimalEdgeCounts), Mode,
+              ProfileInfoLoader::Uncounted64);
+  MergeCounts(SLGCounts, makeArrayRef(PIM.SLGCounts), Mode, Uncounted);
+  MergeCounts(MPICounts, makeArrayRef(PIM.MPICounts), Mode, Uncounted);
+  MergeCounts(MPIFullCounts, makeArrayRef(PIM.MPIFullCounts), Mode,
+              Uncounted);
+  MergeCounts(RankCounts, makeArrayRef(PIM.RankCounts), MergeMin, Uncounted);
+
+  MergeTimes(TimeMess, PIM.TimeMess, Mode);
+  MergeTimes(TimeMin, PIM.TimeMin, MergeMin);
+  MergeTimes(TimeMax, PIM.TimeMax, MergeMax);
+
+  if (ValueCounts.empty()) ValueHistograms = PIM.ValueHistograms;
+  if (ValueHistograms == PIM.ValueHistograms) {
+    if (ValueContents.size() < PIM.ValueContents.size())
+      ValueContents.resize(PIM.ValueContents.size());
+    for (size_t i = 0, e = PIM.ValueContents.size(); i != e; ++i)
+      MergeValueContent(ValueContents[i], PIM.ValueContents[i],
+                        ValueHistograms);
+  }
+  MergeCounts(ValueCounts, makeArrayRef(PIM.ValueCounts), Mode, Uncounted);
+
+  HasBBTrace |= PIM.HasBBTrace;
+
+  AddDistributions(BlockStats, PIM.BlockStats);
+  AddDistributions(EdgeStats, PIM.EdgeStats);
+  AddDistributions(MPIFullStats, PIM.MPIFullStats);
+  AddDistributions(TimeStats, PIM.TimeStats);
+}
+
+// Average - The counters of Data divided by N, except the uncounted ones.
+template<class T>
+static std::vector<T> Average(const std::vector<T> &Data, unsigned N,
+                              uint64_t Uncounted) {
+  std::vector<T> Avg(Data);
+  for (size_t i = 0, e = Avg.size(); i != e; ++i)
+    if (Avg[i] != Uncounted) Avg[i] /= N;
+  return Avg;
+}
+
+static std::vector<double> Average(const std::vector<double> &Data,
+                                   unsigned N) {
+  std::vector<double> Avg(Data);
+  for (size_t i = 0, e = Avg.size(); i != e; ++i)
+    Avg[i] /= N;
+  return Avg;
+}
+
+// Narrow - The counters of a 32 bit packet, those which do not fit are capped
+// below Uncounted.
+static std::vector<unsigned> Narrow(const std::vector<uint64_t> &Data,
+                                    bool &Capped) {
+  std::vector<unsigned> Counts(Data.size());
+  for (size_t i = 0, e = Data.size(); i != e; ++i) {
+    if (Data[i] > ProfileInfoLoader::Uncounted) Capped = true;
+    Counts[i] = Data[i] < ProfileInfoLoader::Uncounted ? Data[i]
+                : Data[i] == ProfileInfoLoader::Uncounted ? ~0U : ~0U - 1;
+  }
+  return Counts;
+}
+
+void ProfileInfoMerge::writeTotalFile(const char *ToolName,
+                                      const std::string &Filename) const {
+  if (HasBBTrace)
+    errs() << ToolName << ": warning: basic block traces are not merged\n";
+
+  ProfileInfoWriter PIW(ToolName, Filename);
+  for (unsigned i = 0, e = CommandLines.size(); i != e; ++i)
+    PIW.write(CommandLines[i]);
+
+  const uint64_t Uncounted = ProfileInfoLoader::Uncounted;
+  unsigned N = Mode == MergeAvg && NumProfiles > 1 ? NumProfiles : 1;
+  bool Capped = false;
+  PIW.write(FunctionInfo,
+            Narrow(Average(FunctionCounts, N, Uncounted), Capped));
+  PIW.write(BlockInfo64, Average(BlockCounts, N, Uncounted));
+  PIW.write(EdgeInfo64, Average(EdgeCounts, N, Uncounted));
+  PIW.write(OptEdgeInfo64, Average(OptimalEdgeCounts, N,
+                                   ProfileInfoLoader::Uncounted64));
+  PIW.writeValues(ValueHistograms ? ValueHistInfo : ValueInfo,
+                  Narrow(Average(ValueCounts, N, Uncounted), Capped),
+                  ValueContents);
+  PIW.write(SLGInfo, Narrow(Average(SLGCounts, N, Uncounted), Capped));
+  PIW.write(MPInfo, Narrow(Average(MPICounts, N, Uncounted), Capped));
+  PIW.write(MPIFullInfo,
+            Narrow(Average(MPIFullCounts, N, Uncounted), Capped));
+  PIW.write(RankInfo, RankCounts);
+  PIW.write(MPITimeInfo, Average(TimeMess, N));
+  PIW.writeTimeRange(TimeMin, TimeMax);
+  if (N == 1) {
+    PIW.writePaths(PathCounts);
+  } else {
+    ProfileInfoLoader::PathCountMap Paths(PathCounts);
+    for (ProfileInfoLoader::PathCountMap::iterator F = Paths.begin(),
+         FE = Paths.end(); F != FE; ++F)
+      for (std::map<unsigned, uint64_t>::iterator P = F->second.begin(),
+           PE = F->second.end(); P != PE; ++P)
+        P->second /= N;
+    PIW.writePaths(Paths);
+  }
+
+  PIW.writeStats(BlockInfo64, GetStats(BlockStats));
+  PIW.writeStats(EdgeInfo64, GetStats(EdgeStats));
+  PIW.writeStats(MPIFullInfo, GetStats(MPIFullStats));
+  PIW.writeStats(MPITimeInfo, GetStats(TimeStats));
+
+  if (Capped)
+    errs() << ToolName << ": warning: counters of 32 bit packets do not fit "
+              "and are capped\n";
+}
+
+// FoldProfiles - Load the profiles Begin to End of Inputs one at a time and
+// fold them into Merge.
+static void FoldProfiles(const char *ToolName,
+                         const std::vector<std::string> *Inputs, size_t Begin,
+                         size_t End, ProfileInfoMerge *Merge) {
+  for (size_t i = Begin; i != End; ++i) {
+    ProfileInfoLoader PIL(ToolName, (*Inputs)[i]);
+    Merge->addProfileInfo(PIL, i);
+  }
+}
+
+static void CombineProfiles(ProfileInfoMerge *Merge,
+                            const ProfileInfoMerge *Next) {
+  Merge->addProfileInfo(*Next);
+}
+
+void llvm::mergeProfiles(const char *ToolName,
+                         const std::vector<std::string> &Inputs,
+                         const std::string &Output,
+                         ProfileInfoMerge::MergeMode Mode,
+                         unsigned NumThreads) {
+  if (NumThreads == 0) NumThreads = std::thread::hardware_concurrency();
+  NumThreads = std::max<size_t>(1, std::min<size_t>(NumThreads, Inputs.size()));
+
+  // Each thread folds a run of inputs, so that the merged command lines and
+  // values keep the order of the inputs.
+  std::vector<std::unique_ptr<ProfileInfoMerge> > Partial(NumThreads);
+  std::vector<std::thread> Workers;
+  for (unsigned t = 0; t != NumThreads; ++t) {
+    Partial[t].reset(new ProfileInfoMerge(Mode));
+    Workers.push_back(std::thread(FoldProfiles, ToolName, &Inputs,
+                                  Inputs.size() * t / NumThreads,
+                                  Inputs.size() * (t + 1) / NumThreads,
+                                  Partial[t].get()));
+  }
+  for (unsigned t = 0; t != NumThreads; ++t)
+    Workers[t].join();
+
+  // Reduce the partial merges pairwise, freeing the ones folded in.
+  for (unsigned Step = 1; Step < NumThreads; Step *= 2) {
+    Workers.clear();
+    for (unsigned t = 0; t + Step < NumThreads; t += 2 * Step)
+      Workers.push_back(std::thread(CombineProfiles, Partial[t].get(),
+                                    Partial[t + Step].get()));
+    for (unsigned w = 0; w != Workers.size(); ++w)
+      Workers[w].join();
+    for (unsigned t = 0; t + Step < NumThreads; t += 2 * Step)
+      Partial[t + Step].reset();
+  }
+  Partial[0]->writeTotalFile(ToolName, Output);
+}
@@ -2,8 +2,10 @@
 #include <llvm/Support/raw_ostream.h>
 #include "ProfileInfoWriter.h"
 
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 using namespace llvm;
@@ -49,3 +51,155 @@ void ProfileInfoWriter::write(ProfilingType Type, const std::vector<unsigned int
      // errs()<<"store over!\n";
 }
 
+template<class T>
+static void writeWide(FILE* File, ProfilingType Type, const std::vector<T>& Counter)
+{
+   uint64_t NumEntries = Counter.size();
+   if(NumEntries == 0) return;
+   fwrite(&Type, sizeof(unsigned), 1, File);
+   fwrite(&NumEntries, sizeof(uint64_t), 1, File);
+   fwrite(&Counter[0], sizeof(T)*NumEntries, 1, File);
+}
+
+void ProfileInfoWriter::write(ProfilingType Type, const std::vector<uint64_t> &Counter)
+{
+   assert(Type == BlockInfo64 || Type == EdgeInfo64 || Type == OptEdgeInfo64);
+   writeWide(this->File, Type, Counter);
+}
+
+void ProfileInfoWriter::write(ProfilingType Type, const std::vector<double> &Counter)
+{
+   assert(Type == MPITimeInfo || Type == BlockInfoDouble);
+   writeWide(this->File, Type, Counter);
+}
+
+void ProfileInfoWriter::writeTimeRange(const std::vector<double>& Min,
+                                       const std::vector<double>& Max)
+{
+   assert(Min.size() == Max.size());
+   writeWide(this->File, MPITimeRangeInfo, Min);
+   if(!Max.empty())
+      fwrite(&Max[0], sizeof(double)*Max.size(), 1, this->File);
+}
+
+void ProfileInfoWriter::writeValues(ProfilingType Type,
+                                    const std::vector<unsigned>& Counts,
+                                    const std::vector<std::vector<int> >& Contents)
+{
+   assert(Type == ValueInfo || Type == ValueHistInfo);
+   unsigned NumEntries = Counts.size();
+   if(NumEntries == 0) return;
+   fwrite(&Type, sizeof(unsigned), 1, this->File);
+   fwrite(&NumEntries, sizeof(unsigned), 1, this->File);
+   fwrite(&Counts[0], sizeof(unsigned)*NumEntries, 1, this->File);
+   for(unsigned i = 0; i < NumEntries; ++i){
+      unsigned Count = i < Contents.size() ? Contents[i].size() : 0;
+      fwrite(&Count, sizeof(unsigned), 1, this->File);
+      if(Count) fwrite(&Contents[i][0], sizeof(int)*Count, 1, this->File);
+   }
+}
+
+void ProfileInfoWriter::writePaths(const ProfileInfoLoader::PathCountMap& Paths)
+{
+   typedef ProfileInfoLoader::PathCountMap::const_iterator FunctionIterator;
+   typedef std::map<unsigned, uint64_t>::const_iterator PathIterator;
+   unsigned Header[2] = { PathInfo64, 0 };
+   for(FunctionIterator F = Paths.begin(), FE = Paths.end(); F != FE; ++F)
+      if(!F->second.empty()) ++Header[1];
+   if(Header[1] == 0) return;
+   fwrite(Header, sizeof(Header), 1, this->File);
+   for(FunctionIterator F = Paths.begin(), FE = Paths.end(); F != FE; ++F){
+      if(F->second.empty()) continue;
+      PathProfileHeader Function;
+      Function.fnNumber = F->first;
+      Function.numEntries = F->second.size();
+      fwrite(&Function, sizeof(Function), 1, this->File);
+      for(PathIterator P = F->second.begin(), PE = F->second.end(); P != PE; ++P){
+         PathProfileTableEntry64 Entry;
+         Entry.pathNumber = P->first;
+         Entry.reserved = 0;
+         Entry.pathCounter = P->second;
+         fwrite(&Entry, sizeof(Entry), 1, this->File);
+      }
+   }
+}
+
+
+void ProfileInfoWriter::writeStats(ProfilingType Kind,
+                                   const std::vector<CounterStats>& Stats)
+{
+   int Header[2] = { StatsInfo, Kind };
+   uint64_t NumEntries = Stats.size();
+   if(NumEntries == 0) return;
+   fwrite(Header, sizeof(Header), 1, this->File);
+   fwrite(&NumEntries, sizeof(uint64_t), 1, this->File);
+   fwrite(&Stats[0], sizeof(CounterStats)*NumEntries, 1, this->File);
+}
+
+
+static bool RecordLess(const ProfileInfoWriter::IndexedRecord& L,
+                       const ProfileInfoWriter::IndexedRecord& R)
+{
+   int Cmp = strcmp(L.Name.c_str(), R.Name.c_str());
+   return Cmp ? Cmp < 0 : L.Checksum < R.Checksum;
+}
+
+template<class T>
+static void append(std::vector<char>& Out, const T* Data, size_t Count = 1)
+{
+   const char* Bytes = (const char*)Data;
+   Out.insert(Out.end(), Bytes, Bytes + sizeof(T) * Count);
+}
+
+static void pad(std::vector<char>& Out)
+{
+   Out.resize((Out.size() + 7) & ~(size_t)7, 0);
+}
+
+void ProfileInfoWriter::writeIndexed(std::vector<IndexedRecord> Records)
+{
+   if(Records.empty()) return;
+   std::sort(Records.begin(), Records.end(), RecordLess);
+
+   // the names and records are laid out first, the table then points into
+   // them
+   std::vector<IndexedFunction> Table(Records.size());
+   std::vector<char> Names, Data;
+   for(size_t i = 0, e = Records.size(); i != e; ++i){
+      Table[i].checksum = Records[i].Checksum;
+      Table[i].nameOffset = Names.size();
+      Table[i].recordOffset = Data.size();
+      Names.insert(Names.end(), Records[i].Name.c_str(),
+                   Records[i].Name.c_str() + Records[i].Name.size() + 1);
+      for(size_t s = 0, se = Records[i].Slices.size(); s != se; ++s){
+         const IndexedSlice& S = Records[i].Slices[s];
+         ::IndexedSlice Header;
+         Header.kind = S.Kind;
+         Header.reserved = 0;
+         Header.first = S.First;
+         Header.numEntries = S.Counters.size();
+         Header.size = S.Counters.size() * sizeof(uint64_t);
+         append(Data, &Header);
+         if(!S.Counters.empty())
+            append(Data, &S.Counters[0], S.Counters.size());
+      }
+      Table[i].recordSize = Data.size() - Table[i].recordOffset;
+   }
+   pad(Names);
+
+   IndexedHeader Header;
+   Header.numFunctions = Table.size();
+   Header.namesSize = Names.size();
+   Header.recordsSize = Data.size();
+   int Type = IndexedInfo;
+   unsigned Version = INDEXED_PROFILE_VERSION;
+   uint64_t Size = sizeof(Header) + Table.size() * sizeof(IndexedFunction) +
+                   Names.size() + Data.size();
+   fwrite(&Type, sizeof(int), 1, this->File);
+   fwrite(&Version, sizeof(unsigned), 1, this->File);
+   fwrite(&Size, sizeof(uint64_t), 1, this->File);
+   fwrite(&Header, sizeof(Header), 1, this->File);
+   fwrite(&Table[0], sizeof(IndexedFunction), Table.size(), this->File);
+   fwrite(&Names[0], 1, Names.size(), this->File);
+   if(!Data.empty()) fwrite(&Data[0], 1, Data.size(), this->File);
+}
@@ -15,16 +15,47 @@
 //===----------------------------------------------------------------------===//
 
 #include "preheader.h"
+#include <llvm/ADT/MapVector.h>
+#include <llvm/Analysis/LoopInfo.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
 #include "ProfilingUtils.h"
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+#include <llvm/Analysis/Dominators.h>
+#else
+#include <llvm/IR/Dominators.h>
+#endif
 
 using namespace llvm;
 
+static cl::opt<bool> ShardedCounters("profiling-sharded-counters",
+      cl::desc("Give every thread its own copy of the profiling counters and "
+               "sum them at exit, for multithreaded programs"),
+      cl::init(false));
+
+static cl::opt<bool> MappedCounters("profiling-mmap-counters",
+      cl::desc("Count into a shared mapping of the profile output file, so "
+               "that a killed process still leaves its profile behind"),
+      cl::init(false));
+
+static cl::opt<bool> IndexedCounters("profiling-indexed",
+      cl::desc("Write the counters as per function records of an indexed "
+               "profile, which can be checked against a changed program"),
+      cl::init(false));
+
+static cl::opt<bool> PromotedCounters("profiling-promote-counters",
+      cl::desc("Keep the counters of loops without calls in registers and "
+               "store them back on loop exit"),
+      cl::init(false));
+
 void llvm::InsertPredMPIProfilingInitCall(Function *MainFn, const char *FnName,
                                    GlobalValue *Array,
                                    GlobalValue *ArrayRank,
@@ -355,3 +386,307 @@ void llvm::InsertProfilingShutdownCall(Function *Callee, Module *Mod) {
   GlobalDtors->setInitializer(ConstantArray::get(
       cast<ArrayType>(GlobalDtors->getType()->getElementType()), dtors));
 }
+
+bool llvm::ShardCounterArray(GlobalVariable *CounterArray, int Kind) {
+  if (!ShardedCounters) return false;
+
+  Module &M = *CounterArray->getParent();
+  LLVMContext &Context = M.getContext();
+  ArrayType *ATy = cast<ArrayType>(CounterArray->getType()->getElementType());
+  Type *Int32Ty = Type::getInt32Ty(Context);
+  Type *Int64Ty = Type::getInt64Ty(Context);
+
+  // Each thread increments its own copy without any atomic operation. Align
+  // the copies to a cache line so that no two threads share a line.
+  CounterArray->setThreadLocal(true);
+  CounterArray->setAlignment(64);
+
+  // Per thread flag telling whether this thread's copy has been handed to the
+  // runtime yet.
+  GlobalVariable *Registered = new GlobalVariable(M, Type::getInt1Ty(Context),
+      false, GlobalValue::InternalLinkage, ConstantInt::getFalse(Context),
+      CounterArray->getName() + ".registered", 0,
+      GlobalVariable::GeneralDynamicTLSModel);
+
+  Constant *RegisterFn = M.getOrInsertFunction("llvm_register_counter_shard",
+                                               Type::getVoidTy(Context),
+                                               PointerType::getUnqual(
+                                                   ATy->getElementType()),
+                                               Int64Ty, Int32Ty,
+                                               (Type *)0);
+  std::vector<Constant*> GEPIndices(2, Constant::getNullValue(Int32Ty));
+  Constant *Start = ConstantExpr::getGetElementPtr(CounterArray, GEPIndices);
+  Value *Args[3] = { Start, ConstantInt::get(Int64Ty, ATy->getNumElements()),
+                     ConstantInt::get(Int32Ty, Kind) };
+
+  // A thread may enter the program through any function (thread entry points,
+  // OpenMP outlined regions, ...), so every function checks the flag on entry
+  // and registers the copy on the first visit. This runs after the counters
+  // have been placed, so the new blocks are never counted themselves.
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    BasicBlock *Entry = F->begin();
+    BasicBlock::iterator InsertPos = Entry->getFirstInsertionPt();
+    while (isa<AllocaInst>(InsertPos)) ++InsertPos;
+
+    BasicBlock *Body = Entry->splitBasicBlock(InsertPos, "shard.body");
+    BasicBlock *Register = BasicBlock::Create(Context, "shard.register", F,
+                                              Body);
+    Entry->getTerminator()->eraseFromParent();
+
+    IRBuilder<> Builder(Entry);
+    Builder.CreateCondBr(Builder.CreateLoad(Registered), Body, Register);
+    Builder.SetInsertPoint(Register);
+    Builder.CreateCall(RegisterFn, Args);
+    Builder.CreateStore(ConstantInt::getTrue(Context), Registered);
+    Builder.CreateBr(Body);
+  }
+  return true;
+}
+
+// AfterStartCalls - Where code which needs a started runtime goes: after the
+// last llvm_start_ call in the entry block of main.
+static Instruction *AfterStartCalls(Function *Main) {
+  BasicBlock *Entry = Main->begin();
+  BasicBlock::iterator InsertPos = Entry->getFirstInsertionPt();
+  while (isa<AllocaInst>(InsertPos)) ++InsertPos;
+  for (BasicBlock::iterator I = InsertPos, IE = Entry->end(); I != IE; ++I)
+    if (CallInst *CI = dyn_cast<CallInst>(I))
+      if (Function *Callee = CI->getCalledFunction())
+        if (Callee->getName().startswith("llvm_start_")) {
+          InsertPos = I;
+          ++InsertPos;
+        }
+  return InsertPos;
+}
+
+bool llvm::MapCounterArray(GlobalVariable *CounterArray, int Kind) {
+  if (!MappedCounters) return false;
+  if (CounterArray->isThreadLocal()) {
+    errs() << "WARNING: thread local counters " << CounterArray->getName()
+           << " can not be mapped onto the profile file!\n";
+    return false;
+  }
+
+  Module &M = *CounterArray->getParent();
+  Function *Main = M.getFunction("main");
+  if (Main == 0) return false;
+  LLVMContext &Context = M.getContext();
+  ArrayType *ATy = cast<ArrayType>(CounterArray->getType()->getElementType());
+  Type *ETy = ATy->getElementType();
+  PointerType *EPtrTy = PointerType::getUnqual(ETy);
+  Type *Int32Ty = Type::getInt32Ty(Context);
+  Type *Int64Ty = Type::getInt64Ty(Context);
+
+  // The instrumented code counts through this pointer, which the runtime moves
+  // from the array to its region of the output file.
+  std::vector<Constant*> GEPIndices(2, Constant::getNullValue(Int32Ty));
+  Constant *Start = ConstantExpr::getGetElementPtr(CounterArray, GEPIndices);
+  GlobalVariable *Base = new GlobalVariable(M, EPtrTy, false,
+      GlobalValue::InternalLinkage, Start, CounterArray->getName() + ".base");
+
+  // Redirect every counter load and store. Other uses, like the array handed
+  // to the runtime's start function, keep the original address.
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+    for (inst_iterator I = inst_begin(*F), IE = inst_end(*F); I != IE; ++I) {
+      unsigned PtrOp;
+      if (isa<LoadInst>(*I))
+        PtrOp = LoadInst::getPointerOperandIndex();
+      else if (isa<StoreInst>(*I))
+        PtrOp = StoreInst::getPointerOperandIndex();
+      else
+        continue;
+      ConstantExpr *CE = dyn_cast<ConstantExpr>(I->getOperand(PtrOp));
+      if (!CE || CE->getOpcode() != Instruction::GetElementPtr ||
+          CE->getOperand(0) != CounterArray || CE->getNumOperands() != 3)
+        continue;
+      IRBuilder<> Builder(&*I);
+      Value *Counter = Builder.CreateGEP(Builder.CreateLoad(Base, "CounterBase"),
+                                         CE->getOperand(2));
+      I->setOperand(PtrOp, Counter);
+    }
+
+  // Map the array right after the runtime has been started, once the output
+  // file name is known.
+  Type *VoidPtrTy = Type::getInt8PtrTy(Context);
+  Constant *MapFn = M.getOrInsertFunction("llvm_map_counter_array",
+                                          Type::getVoidTy(Context),
+                                          PointerType::getUnqual(VoidPtrTy),
+                                          VoidPtrTy, Int64Ty, Int32Ty, Int32Ty,
+                                          (Type *)0);
+  Value *Args[5] = {
+    ConstantExpr::getBitCast(Base, PointerType::getUnqual(VoidPtrTy)),
+    ConstantExpr::getBitCast(Start, VoidPtrTy),
+    ConstantInt::get(Int64Ty, ATy->getNumElements()),
+    ConstantInt::get(Int32Ty, ETy->getPrimitiveSizeInBits() / 8),
+    ConstantInt::get(Int32Ty, Kind)
+  };
+  CallInst::Create(MapFn, Args, "", AfterStartCalls(Main));
+  return true;
+}
+
+bool llvm::IndexCounterArray(GlobalVariable *CounterArray, int Kind,
+                             const std::vector<IndexedRange> &Ranges) {
+  if (!IndexedCounters) return false;
+  if (MappedCounters) {
+    errs() << "WARNING: mapped counters " << CounterArray->getName()
+           << " can not be written as an indexed profile!\n";
+    return false;
+  }
+
+  Module &M = *CounterArray->getParent();
+  Function *Main = M.getFunction("main");
+  if (Main == 0) return false;
+  LLVMContext &Context = M.getContext();
+  ArrayType *ATy = cast<ArrayType>(CounterArray->getType()->getElementType());
+  Type *Int32Ty = Type::getInt32Ty(Context);
+  Type *Int64Ty = Type::getInt64Ty(Context);
+  Type *VoidPtrTy = Type::getInt8PtrTy(Context);
+
+  // The table is an array of IndexedCounters, see ProfileInfoTypes.h.
+  StructType *EntryTy = StructType::get(VoidPtrTy, Int64Ty, Int64Ty, Int64Ty,
+                                        (Type *)0);
+  std::vector<Constant*> GEPIndices(2, Constant::getNullValue(Int32Ty));
+  std::vector<Constant*> Entries;
+  for (unsigned i = 0, e = Ranges.size(); i != e; ++i) {
+    Constant *Name = ConstantDataArray::getString(Context,
+                                                  Ranges[i].F->getName());
+    GlobalVariable *NameVar = new GlobalVariable(M, Name->getType(), true,
+        GlobalValue::PrivateLinkage, Name, "prof.name");
+    Constant *Fields[4] = {
+      ConstantExpr::getGetElementPtr(NameVar, GEPIndices),
+      ConstantInt::get(Int64Ty, Ranges[i].Checksum),
+      ConstantInt::get(Int64Ty, Ranges[i].First),
+      ConstantInt::get(Int64Ty, Ranges[i].Count)
+    };
+    Entries.push_back(ConstantStruct::get(EntryTy, Fields));
+  }
+  ArrayType *TableTy = ArrayType::get(EntryTy, Entries.size());
+  GlobalVariable *Table = new GlobalVariable(M, TableTy, true,
+      GlobalValue::InternalLinkage, ConstantArray::get(TableTy, Entries),
+      CounterArray->getName() + ".index");
+
+  Constant *IndexFn = M.getOrInsertFunction("llvm_index_counter_array",
+                                            Type::getVoidTy(Context),
+                                            VoidPtrTy, Int32Ty, Int32Ty,
+                                            PointerType::getUnqual(EntryTy),
+                                            Int32Ty, (Type *)0);
+  Constant *Start = ConstantExpr::getGetElementPtr(CounterArray, GEPIndices);
+  Value *Args[5] = {
+    ConstantExpr::getBitCast(Start, VoidPtrTy),
+    ConstantInt::get(Int32Ty, Kind),
+    ConstantInt::get(Int32Ty,
+                     ATy->getElementType()->getPrimitiveSizeInBits() / 8),
+    ConstantExpr::getGetElementPtr(Table, GEPIndices),
+    ConstantInt::get(Int32Ty, Entries.size())
+  };
+  CallInst::Create(IndexFn, Args, "", AfterStartCalls(Main));
+  return true;
+}
+
+// MayLeaveUncounted - Whether the loop contains a call which could exit the
+// program, or count into the array itself, while the counters of the loop are
+// kept in registers. Only calls to external functions which do not write
+// memory are safe; the attributes of functions in the module describe them
+// before they were instrumented.
+static bool MayLeaveUncounted(Loop *L) {
+  for (Loop::block_iterator BI = L->block_begin(), BE = L->block_end();
+       BI != BE; ++BI)
+    for (BasicBlock::iterator I = (*BI)->begin(), E = (*BI)->end(); I != E;
+         ++I) {
+      if (isa<InvokeInst>(I)) return true;
+      CallInst *CI = dyn_cast<CallInst>(I);
+      if (!CI || isa<DbgInfoIntrinsic>(CI)) continue;
+      Function *Callee = CI->getCalledFunction();
+      if (!Callee || !Callee->isDeclaration() || !CI->onlyReadsMemory())
+        return true;
+    }
+  return false;
+}
+
+// PromoteInLoop - Give every counter of CounterArray used in L a stack slot,
+// loaded in the preheader and stored back in each exit block. Loops which
+// can not be promoted as a whole are tried one level deeper.
+static void PromoteInLoop(Loop *L, GlobalValue *CounterArray,
+                          std::vector<AllocaInst*> &Slots) {
+  BasicBlock *Preheader = L->getLoopPreheader();
+  if (!Preheader || !L->hasDedicatedExits() || MayLeaveUncounted(L)) {
+    for (Loop::iterator SubL = L->begin(), E = L->end(); SubL != E; ++SubL)
+      PromoteInLoop(*SubL, CounterArray, Slots);
+    return;
+  }
+
+  // In first use order, which keeps the emitted IR independent of addresses.
+  MapVector<Constant*, AllocaInst*> Promoted;
+  BasicBlock *Entry = &Preheader->getParent()->getEntryBlock();
+  for (Loop::block_iterator BI = L->block_begin(), BE = L->block_end();
+       BI != BE; ++BI)
+    for (BasicBlock::iterator I = (*BI)->begin(), E = (*BI)->end(); I != E;
+         ++I) {
+      unsigned PtrOp;
+      if (isa<LoadInst>(*I))
+        PtrOp = LoadInst::getPointerOperandIndex();
+      else if (isa<StoreInst>(*I))
+        PtrOp = StoreInst::getPointerOperandIndex();
+      else
+        continue;
+      ConstantExpr *CE = dyn_cast<ConstantExpr>(I->getOperand(PtrOp));
+      if (!CE || CE->getOpcode() != Instruction::GetElementPtr ||
+          CE->getOperand(0) != CounterArray)
+        continue;
+
+      AllocaInst *&Slot = Promoted[CE];
+      if (!Slot) {
+        Type *ETy = CE->getType()->getPointerElementType();
+        Slot = new AllocaInst(ETy, "PromotedCounter", Entry->begin());
+        new StoreInst(new LoadInst(CE, "OldLoopCounter",
+                                   Preheader->getTerminator()),
+                      Slot, Preheader->getTerminator());
+        Slots.push_back(Slot);
+      }
+      I->setOperand(PtrOp, Slot);
+      // PredBlockDouble counts with volatile accesses, which would keep the
+      // slot in memory.
+      if (LoadInst *LI = dyn_cast<LoadInst>(I)) LI->setVolatile(false);
+      if (StoreInst *SI = dyn_cast<StoreInst>(I)) SI->setVolatile(false);
+    }
+  if (Promoted.empty()) return;
+
+  SmallVector<BasicBlock*, 8> Exits;
+  L->getUniqueExitBlocks(Exits);
+  for (unsigned i = 0, e = Exits.size(); i != e; ++i) {
+    BasicBlock::iterator InsertPos = Exits[i]->getFirstInsertionPt();
+    for (MapVector<Constant*, AllocaInst*>::iterator P = Promoted.begin(),
+         PE = Promoted.end(); P != PE; ++P)
+      new StoreInst(new LoadInst(P->second, "NewLoopCounter", InsertPos),
+                    P->first, InsertPos);
+  }
+}
+
+bool llvm::PromoteLoopCounters(GlobalVariable *CounterArray) {
+  if (!PromotedCounters) return false;
+
+  Module &M = *CounterArray->getParent();
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    DominatorTree DT;
+    LoopInfoBase<BasicBlock, Loop> LI;
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
+    DT.runOnFunction(*F);
+    LI.Analyze(DT.getBase());
+#else
+    DT.recalculate(*F);
+    LI.Analyze(DT);
+#endif
+
+    // Only loads, stores and allocas are added, the dominator tree stays
+    // valid for the promotion to SSA values.
+    std::vector<AllocaInst*> Slots;
+    for (LoopInfoBase<BasicBlock, Loop>::iterator L = LI.begin(),
+         LE = LI.end(); L != LE; ++L)
+      PromoteInLoop(*L, CounterArray, Slots);
+    if (!Slots.empty())
+      PromoteMemToReg(Slots, DT);
+  }
+  return true;
+}
@@ -17,6 +17,9 @@
 #ifndef PROFILINGUTILS_H
 #define PROFILINGUTILS_H
 
+#include <stdint.h>
+#include <vector>
+
 namespace llvm {
   class BasicBlock;
   class Function;
@@ -43,6 +46,51 @@ namespace llvm {
                                bool beginning = true);
   void InsertProfilingShutdownCall(Function *Callee, Module *Mod);
 
+  // ShardCounterArray - With -profiling-sharded-counters, turn CounterArray
+  // into a thread local, cache line aligned array and make every function
+  // register the running thread's copy with the runtime before its first
+  // increment. Kind is the ProfilingType the array is written out as; the
+  // runtime sums all copies into that one packet at exit. Returns false (and
+  // leaves the array alone) when sharding was not requested.
+  bool ShardCounterArray(GlobalVariable *CounterArray, int Kind);
+
+  // MapCounterArray - With -profiling-mmap-counters, make the counters of
+  // CounterArray live in a shared mapping of the output file, where the runtime
+  // lays them out as a Kind packet. All loads and stores of the counters are
+  // redirected through a pointer the runtime sets up right after the start
+  // call in main. Returns false when mapping was not requested.
+  bool MapCounterArray(GlobalVariable *CounterArray, int Kind);
+
+  // PromoteLoopCounters - With -profiling-promote-counters, keep the counters
+  // of CounterArray which are incremented inside a loop in registers for the
+  // duration of the loop: they are loaded in the preheader, carried in phis
+  // and stored back in the loop exit blocks. Loops with calls which may not
+  // return, or may count themselves, keep counting in memory. Call it after
+  // all counters have been placed and before ShardCounterArray or
+  // MapCounterArray. Returns false when promotion was not requested.
+  bool PromoteLoopCounters(GlobalVariable *CounterArray);
+
+  // IndexedRange - The counters First to First + Count - 1 of a counter array
+  // belong to F, whose CFG had the checksum FunctionCFGChecksum returned
+  // before any edge was split.
+  struct IndexedRange {
+    Function *F;
+    uint64_t Checksum;
+    uint64_t First;
+    uint64_t Count;
+    IndexedRange(Function *F, uint64_t Checksum, uint64_t First,
+                 uint64_t Count)
+      : F(F), Checksum(Checksum), First(First), Count(Count) {}
+  };
+
+  // IndexCounterArray - With -profiling-indexed, hand the runtime a table of
+  // the Ranges of CounterArray right after the start call in main, so that
+  // the counters are written out as the per function records of an
+  // IndexedInfo packet instead of a Kind packet. Returns false when indexing
+  // was not requested.
+  bool IndexCounterArray(GlobalVariable *CounterArray, int Kind,
+                         const std::vector<IndexedRange> &Ranges);
+
 }
 
 #endif
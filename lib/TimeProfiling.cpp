@@ -3,6 +3,8 @@
 #include <llvm/Pass.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/raw_ostream.h>
 #include <unordered_map>
 
@@ -10,6 +12,7 @@
 #include "ProfilingUtils.h"
 #include "ProfileInstrumentations.h"
 #include "ProfileDataTypes.h"
+#include "ProfileInfoLoader.h"
 
 namespace {
 	class TimeProfiler : public llvm::ModulePass
@@ -27,6 +30,15 @@ char TimeProfiler::ID = 0;
 static RegisterPass<TimeProfiler> X("insert-time-profiling",
 		"insert profiling for the time of mpi communication", false, false);
 
+enum TimerKind { TIMER_WTIME, TIMER_TSC, TIMER_TSCP };
+static cl::opt<TimerKind> Timer("time-profiling-timer",
+		cl::desc("How the time of mpi communication is taken"),
+		cl::init(TIMER_WTIME), cl::values(
+			clEnumValN(TIMER_WTIME, "wtime", "call mpi_wtime_ around each call"),
+			clEnumValN(TIMER_TSC, "tsc", "inline rdtsc, counted in cycles"),
+			clEnumValN(TIMER_TSCP, "tscp", "inline rdtscp, counted in cycles"),
+			clEnumValEnd));
+
 //Get the next instruction after Point
 static Value* getNextIns(Value* Point)
 {
@@ -64,6 +76,45 @@ static void IncrementTimeCounter(Value* Inc, Value* calle, unsigned Index, Globa
 	Builder.CreateStore(NewVal, ElementPtr);
 }
 
+//Read the time stamp counter inline, the same way as _timing in
+//src/libtiming.c does
+static Value* ReadTimestamp(IRBuilder<>& Builder)
+{
+	LLVMContext &Context = Builder.getContext();
+	Type* I32Ty = Type::getInt32Ty(Context);
+	Type* I64Ty = Type::getInt64Ty(Context);
+	Type* Halves[] = {I32Ty, I32Ty};
+	FunctionType* AsmTy = FunctionType::get(StructType::get(Context, Halves),
+			false);
+	InlineAsm* Asm = Timer == TIMER_TSCP
+		? InlineAsm::get(AsmTy, "rdtscp",
+				"={ax},={dx},~{ecx},~{memory},~{dirflag},~{fpsr},~{flags}", true)
+		: InlineAsm::get(AsmTy, "rdtsc",
+				"={ax},={dx},~{memory},~{dirflag},~{fpsr},~{flags}", true);
+	Value* Stamp = Builder.CreateCall(Asm, "tsc");
+	Value* Low = Builder.CreateZExt(Builder.CreateExtractValue(Stamp, 0), I64Ty);
+	Value* High = Builder.CreateZExt(Builder.CreateExtractValue(Stamp, 1), I64Ty);
+	return Builder.CreateOr(Builder.CreateShl(High, 32), Low, "timestamp");
+}
+static void IncrementCycleCounter(Value* Start, unsigned Index, GlobalVariable* Counters, IRBuilder<>& Builder, Value* Point)
+{
+	LLVMContext &Context = Start->getContext();
+	Builder.SetInsertPoint(dyn_cast<Instruction>(getNextIns(Point)));
+
+	std::vector<Constant*> Indices(2);
+	Indices[0] = Constant::getNullValue(Type::getInt32Ty(Context));
+	Indices[1] = ConstantInt::get(Type::getInt32Ty(Context), Index);
+	Constant *ElementPtr =
+		ConstantExpr::getGetElementPtr(Counters, Indices);
+
+	// a = a + (end_cycles - start_cycles), all in integers
+	Value* End = ReadTimestamp(Builder);
+	Value* OldVal = Builder.CreateLoad(ElementPtr, "OldTimeCounter");
+	Value* Elapsed = Builder.CreateSub(End, Start, "ElapsedCycles");
+	Value* NewVal = Builder.CreateAdd(OldVal, Elapsed, "NewTimeCounter");
+	Builder.CreateStore(NewVal, ElementPtr);
+}
+
 bool TimeProfiler::runOnModule(llvm::Module &M)
 {
 	Function *Main = M.getFunction("main");
@@ -78,9 +129,11 @@ bool TimeProfiler::runOnModule(llvm::Module &M)
 	CallInst* CommRank = NULL;
 	Function* CommRankFunc = NULL;
 	Instruction* Next = NULL;
+	std::vector<IndexedRange> Ranges;
 	for(auto F = M.begin(), E = M.end(); F!=E; ++F){
 		if((*F).getName() == "mpi_wtime_")
 			wtime = &*F;
+		unsigned First = Traped.size();
 		for(auto I = inst_begin(*F), IE = inst_end(*F); I!=IE; ++I){
 			CallInst* CI = dyn_cast<CallInst>(&*I);
 			if(CI == NULL) continue;
@@ -106,8 +159,11 @@ bool TimeProfiler::runOnModule(llvm::Module &M)
 				Traped.push_back(CI);
 			}
 		}
+		if(Traped.size() != First)
+			Ranges.push_back(IndexedRange(F, FunctionCFGChecksum(F), First,
+						Traped.size() - First));
 	}
-	if(wtime == NULL)
+	if(wtime == NULL && Timer == TIMER_WTIME)
 	{
 		std::vector<Type*> Doubles;
 		FunctionType *Ft = FunctionType::get(Type::getDoubleTy(Main->getContext()),Doubles,false);
@@ -116,15 +172,23 @@ bool TimeProfiler::runOnModule(llvm::Module &M)
 
 	IRBuilder<> Builder(M.getContext());
 
-	Type* DoubleTy = Type::getDoubleTy(M.getContext());
+	// seconds from mpi_wtime_, or cycles of the time stamp counter which the
+	// runtime converts to seconds when writing them out
+	Type* CounterTy = Timer == TIMER_WTIME ? Type::getDoubleTy(M.getContext())
+		: Type::getInt64Ty(M.getContext());
 
-	Type*ATy = ArrayType::get(DoubleTy, Traped.size());
+	Type*ATy = ArrayType::get(CounterTy, Traped.size());
 	GlobalVariable* Counters = new GlobalVariable(M, ATy, false,
 			GlobalVariable::InternalLinkage, Constant::getNullValue(ATy),
 			"TimeCounters");
 
 	unsigned I=0;
 	for(auto P : Traped){
+		if(Timer != TIMER_WTIME){
+			Builder.SetInsertPoint(P);
+			IncrementCycleCounter(ReadTimestamp(Builder), I++, Counters, Builder, P);
+			continue;
+		}
 		ArrayRef<Value*> args;
 		CallInst* callTime = CallInst::Create(wtime, args, "", P);
 
@@ -147,6 +211,15 @@ bool TimeProfiler::runOnModule(llvm::Module &M)
 		ConstantExpr::getGetElementPtr(RankCounters, Indices);
 	Builder.CreateStore(RankLoad, ElementPtr);
 
+	if(Timer != TIMER_WTIME){
+		// cycles are not mapped onto the profile file, it must only ever
+		// contain seconds
+		InsertPredMPIProfilingInitCall(Main, "llvm_start_time_tsc_profiling", Counters ,RankCounters);
+		IndexCounterArray(Counters, MPITimeInfo, Ranges);
+		return true;
+	}
 	InsertPredMPIProfilingInitCall(Main, "llvm_start_time_profiling", Counters ,RankCounters);
+	MapCounterArray(Counters, MPITimeInfo);
+	IndexCounterArray(Counters, MPITimeInfo, Ranges);
 	return true;
 }
@@ -77,6 +77,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <float.h>
+#include <algorithm>
 #include <functional>
 #include <fstream>
 #include <sstream>
@@ -271,6 +272,65 @@ MPITiming::MPITiming(Kind K, size_t N):TimingSource(K, N)
    this->R = atoi(REnv);
 }
 
+BlockHistogram::BlockHistogram(Module& M, unsigned NumGroups)
+   :NumGroups(NumGroups)
+{
+   for(auto& F : M)
+      for(auto& BB : F){
+         Numbers[&BB] = Blocks.size();
+         Blocks.push_back(&BB);
+      }
+   Counts.assign((size_t)NumGroups * Blocks.size(), 0);
+}
+
+void BBlockTiming::countGroups(BlockHistogram& H, unsigned N) const
+{
+   size_t Stride = H.getNumBlocks();
+   uint32_t* Counts = H.column(0) + N;
+   for(auto& I : *H.getBlock(N))
+      ++Counts[group(I) * Stride];
+}
+
+void BBlockTiming::blockCosts(const BlockHistogram& H, std::vector<double>& Costs) const
+{
+   unsigned NumBlocks = H.getNumBlocks();
+   Costs.assign(NumBlocks, 0.);
+   double* C = Costs.data();
+   // a column at a time, so that the inner loop is vectorized
+   for(unsigned G = 0, GE = std::min<size_t>(H.getNumGroups(), params.size()); G != GE; ++G){
+      double P = params[G];
+      const uint32_t* Col = H.column(G);
+      if(P == 0.) continue;
+      for(unsigned B = 0; B != NumBlocks; ++B)
+         C[B] += P * Col[B];
+   }
+}
+
+double BBlockTiming::count(const BlockHistogram& H, const std::vector<double>& Freqs) const
+{
+   unsigned NumBlocks = H.getNumBlocks();
+   const double* F = Freqs.data();
+   double Total = 0.;
+   // how many times every group executes, in four interleaved partial sums
+   // which the compiler keeps in the lanes of a vector register
+   for(unsigned G = 0, GE = std::min<size_t>(H.getNumGroups(), params.size()); G != GE; ++G){
+      if(params[G] == 0.) continue;
+      const uint32_t* Col = H.column(G);
+      double S0 = 0., S1 = 0., S2 = 0., S3 = 0.;
+      unsigned B = 0;
+      for(; B + 4 <= NumBlocks; B += 4){
+         S0 += F[B] * Col[B];
+         S1 += F[B+1] * Col[B+1];
+         S2 += F[B+2] * Col[B+2];
+         S3 += F[B+3] * Col[B+3];
+      }
+      for(; B != NumBlocks; ++B)
+         S0 += F[B] * Col[B];
+      Total += params[G] * ((S0 + S1) + (S2 + S3));
+   }
+   return Total;
+}
+
 StringRef LmbenchTiming::getName(EnumTy IG)
 {
    static SmallVector<std::string,NumGroups> InstGroupNames;
@@ -1,12 +1,15 @@
 #include "preheader.h"
 #include "ValueProfiling.h"
 #include "ProfilingUtils.h"
+#include "ProfileDataTypes.h"
+#include "ProfileInfoLoader.h"
 
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/Support/raw_ostream.h>
+#include <set>
 
 using namespace llvm;
 using namespace std;
@@ -60,6 +63,8 @@ Value* ValueProfiler::insertValueTrap(Value* v,Instruction* InsertBefore)
 			numTrapedValues++, InsertBefore);
 }
 
+static std::vector<IndexedRange> trapRanges(Module& M);
+
 bool ValueProfiler::runOnModule(Module& M)
 {
    // empty traps, this is mannual insertion, we search in module
@@ -81,5 +86,31 @@ bool ValueProfiler::runOnModule(Module& M)
 			GlobalVariable::InternalLinkage, Constant::getNullValue(ATy),
 			"ValueProfCounters");
 	InsertProfilingInitCall(Main, "llvm_start_value_profiling",Counters);
+	IndexCounterArray(Counters, ValueInfo, trapRanges(M));
 	return true;
 }
+
+// trapRanges - The runs of consecutive trap indices of every function, the
+// value counters they own.
+static std::vector<IndexedRange> trapRanges(Module& M)
+{
+   std::vector<IndexedRange> Ranges;
+   for(Function& F : M){
+      if(F.isDeclaration()) continue;
+      std::set<uint64_t> Traps;
+      for(auto I = inst_begin(F), E = inst_end(F); I!=E; ++I){
+         CallInst* CI = dyn_cast<CallInst>(&*I);
+         if(CI == NULL || CI->getCalledFunction() == NULL) continue;
+         if(CI->getCalledFunction()->getName() != "llvm_profiling_trap_value")
+            continue;
+         Traps.insert(cast<ConstantInt>(CI->getArgOperand(0))->getZExtValue());
+      }
+      uint64_t Checksum = FunctionCFGChecksum(&F);
+      for(auto T = Traps.begin(); T != Traps.end(); ){
+         uint64_t First = *T, Count = 0;
+         for(; T != Traps.end() && *T == First + Count; ++T) ++Count;
+         Ranges.push_back(IndexedRange(&F, Checksum, First, Count));
+      }
+   }
+   return Ranges;
+}
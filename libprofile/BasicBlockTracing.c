@@ -4,35 +4,163 @@
 |*
 |* This file is distributed under the University of Illinois Open Source
 |* License. See LICENSE.TXT for details.
-|* 
+|*
 |*===----------------------------------------------------------------------===*|
-|* 
+|*
 |* This file implements the call back routines for the basic block tracing
 |* instrumentation pass.  This should be used with the -trace-basic-blocks
 |* LLVM pass.
 |*
+|* The trace is collected in a ring of TRACE_BUFFERS buffers.  Full buffers
+|* are handed to a background thread, which encodes each block number as the
+|* zig-zag varint of its difference to the previous one and appends it to the
+|* output file as a BBTraceDeltaInfo packet:
+|*
+|*   int type, unsigned number of blocks, unsigned number of bytes,
+|*   bytes padded to 4
+|*
+|* The instrumented program only waits when every buffer is still queued.
+|*
 \*===----------------------------------------------------------------------===*/
 
 #include "Profiling.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_BUFFERS 4
+#define TRACE_BUFFER_SIZE (32 * 1024) /* block numbers per buffer */
+/* a varint of 32 bits takes at most 5 bytes */
+#define MAX_PACKET_SIZE (3 * sizeof(unsigned) + 5 * TRACE_BUFFER_SIZE + 3)
 
 static unsigned *ArrayStart, *ArrayEnd, *ArrayCursor;
 
-/* WriteAndFlushBBTraceData - write out the currently accumulated trace data
- * and reset the cursor to point to the beginning of the buffer.
+static unsigned *Buffers[TRACE_BUFFERS];
+static unsigned Filled[TRACE_BUFFERS]; /* block numbers in queued buffers */
+static unsigned Head = 0;    /* the next buffer to encode */
+static unsigned Tail = 0;    /* the buffer being filled */
+static unsigned Queued = 0;  /* buffers waiting for or being encoded */
+static int Done = 0;
+static int HaveWriter = 0;
+static pthread_t Writer;
+static pthread_mutex_t QueueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t NotEmpty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t NotFull = PTHREAD_COND_INITIALIZER;
+
+/* EncodeAndWrite - append one BBTraceDeltaInfo packet holding Count block
+ * numbers to the output file as one piece.  Packet is scratch space of
+ * MAX_PACKET_SIZE bytes.
+ */
+static void EncodeAndWrite(const unsigned *Ids, unsigned Count,
+                           unsigned char *Packet) {
+  unsigned char *Out = Packet + 3 * sizeof(unsigned);
+  unsigned Prev = 0, i, NumBytes, Header[3];
+  size_t Size;
+  int OutFile;
+
+  for (i = 0; i != Count; ++i) {
+    int Delta = (int)(Ids[i] - Prev);
+    unsigned ZigZag = ((unsigned)Delta << 1) ^ (unsigned)(Delta >> 31);
+    Prev = Ids[i];
+    while (ZigZag >= 0x80) {
+      *Out++ = (unsigned char)(ZigZag | 0x80);
+      ZigZag >>= 7;
+    }
+    *Out++ = (unsigned char)ZigZag;
+  }
+  NumBytes = Out - Packet - 3 * sizeof(unsigned);
+  while ((Out - Packet) & 3)
+    *Out++ = 0;
+
+  Header[0] = BBTraceDeltaInfo;
+  Header[1] = Count;
+  Header[2] = NumBytes;
+  memcpy(Packet, Header, sizeof(Header));
+  Size = Out - Packet;
+
+  if (profiling_packet_discarded(BBTraceDeltaInfo) ||
+      (OutFile = getOutFile()) == -1) return;
+  flush_profiling_arguments(OutFile);
+  if (append_profiling_output(OutFile, Packet, Size))
+    fprintf(stderr, "error: unable to write basic block trace.");
+}
+
+/* TraceWriter - the background thread encoding and writing full buffers. */
+static void *TraceWriter(void *Arg) {
+  unsigned char *Packet = malloc(MAX_PACKET_SIZE);
+  for (;;) {
+    unsigned Index, Count;
+    pthread_mutex_lock(&QueueLock);
+    while (Queued == 0 && !Done)
+      pthread_cond_wait(&NotEmpty, &QueueLock);
+    if (Queued == 0) {
+      pthread_mutex_unlock(&QueueLock);
+      break;
+    }
+    Index = Head;
+    Count = Filled[Index];
+    pthread_mutex_unlock(&QueueLock);
+
+    if (Packet)
+      EncodeAndWrite(Buffers[Index], Count, Packet);
+
+    pthread_mutex_lock(&QueueLock);
+    Head = (Head + 1) % TRACE_BUFFERS;
+    --Queued;
+    pthread_cond_signal(&NotFull);
+    pthread_mutex_unlock(&QueueLock);
+  }
+  free(Packet);
+  return 0;
+}
+
+/* WriteAndFlushBBTraceData - hand the currently accumulated trace data to the
+ * writer and move the cursor to the next free buffer, waiting for one if the
+ * writer is behind.  Without a writer thread the data is written right away.
  */
 static void WriteAndFlushBBTraceData () {
-  write_profiling_data(BBTraceInfo, ArrayStart, (ArrayCursor - ArrayStart));
-  ArrayCursor = ArrayStart;
+  unsigned Count = ArrayCursor - ArrayStart;
+  if (!HaveWriter) {
+    static unsigned char *Packet;
+    if (!Packet && !(Packet = malloc(MAX_PACKET_SIZE))) return;
+    if (Count)
+      EncodeAndWrite(ArrayStart, Count, Packet);
+    ArrayCursor = ArrayStart;
+    return;
+  }
+
+  pthread_mutex_lock(&QueueLock);
+  if (Count) {
+    Filled[Tail] = Count;
+    ++Queued;
+    Tail = (Tail + 1) % TRACE_BUFFERS;
+    pthread_cond_signal(&NotEmpty);
+  }
+  while (Queued == TRACE_BUFFERS)
+    pthread_cond_wait(&NotFull, &QueueLock);
+  pthread_mutex_unlock(&QueueLock);
+
+  ArrayStart = ArrayCursor = Buffers[Tail];
+  ArrayEnd = ArrayStart + TRACE_BUFFER_SIZE;
 }
 
-/* BBTraceAtExitHandler - When the program exits, just write out any remaining 
- * data and free the trace buffer.
+/* BBTraceAtExitHandler - When the program exits, just write out any remaining
+ * data, wait for the writer and free the trace buffers.
  */
 static void BBTraceAtExitHandler(void) {
+  unsigned i;
   WriteAndFlushBBTraceData ();
-  free (ArrayStart);
+  if (HaveWriter) {
+    pthread_mutex_lock(&QueueLock);
+    Done = 1;
+    pthread_cond_signal(&NotEmpty);
+    pthread_mutex_unlock(&QueueLock);
+    pthread_join(Writer, 0);
+  }
+  for (i = 0; i != TRACE_BUFFERS; ++i)
+    free (Buffers[i]);
 }
 
 /* llvm_trace_basic_block - called upon hitting a new basic block. */
@@ -44,21 +172,32 @@ void llvm_trace_basic_block (unsigned BBNum) {
 
 /* llvm_start_basic_block_tracing - This is the main entry point of the basic
  * block tracing library.  It is responsible for setting up the atexit
- * handler and allocating the trace buffer.
+ * handler, allocating the trace buffers and starting the writer thread.
  */
 int llvm_start_basic_block_tracing(int argc, const char **argv,
                               unsigned *arrayStart, unsigned numElements) {
   int Ret;
-  const unsigned BufferSize = 128 * 1024;
-  unsigned ArraySize;
+  unsigned i;
 
   Ret = save_arguments(argc, argv);
 
-  /* Allocate a buffer to contain BB tracing data */
-  ArraySize = BufferSize / sizeof (unsigned);
-  ArrayStart = malloc (ArraySize * sizeof (unsigned));
-  ArrayEnd = ArrayStart + ArraySize;
-  ArrayCursor = ArrayStart;
+  /* The trace packets are appended to the file directly and stand on their
+   * own.  The rest of the output of this run stays buffered, to be written at
+   * exit as one piece behind its command line.
+   */
+
+  /* Allocate the buffers to contain BB tracing data */
+  for (i = 0; i != TRACE_BUFFERS; ++i) {
+    Buffers[i] = malloc (TRACE_BUFFER_SIZE * sizeof (unsigned));
+    if (!Buffers[i]) {
+      fprintf(stderr, "error: unable to allocate basic block trace buffers.");
+      exit(0);
+    }
+  }
+  ArrayStart = ArrayCursor = Buffers[0];
+  ArrayEnd = ArrayStart + TRACE_BUFFER_SIZE;
+
+  HaveWriter = pthread_create(&Writer, 0, TraceWriter, 0) == 0;
 
   /* Set up the atexit handler. */
   atexit (BBTraceAtExitHandler);
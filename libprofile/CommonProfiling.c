@@ -16,7 +16,9 @@
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +35,80 @@ static const char *SavedEnvVar = 0;
 
 static const char *OutputFilename = "llvmprof.out";
 
+static CounterFolder FoldCounters = 0;
+
+/* Packets of this process waiting to be written.  They are emitted together by
+ * flush_profiling_data, so the whole run of a process reaches the output file
+ * as one piece.
+ */
+static char *OutBuffer = 0;
+static size_t OutBufferSize = 0;
+static size_t OutBufferCapacity = 0;
+
+/* The ArgumentInfo packet of this process is either not written yet, waiting
+ * at the start of OutBuffer, or already in the output file.  Threads appending
+ * straight to the file put it there first, see flush_profiling_arguments;
+ * the first OutBufferFlushed bytes of OutBuffer are then not written again.
+ */
+enum { ARGUMENTS_PENDING, ARGUMENTS_BUFFERED, ARGUMENTS_FLUSHED };
+static int ArgumentsState = ARGUMENTS_PENDING;
+static size_t OutBufferFlushed = 0;
+static pthread_mutex_t ArgumentsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Serializes the file writes of the threads of this process, the fcntl lock
+ * only keeps other processes out.
+ */
+static pthread_mutex_t OutputLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set once the MPI reduction runtime has summed the counters of all ranks.
+ * Only the root then writes the packet kinds the reduction merges, the other
+ * ranks keep writing the rest of their profile.
+ */
+static int RanksReduced = 0;
+static int IsRootRank = 1;
+static unsigned char ReducedKinds[StatsInfo + 1];
+
+/* Counter arrays which live in the output file itself, see
+ * llvm_map_counter_array.  Their packets are already in place at exit.
+ */
+#define MAX_MAPPED_COUNTERS 16
+static const void *MappedCounters[MAX_MAPPED_COUNTERS];
+static unsigned NumMappedCounters = 0;
+
+/* Counter arrays written only by the MASTER_RANK rank. */
+#define MAX_RANK_COUNTERS 4
+static const void *RankCounters[MAX_RANK_COUNTERS];
+static unsigned NumRankCounters = 0;
+
+/* set_counter_folder - Let 64 bit counter packets be summed over all per
+ * thread copies before they are written out.
+ */
+void set_counter_folder(CounterFolder Folder) {
+  FoldCounters = Folder;
+}
+
+void mark_packets_reduced(enum ProfilingType PT) {
+  if ((unsigned)PT < sizeof(ReducedKinds)) ReducedKinds[PT] = 1;
+}
+
+int packets_reduced(enum ProfilingType PT) {
+  return (unsigned)PT < sizeof(ReducedKinds) && ReducedKinds[PT];
+}
+
+void set_ranks_reduced(int IsRoot) {
+  RanksReduced = 1;
+  IsRootRank = IsRoot;
+}
+
+int profiling_packet_discarded(enum ProfilingType PT) {
+  return RanksReduced && !IsRootRank && packets_reduced(PT);
+}
+
+uint64_t* fold_profiling_counters(enum ProfilingType PT, uint64_t* Start,
+                                  uint64_t NumElements) {
+  return FoldCounters ? FoldCounters(PT, Start, NumElements) : 0;
+}
+
 /* check_environment_variable - Check to see if the LLVMPROF_OUTPUT environment
  * variable is set.  If it is then save it and set OutputFilename.
  */
@@ -58,6 +134,13 @@ static void check_environment_variable(void) {
  */
 int save_arguments(int argc, const char **argv) {
   unsigned Length, i;
+  static int FlushRegistered = 0;
+  /* Registered before any profiler's own atexit handler, so it runs after all
+   * of them and emits everything they wrote. */
+  if (!FlushRegistered) {
+    FlushRegistered = 1;
+    atexit(flush_profiling_data);
+  }
   if (!SavedEnvVar && !SavedArgs) check_environment_variable();
   if (SavedArgs || !argv) return argc;  /* This can be called multiple times */
 
@@ -135,42 +218,220 @@ int getOutFile() {
            (OutDir?"/":""),
            OutputFilename,
            (unsigned long)pid);
-     OutFile = open(OutputFilenameRuntime, O_CREAT | O_WRONLY, 0666);
 #else
      snprintf(OutputFilenameRuntime,sizeof(OutputFilenameRuntime),"%s%s%s",
            (OutDir?:""),
            (OutDir?"/":""),
            OutputFilename);
-     OutFile = open(OutputFilenameRuntime, O_CREAT | O_WRONLY, 0666);
 #endif
-     lseek(OutFile, 0, SEEK_END); /* O_APPEND prevents seeking */
+     /* Readable as well, so that counters can be mapped onto the file. */
+     OutFile = open(OutputFilenameRuntime, O_CREAT | O_RDWR | O_APPEND, 0666);
      if (OutFile == -1) {
         fprintf(stderr, "LLVM profiling runtime: while opening '%s': ",
               OutputFilename);
         perror("");
         return(OutFile);
      }
+  }
+  return(OutFile);
+}
 
-     /* Output the command line arguments to the file. */
-     {
-        int PTy = ArgumentInfo;
-      int Zeros = 0;
-      if (write(OutFile, &PTy, sizeof(int)) < 0 ||
-          write(OutFile, &SavedArgsLength, sizeof(unsigned)) < 0 ||
-          write(OutFile, SavedArgs, SavedArgsLength) < 0 ) {
-        fprintf(stderr,"error: unable to write to output file.");
-        exit(0);
-      }
-      /* Pad out to a multiple of four bytes */
-      if (SavedArgsLength & 3) {
-        if (write(OutFile, &Zeros, 4-(SavedArgsLength&3)) < 0) {
-          fprintf(stderr,"error: unable to write to output file.");
-          exit(0);
-        }
-      }
+/* reserve_output - Grow the output buffer by Size bytes and return where they
+ * start.  The pointer is only valid until the next reservation.
+ */
+static char *reserve_output(size_t Size) {
+  char *Reserved;
+  if (OutBufferSize + Size > OutBufferCapacity) {
+    size_t Capacity = OutBufferCapacity ? OutBufferCapacity : 64 * 1024;
+    while (Capacity < OutBufferSize + Size) Capacity *= 2;
+    OutBuffer = (char*)realloc(OutBuffer, Capacity);
+    if (!OutBuffer) {
+      fprintf(stderr, "error: unable to allocate profiling output buffer.");
+      exit(0);
     }
+    OutBufferCapacity = Capacity;
   }
-  return(OutFile);
+  Reserved = OutBuffer + OutBufferSize;
+  OutBufferSize += Size;
+  return Reserved;
+}
+
+/* mark_counters_mapped - Counters at Start have been moved into the output
+ * file, skip them when their packet is written at exit.  Returns 0, and the
+ * counters must stay in memory, once MAX_MAPPED_COUNTERS arrays are mapped.
+ */
+int mark_counters_mapped(const void *Start) {
+  if (NumMappedCounters == MAX_MAPPED_COUNTERS) return 0;
+  MappedCounters[NumMappedCounters++] = Start;
+  return 1;
+}
+
+int can_map_counters(void) {
+  return NumMappedCounters != MAX_MAPPED_COUNTERS;
+}
+
+void mark_counters_rank_restricted(const void *Start) {
+  if (NumRankCounters != MAX_RANK_COUNTERS)
+    RankCounters[NumRankCounters++] = Start;
+}
+
+int counters_rank_restricted(const void *Start) {
+  unsigned i;
+  for (i = 0; i != NumRankCounters; ++i)
+    if (RankCounters[i] == Start) return 1;
+  return 0;
+}
+
+static int counters_mapped(const void *Start) {
+  unsigned i;
+  for (i = 0; i != NumMappedCounters; ++i)
+    if (MappedCounters[i] == Start) return 1;
+  return 0;
+}
+
+static size_t arguments_size(void) {
+  return sizeof(int) + sizeof(unsigned) + ((SavedArgsLength + 3) & ~3U);
+}
+
+/* fill_arguments - Lay out the ArgumentInfo packet at P. */
+static void fill_arguments(char *P) {
+  int PTy = ArgumentInfo;
+  unsigned Padded = (SavedArgsLength + 3) & ~3U;
+  memcpy(P, &PTy, sizeof(int));
+  memcpy(P + sizeof(int), &SavedArgsLength, sizeof(unsigned));
+  P += sizeof(int) + sizeof(unsigned);
+  if (SavedArgsLength) memcpy(P, SavedArgs, SavedArgsLength);
+  /* Pad out to a multiple of four bytes */
+  memset(P + SavedArgsLength, 0, Padded - SavedArgsLength);
+}
+
+/* write_profiling_arguments - Start the output of this process with its
+ * command line, which also marks where the run of one process begins in a
+ * shared file.
+ */
+void write_profiling_arguments(void) {
+  pthread_mutex_lock(&ArgumentsLock);
+  if (ArgumentsState == ARGUMENTS_PENDING) {
+    ArgumentsState = ARGUMENTS_BUFFERED;
+    fill_arguments(reserve_output(arguments_size()));
+  }
+  pthread_mutex_unlock(&ArgumentsLock);
+}
+
+/* flush_profiling_arguments - Make sure the ArgumentInfo packet is in OutFile
+ * before a packet is appended to it directly.  The packet is written on its
+ * own, OutBuffer may hold packets another thread is still building.
+ */
+void flush_profiling_arguments(int OutFile) {
+  size_t Size = arguments_size();
+  char *Packet;
+  pthread_mutex_lock(&ArgumentsLock);
+  if (ArgumentsState != ARGUMENTS_FLUSHED) {
+    if (!(Packet = (char*)malloc(Size))) {
+      fprintf(stderr, "error: unable to allocate profiling output buffer.");
+      exit(0);
+    }
+    fill_arguments(Packet);
+    if (append_profiling_output(OutFile, Packet, Size)) {
+      fprintf(stderr, "error: unable to write to output file.");
+      exit(0);
+    }
+    free(Packet);
+    if (ArgumentsState == ARGUMENTS_BUFFERED) OutBufferFlushed = Size;
+    ArgumentsState = ARGUMENTS_FLUSHED;
+  }
+  pthread_mutex_unlock(&ArgumentsLock);
+}
+
+/* write_packet - Append a packet made of its type, an element count of
+ * CountSize bytes and the raw data.
+ */
+static void write_packet(enum ProfilingType PT, const void *Count,
+                         size_t CountSize, const void *Data, size_t DataSize) {
+  int PTy = PT;
+  char *P;
+  if (counters_mapped(Data) || profiling_packet_discarded(PT)) return;
+  write_profiling_arguments();
+  P = reserve_output(sizeof(int) + CountSize + DataSize);
+  memcpy(P, &PTy, sizeof(int));
+  memcpy(P + sizeof(int), Count, CountSize);
+  if (DataSize) memcpy(P + sizeof(int) + CountSize, Data, DataSize);
+}
+
+/* write_profiling_bytes - Append raw bytes to the current packet. */
+void write_profiling_bytes(const void *Data, size_t Size) {
+  write_profiling_arguments();
+  if (Size) memcpy(reserve_output(Size), Data, Size);
+}
+
+/* reserve_profiling_bytes - Leave room for Size bytes which are only known
+ * once the rest of the packet has been written, see patch_profiling_bytes.
+ */
+size_t reserve_profiling_bytes(size_t Size) {
+  write_profiling_arguments();
+  reserve_output(Size);
+  return OutBufferSize - Size;
+}
+
+void patch_profiling_bytes(size_t Offset, const void *Data, size_t Size) {
+  assert(Offset + Size <= OutBufferSize && "patching unreserved bytes");
+  memcpy(OutBuffer + Offset, Data, Size);
+}
+
+/* append_profiling_output - Append Size bytes at Data to the output file as
+ * one piece.  Linux writes at most 0x7ffff000 bytes per call, so a big piece
+ * takes several writes; every writer holds the file lock and OutputLock
+ * meanwhile, so neither the output of other processes sharing the file nor
+ * that of other threads can land in between.
+ */
+int append_profiling_output(int OutFile, const void *Data, size_t Size) {
+  struct flock Lock;
+  size_t Written = 0;
+  int Locked;
+
+  pthread_mutex_lock(&OutputLock);
+  memset(&Lock, 0, sizeof(Lock));
+  Lock.l_type = F_WRLCK;
+  Lock.l_whence = SEEK_SET;
+  do
+    Locked = fcntl(OutFile, F_SETLKW, &Lock) == 0;
+  while (!Locked && errno == EINTR);
+  while (Written != Size) {
+    ssize_t Ret = write(OutFile, (const char*)Data + Written, Size - Written);
+    if (Ret < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    Written += Ret;
+  }
+  if (Locked) {
+    int SavedErrno = errno;
+    Lock.l_type = F_UNLCK;
+    fcntl(OutFile, F_SETLK, &Lock);
+    errno = SavedErrno;
+  }
+  pthread_mutex_unlock(&OutputLock);
+  return Written == Size ? 0 : -1;
+}
+
+/* flush_profiling_data - Write out every packet buffered so far as one piece.
+ * Registered with atexit by save_arguments.
+ */
+void flush_profiling_data(void) {
+  int outFile;
+
+  pthread_mutex_lock(&ArgumentsLock);
+  if (OutBufferSize != OutBufferFlushed && (outFile = getOutFile()) != -1) {
+    if (append_profiling_output(outFile, OutBuffer + OutBufferFlushed,
+                                OutBufferSize - OutBufferFlushed)) {
+      fprintf(stderr, "error: unable to write to output file.");
+      exit(0);
+    }
+    if (ArgumentsState == ARGUMENTS_BUFFERED)
+      ArgumentsState = ARGUMENTS_FLUSHED;
+    OutBufferSize = OutBufferFlushed = 0;
+  }
+  pthread_mutex_unlock(&ArgumentsLock);
 }
 
 /* write_profiling_data - Write a raw block of profiling counters out to the
@@ -180,133 +441,60 @@ int getOutFile() {
  */
 void write_profiling_data(enum ProfilingType PT, unsigned *Start,
                           unsigned NumElements) {
-  int PTy;
-  int outFile = getOutFile();
-
-  /* Write out this record! */
-  PTy = PT;
-  if( write(outFile, &PTy, sizeof(int)) < 0 ||
-      write(outFile, &NumElements, sizeof(unsigned)) < 0 ||
-      write(outFile, Start, NumElements*sizeof(unsigned)) < 0 ) {
-    fprintf(stderr,"error: unable to write to output file.");
-    exit(0);
-  }
+  if (counters_indexed(Start)) return;
+  write_packet(PT, &NumElements, sizeof(unsigned), Start,
+               NumElements * sizeof(unsigned));
 }
 
 void write_profiling_data_long(enum ProfilingType PT, uint64_t* Start,
                           uint64_t NumElements)
 {
-  int PTy;
-  int outFile = getOutFile();
-
-  /* Write out this record! */
-  PTy = PT;
-  if (write(outFile, &PTy, sizeof(int)) < 0
-      || write(outFile, &NumElements, sizeof(uint64_t)) < 0
-      || write(outFile, Start, NumElements * sizeof(uint64_t)) < 0) {
-     fprintf(stderr, "error: unable to write to output file.");
-     exit(0);
-  }
+  uint64_t* Folded;
+  if (counters_indexed(Start)) return;
+  Folded = fold_profiling_counters(PT, Start, NumElements);
+  if (Folded) Start = Folded;
+  write_packet(PT, &NumElements, sizeof(uint64_t), Start,
+               NumElements * sizeof(uint64_t));
+  free(Folded);
 }
 //add by haomeng
 void write_profiling_data_double(enum ProfilingType PT, double* Start,
                           uint64_t NumElements)
 {
-  int PTy;
-  int outFile = getOutFile();
-  /* Write out this record! */
-  PTy = PT;
-  if (write(outFile, &PTy, sizeof(int)) < 0
-	  || write(outFile, &NumElements, sizeof(uint64_t)) < 0
-	  || write(outFile, Start, NumElements * sizeof(double)) < 0) {
-	 fprintf(stderr, "error: unable to write to output file.");
-	 exit(0);
-  }
+  if (counters_indexed(Start)) return;
+  write_packet(PT, &NumElements, sizeof(uint64_t), Start,
+               NumElements * sizeof(double));
+}
+
+/* is_master_rank - The MASTER_RANK environment variable selects the only rank
+ * which outputs rank restricted profiles, every rank outputs when unset.  Once
+ * the ranks are reduced the root writes the sums of all ranks instead.
+ */
+static int is_master_rank(int* StartRank)
+{
+  char* value;
+  if (RanksReduced) return 1;
+  if((value= getenv("MASTER_RANK")))
+     return StartRank[0] == atoi(value);
+  return 1;
 }
 //add by haomeng
 void write_edge_rank_profiling_data_long(enum ProfilingType PT, uint64_t* Start,
                           uint64_t NumElements, int* StartRank, int NumRankElements)
 {
-  int PTy;
-  char* value;
-  if((value= getenv("MASTER_RANK")))
-  {
-	  int rank = atoi(value);
-	  if(StartRank[0] == rank){//Specify the rank which output profile, default 0
-		  int outFile = getOutFile();
-
-		  /* Write out this record! */
-		  PTy = PT;
-		  if (write(outFile, &PTy, sizeof(int)) < 0
-			  || write(outFile, &NumElements, sizeof(uint64_t)) < 0
-			  || write(outFile, Start, NumElements * sizeof(uint64_t)) < 0) {
-			 fprintf(stderr, "error: unable to write to output file.");
-			 exit(0);
-		  }
-	  }
-  }
-  else
-  {
-     int outFile = getOutFile();
-
-     /* Write out this record! */
-     PTy = PT;
-     if (write(outFile, &PTy, sizeof(int)) < 0
-         || write(outFile, &NumElements, sizeof(uint64_t)) < 0
-         || write(outFile, Start, NumElements * sizeof(uint64_t)) < 0) {
-        fprintf(stderr, "error: unable to write to output file.");
-        exit(0);
-     }
-  }
+  if (!is_master_rank(StartRank)) return;
+  write_profiling_data_long(PT, Start, NumElements);
 }
 //add by haomeng
 void write_time_rank_profiling_data_double(enum ProfilingType PT, double* Start,
                           uint64_t NumElements, int* StartRank, int NumRankElements)
 {
-  int PTy;
-  char* value;
-  if((value= getenv("MASTER_RANK")))
-  {
-	  int rank = atoi(value);
-	  if(StartRank[0] == rank){//Specify the rank which output profile, default 0
-		  int outFile = getOutFile();
-
-		  /* Write out this record! */
-		  PTy = PT;
-		  if (write(outFile, &PTy, sizeof(int)) < 0
-			  || write(outFile, &NumElements, sizeof(uint64_t)) < 0
-			  || write(outFile, Start, NumElements * sizeof(double)) < 0) {
-			 fprintf(stderr, "error: unable to write to output file.");
-			 exit(0);
-		  }
-	  }
-  }
-  else
-  {
-	  int outFile = getOutFile();
-	  /* Write out this record! */
-	  PTy = PT;
-	  if (write(outFile, &PTy, sizeof(int)) < 0
-		  || write(outFile, &NumElements, sizeof(uint64_t)) < 0
-		  || write(outFile, Start, NumElements * sizeof(double)) < 0) {
-		 fprintf(stderr, "error: unable to write to output file.");
-		 exit(0);
-	  }
-  }
+  if (!is_master_rank(StartRank)) return;
+  write_profiling_data_double(PT, Start, NumElements);
 }
 //add by haomeng
 void write_mpitime_profiling_data_double(enum ProfilingType PT, double* Start,
                           uint64_t NumElements)
 {
-  int PTy;
-  int outFile = getOutFile();
-
-  /* Write out this record! */
-  PTy = PT;
-  if (write(outFile, &PTy, sizeof(int)) < 0
-      || write(outFile, &NumElements, sizeof(uint64_t)) < 0
-      || write(outFile, Start, NumElements * sizeof(double)) < 0) {
-     fprintf(stderr, "error: unable to write to output file.");
-     exit(0);
-  }
+  write_profiling_data_double(PT, Start, NumElements);
 }
@@ -0,0 +1,152 @@
+/*===-- CounterShards.c - Per thread copies of profiling counters ---------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the runtime side of -profiling-sharded-counters.  The
+|* instrumented program keeps one thread local copy of each 64 bit counter
+|* array, so threads never contend on a counter cache line.  Every thread hands
+|* its copy to llvm_register_counter_shard the first time it enters an
+|* instrumented function, and the copies are summed into a single packet when
+|* the data is written out.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SHARD_ALIGN 64
+
+typedef struct CounterShard {
+  enum ProfilingType Kind;
+  uint64_t *Counters;
+  uint64_t NumElements;
+  struct CounterShard *Next;          /* next shard in Shards or Retired */
+  struct CounterShard *NextOfThread;  /* next shard of the owning thread */
+} CounterShard;
+
+static pthread_mutex_t ShardLock = PTHREAD_MUTEX_INITIALIZER;
+/* Copies owned by running threads. */
+static CounterShard *Shards = 0;
+/* Sums of the copies of threads which have already exited, the thread local
+ * storage of those is gone. */
+static CounterShard *Retired = 0;
+static pthread_key_t ThreadShards;
+static pthread_once_t ThreadShardsOnce = PTHREAD_ONCE_INIT;
+
+/* retired_shard - Find or create the accumulator for exited threads' copies
+ * of a counter array.  Called with ShardLock held.
+ */
+static CounterShard *retired_shard(enum ProfilingType Kind,
+                                   uint64_t NumElements) {
+  CounterShard *R;
+  void *Counters;
+  for (R = Retired; R; R = R->Next)
+    if (R->Kind == Kind && R->NumElements == NumElements)
+      return R;
+
+  R = (CounterShard*)malloc(sizeof(CounterShard));
+  if (!R || posix_memalign(&Counters, SHARD_ALIGN,
+                           NumElements * sizeof(uint64_t))) {
+    free(R);
+    return 0;
+  }
+  memset(Counters, 0, NumElements * sizeof(uint64_t));
+  R->Kind = Kind;
+  R->Counters = (uint64_t*)Counters;
+  R->NumElements = NumElements;
+  R->NextOfThread = 0;
+  R->Next = Retired;
+  Retired = R;
+  return R;
+}
+
+/* retire_thread_shards - Thread exit hook: fold the exiting thread's copies
+ * into the retired sums before its thread local storage is released.
+ */
+static void retire_thread_shards(void *Head) {
+  CounterShard *S = (CounterShard*)Head, *Next, **Link;
+  uint64_t i;
+
+  pthread_mutex_lock(&ShardLock);
+  for (; S; S = Next) {
+    CounterShard *R = retired_shard(S->Kind, S->NumElements);
+    Next = S->NextOfThread;
+    if (R)
+      for (i = 0; i != S->NumElements; ++i)
+        R->Counters[i] += S->Counters[i];
+    for (Link = &Shards; *Link; Link = &(*Link)->Next)
+      if (*Link == S) {
+        *Link = S->Next;
+        break;
+      }
+    free(S);
+  }
+  pthread_mutex_unlock(&ShardLock);
+}
+
+/* fold_counter_shards - CounterFolder summing every copy registered under the
+ * same packet type and size as Start.
+ */
+static uint64_t *fold_counter_shards(enum ProfilingType PT, uint64_t *Start,
+                                     uint64_t NumElements) {
+  uint64_t *Sum = 0, i;
+  CounterShard *Lists[2], *S;
+  int l;
+
+  pthread_mutex_lock(&ShardLock);
+  Lists[0] = Shards;
+  Lists[1] = Retired;
+  for (l = 0; l != 2; ++l)
+    for (S = Lists[l]; S; S = S->Next) {
+      if (S->Kind != PT || S->NumElements != NumElements ||
+          S->Counters == Start)
+        continue;
+      if (!Sum) {
+        Sum = (uint64_t*)malloc(NumElements * sizeof(uint64_t));
+        if (!Sum) break;
+        memcpy(Sum, Start, NumElements * sizeof(uint64_t));
+      }
+      for (i = 0; i != NumElements; ++i)
+        Sum[i] += S->Counters[i];
+    }
+  pthread_mutex_unlock(&ShardLock);
+  return Sum;
+}
+
+static void init_thread_shards(void) {
+  pthread_key_create(&ThreadShards, retire_thread_shards);
+  set_counter_folder(fold_counter_shards);
+}
+
+/* llvm_register_counter_shard - Called by instrumented code when a thread
+ * first reaches a function; Counters is that thread's copy of the array.
+ */
+void llvm_register_counter_shard(uint64_t *Counters, uint64_t NumElements,
+                                 int Kind) {
+  CounterShard *Mine, *S;
+
+  pthread_once(&ThreadShardsOnce, init_thread_shards);
+  Mine = (CounterShard*)pthread_getspecific(ThreadShards);
+  for (S = Mine; S; S = S->NextOfThread)
+    if (S->Counters == Counters) return;
+
+  S = (CounterShard*)malloc(sizeof(CounterShard));
+  if (!S) return;
+  S->Kind = (enum ProfilingType)Kind;
+  S->Counters = Counters;
+  S->NumElements = NumElements;
+  S->NextOfThread = Mine;
+  pthread_setspecific(ThreadShards, S);
+
+  pthread_mutex_lock(&ShardLock);
+  S->Next = Shards;
+  Shards = S;
+  pthread_mutex_unlock(&ShardLock);
+}
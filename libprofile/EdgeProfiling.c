@@ -40,6 +40,7 @@ int llvm_start_edge_profiling(int argc, const char **argv,
   int Ret = save_arguments(argc, argv);
   ArrayStart = arrayStart;
   NumElements = numElements;
+  register_counter_array(EdgeInfo64, ArrayStart, NumElements, 8);
   atexit(EdgeProfAtExitHandler);
   return Ret;
 }
@@ -18,6 +18,8 @@ int llvm_start_edge_rank_profiling(int argc, const char** argv,
   ArrayRankStart = arrayRankStart;
   NumElements = numElements;
   NumRankElements = numRankElements;
+  register_counter_array(EdgeInfo64, ArrayStart, NumElements, 8);
+  mark_counters_rank_restricted(ArrayStart);
   atexit(EdgeRankProfAtExitHandler);
   return Ret;
 }
@@ -0,0 +1,231 @@
+/*===-- IndexedProfile.c - Write counters as per function records ---------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the version 2 output of programs instrumented with
+|* -profiling-indexed.  Every instrumented counter array comes with a table of
+|* the counters each function owns.  At exit the counters of all indexed
+|* arrays are regrouped by function into the records of one IndexedInfo
+|* packet, see ProfileInfoTypes.h, which replaces their ordinary packets.
+|*
+|* Snapshots still hold ordinary packets.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include "ProfileInfoTypes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_INDEXED_ARRAYS 16
+
+typedef struct IndexedArray {
+  const void *Start;
+  enum ProfilingType Kind;
+  int ElementSize;
+  const IndexedCounters *Functions;
+  unsigned NumFunctions;
+  char *Data;           /* the counters as written out, filled in at exit */
+} IndexedArray;
+
+/* IndexedEntry - The counters of one function in one array. */
+typedef struct IndexedEntry {
+  IndexedArray *Array;
+  const IndexedCounters *Counters;
+} IndexedEntry;
+
+static IndexedArray Arrays[MAX_INDEXED_ARRAYS];
+static unsigned NumArrays = 0;
+static ValueSliceWriter WriteValueSlice = 0;
+
+void set_value_slice_writer(ValueSliceWriter Writer) {
+  WriteValueSlice = Writer;
+}
+
+int counters_indexed(const void *Start) {
+  unsigned i;
+  for (i = 0; i != NumArrays; ++i)
+    if (Arrays[i].Start == Start) return 1;
+  return 0;
+}
+
+/* compare_entries - Order entries by function, keeping the order of the
+ * arrays and of the counters within an array.
+ */
+static int compare_entries(const void *L, const void *R) {
+  const IndexedEntry *A = (const IndexedEntry*)L, *B = (const IndexedEntry*)R;
+  int Cmp = strcmp(A->Counters->name, B->Counters->name);
+  if (Cmp) return Cmp;
+  if (A->Counters->checksum != B->Counters->checksum)
+    return A->Counters->checksum < B->Counters->checksum ? -1 : 1;
+  if (A->Array != B->Array) return A->Array < B->Array ? -1 : 1;
+  return A->Counters->first < B->Counters->first ? -1
+         : A->Counters->first > B->Counters->first;
+}
+
+static int same_function(const IndexedEntry *A, const IndexedEntry *B) {
+  return !strcmp(A->Counters->name, B->Counters->name) &&
+         A->Counters->checksum == B->Counters->checksum;
+}
+
+static size_t output_offset(void) {
+  return reserve_profiling_bytes(0);
+}
+
+static void pad_output(size_t Begin) {
+  static const char Zeros[8] = { 0 };
+  size_t Size = output_offset() - Begin;
+  if (Size % 8) write_profiling_bytes(Zeros, 8 - Size % 8);
+}
+
+/* write_slice - Write the counters of one function in one array. */
+static void write_slice(const IndexedEntry *E) {
+  IndexedSlice Slice;
+  size_t At = reserve_profiling_bytes(sizeof(IndexedSlice));
+  const IndexedArray *A = E->Array;
+  Slice.kind = A->Kind;
+  Slice.reserved = 0;
+  Slice.first = E->Counters->first;
+  Slice.numEntries = E->Counters->numCounters;
+  if (A->Kind == ValueInfo)
+    Slice.kind = WriteValueSlice(Slice.first, Slice.numEntries);
+  else
+    write_profiling_bytes(A->Data + Slice.first * A->ElementSize,
+                          Slice.numEntries * A->ElementSize);
+  pad_output(At);
+  Slice.size = output_offset() - At - sizeof(IndexedSlice);
+  patch_profiling_bytes(At, &Slice, sizeof(IndexedSlice));
+}
+
+/* write_indexed_profile - Write the IndexedInfo packet, registered with
+ * atexit by the first llvm_index_counter_array.  It runs before the exit
+ * handlers of the profilers, which skip the indexed arrays.
+ */
+static void write_indexed_profile(void) {
+  int PTy = IndexedInfo, Kind;
+  unsigned Version = INDEXED_PROFILE_VERSION, i, j;
+  size_t NumEntries = 0, n, Begin, HeaderAt, TableAt, NamesAt, RecordsAt;
+  IndexedEntry *Entries;
+  IndexedHeader Header;
+  uint64_t Size, NameOffset;
+
+  for (i = 0; i != NumArrays; ++i)
+    NumEntries += Arrays[i].NumFunctions;
+  Entries = (IndexedEntry*)malloc(NumEntries * sizeof(IndexedEntry) + 1);
+  if (!Entries) {
+    fprintf(stderr, "error: unable to allocate the indexed profile.");
+    exit(0);
+  }
+
+  NumEntries = 0;
+  for (i = 0; i != NumArrays; ++i) {
+    IndexedArray *A = &Arrays[i];
+    if (A->Kind == ValueInfo) {
+      if (!WriteValueSlice) continue;
+    } else {
+      uint64_t NumElements = 0;
+      for (j = 0; j != A->NumFunctions; ++j)
+        if (A->Functions[j].first + A->Functions[j].numCounters > NumElements)
+          NumElements = A->Functions[j].first + A->Functions[j].numCounters;
+      A->Data = (char*)malloc(NumElements * A->ElementSize + 1);
+      if (!A->Data) {
+        fprintf(stderr, "error: unable to allocate the indexed profile.");
+        exit(0);
+      }
+      /* Counters not known to the snapshot runtime are written as they are */
+      Kind = copy_counter_array(A->Start, A->Data);
+      if (Kind)
+        A->Kind = (enum ProfilingType)Kind;
+      else
+        memcpy(A->Data, A->Start, NumElements * A->ElementSize);
+      /* The root rank writes the sums of the MPI ranks for this array. */
+      if (profiling_packet_discarded(A->Kind)) continue;
+    }
+    for (j = 0; j != A->NumFunctions; ++j) {
+      Entries[NumEntries].Array = A;
+      Entries[NumEntries++].Counters = &A->Functions[j];
+    }
+  }
+  if (NumEntries == 0) {
+    for (i = 0; i != NumArrays; ++i)
+      free(Arrays[i].Data);
+    free(Entries);
+    return;
+  }
+  qsort(Entries, NumEntries, sizeof(IndexedEntry), compare_entries);
+
+  memset(&Header, 0, sizeof(Header));
+  for (n = 0; n != NumEntries; ++n)
+    if (n == 0 || !same_function(&Entries[n - 1], &Entries[n])) {
+      ++Header.numFunctions;
+      Header.namesSize += strlen(Entries[n].Counters->name) + 1;
+    }
+  Header.namesSize = (Header.namesSize + 7) & ~(uint64_t)7;
+
+  write_profiling_bytes(&PTy, sizeof(int));
+  write_profiling_bytes(&Version, sizeof(unsigned));
+  Begin = reserve_profiling_bytes(sizeof(uint64_t)) + sizeof(uint64_t);
+  HeaderAt = reserve_profiling_bytes(sizeof(IndexedHeader));
+  TableAt = reserve_profiling_bytes(Header.numFunctions *
+                                    sizeof(IndexedFunction));
+  NamesAt = output_offset();
+  for (n = 0; n != NumEntries; ++n)
+    if (n == 0 || !same_function(&Entries[n - 1], &Entries[n]))
+      write_profiling_bytes(Entries[n].Counters->name,
+                            strlen(Entries[n].Counters->name) + 1);
+  pad_output(NamesAt);
+
+  RecordsAt = output_offset();
+  for (n = 0, i = 0, NameOffset = 0; n != NumEntries; ++i) {
+    IndexedFunction Function;
+    size_t Next;
+    Function.checksum = Entries[n].Counters->checksum;
+    Function.nameOffset = NameOffset;
+    Function.recordOffset = output_offset() - RecordsAt;
+    NameOffset += strlen(Entries[n].Counters->name) + 1;
+    for (Next = n; Next != NumEntries &&
+                   same_function(&Entries[n], &Entries[Next]); ++Next)
+      write_slice(&Entries[Next]);
+    Function.recordSize = output_offset() - RecordsAt - Function.recordOffset;
+    patch_profiling_bytes(TableAt + i * sizeof(IndexedFunction), &Function,
+                          sizeof(IndexedFunction));
+    n = Next;
+  }
+  Header.recordsSize = output_offset() - RecordsAt;
+  patch_profiling_bytes(HeaderAt, &Header, sizeof(IndexedHeader));
+  Size = output_offset() - Begin;
+  patch_profiling_bytes(Begin - sizeof(uint64_t), &Size, sizeof(uint64_t));
+
+  for (i = 0; i != NumArrays; ++i)
+    free(Arrays[i].Data);
+  free(Entries);
+}
+
+/* llvm_index_counter_array - Called after the start of a profiler by code
+ * instrumented with -profiling-indexed: the counters at Start, ElementSize
+ * bytes each, belong to the NumFunctions functions described at Functions.
+ */
+void llvm_index_counter_array(const void *Start, int Kind, int ElementSize,
+                              const IndexedCounters *Functions,
+                              unsigned NumFunctions) {
+  if (NumArrays == MAX_INDEXED_ARRAYS) {
+    fprintf(stderr, "LLVM profiling runtime: more than %d indexed counter "
+                    "arrays, the others are written as ordinary packets.\n",
+            MAX_INDEXED_ARRAYS);
+    return;
+  }
+  if (NumArrays == 0) atexit(write_indexed_profile);
+  Arrays[NumArrays].Start = Start;
+  Arrays[NumArrays].Kind = (enum ProfilingType)Kind;
+  Arrays[NumArrays].ElementSize = ElementSize;
+  Arrays[NumArrays].Functions = Functions;
+  Arrays[NumArrays].NumFunctions = NumFunctions;
+  Arrays[NumArrays].Data = 0;
+  ++NumArrays;
+}
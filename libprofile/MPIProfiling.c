@@ -58,6 +58,7 @@ int llvm_start_mpi_profiling(int argc, const char **argv,
   ArrayStart = arrayStart;
   NumElements = numElements - FORTRAN_DATATYPE_MAP_SIZE * 2;
   init_datatype_map(ArrayStart + NumElements);
+  register_counter_array(MPIFullInfo, ArrayStart, NumElements, 4);
   atexit(MPIProfAtExitHandler);
   return Ret;
 }
@@ -0,0 +1,187 @@
+/*===-- MPIReduce.c - Reduce the counters of all MPI ranks at finalize ----===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the opt-in libprofile_rt_mpi runtime.  Linked in front
+|* of libprofile_rt, it intercepts MPI_Finalize and mpi_finalize_ and reduces
+|* the registered counter arrays over MPI_COMM_WORLD before MPI shuts down.
+|* Counters are summed, MPI times are summed and their minimum and maximum
+|* over the ranks are kept in an extra MPITimeRangeInfo packet.  Only rank 0
+|* writes the reduced kinds of packets; value, path, trace and the other
+|* profiles which are not summed are still written by every rank.
+|*
+|* Counts of the reduced kinds made after MPI_Finalize are only kept for rank
+|* 0.  Their counters are never mapped into the output file, see
+|* llvm_map_counter_array.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* MPI counts are int, larger arrays are reduced in slices */
+#define REDUCE_SLICE (1 << 26)
+
+static int Rank = 0;
+
+/* The kinds of packets reduce_counter_array sums.  MPITimeCycleInfo counters
+ * are written as MPITimeInfo packets.
+ */
+static const enum ProfilingType ReducedKinds[] = {
+  EdgeInfo64, BlockInfo64, MPIFullInfo, OptEdgeInfo, OptEdgeInfo64,
+  MPITimeInfo, MPITimeCycleInfo, BlockInfoDouble
+};
+
+/* mark_reduced_kinds - Known before main, so the counters of these kinds stay
+ * in memory where they can be reduced.
+ */
+static void __attribute__((constructor)) mark_reduced_kinds(void) {
+  unsigned i;
+  for (i = 0; i != sizeof(ReducedKinds) / sizeof(ReducedKinds[0]); ++i)
+    mark_packets_reduced(ReducedKinds[i]);
+}
+
+/* reduce - Reduce NumElements elements at Data into rank 0, in place. */
+static void reduce(void *Data, uint64_t NumElements, MPI_Datatype Type,
+                   int ElementSize, MPI_Op Op) {
+  char *P = (char*)Data;
+  while (NumElements) {
+    int Count = NumElements < REDUCE_SLICE ? (int)NumElements : REDUCE_SLICE;
+    if (Rank == 0)
+      PMPI_Reduce(MPI_IN_PLACE, P, Count, Type, Op, 0, MPI_COMM_WORLD);
+    else
+      PMPI_Reduce(P, 0, Count, Type, Op, 0, MPI_COMM_WORLD);
+    P += (size_t)Count * ElementSize;
+    NumElements -= Count;
+  }
+}
+
+/* sum_counted - MPI_Op for optimal edge counters, where ~0 marks a counter
+ * which is never incremented and stays ~0 on every rank.
+ */
+static void sum_counted(void *In, void *InOut, int *Len, MPI_Datatype *Type) {
+  unsigned *I = (unsigned*)In, *IO = (unsigned*)InOut;
+  int i;
+  for (i = 0; i != *Len; ++i)
+    if (I[i] != ~0U)
+      IO[i] = IO[i] == ~0U ? I[i] : IO[i] + I[i];
+}
+
+/* sum_counted64 - sum_counted for 64 bit optimal edge counters. */
+static void sum_counted64(void *In, void *InOut, int *Len,
+                          MPI_Datatype *Type) {
+  uint64_t *I = (uint64_t*)In, *IO = (uint64_t*)InOut;
+  int i;
+  for (i = 0; i != *Len; ++i)
+    if (I[i] != ~(uint64_t)0)
+      IO[i] = IO[i] == ~(uint64_t)0 ? I[i] : IO[i] + I[i];
+}
+
+/* reduce_time_range - Keep the minimum and maximum of every MPI time over all
+ * ranks, rank 0 writes them out as an MPITimeRangeInfo packet.
+ */
+static void reduce_time_range(double *Times, uint64_t NumElements) {
+  size_t Size = NumElements * sizeof(double);
+  double *Range = (double*)malloc(2 * Size + 1);
+  int PTy = MPITimeRangeInfo;
+  if (!Range) {
+    fprintf(stderr, "error: unable to allocate MPI time ranges.");
+    exit(0);
+  }
+  memcpy(Range, Times, Size);
+  memcpy(Range + NumElements, Times, Size);
+  reduce(Range, NumElements, MPI_DOUBLE, sizeof(double), MPI_MIN);
+  reduce(Range + NumElements, NumElements, MPI_DOUBLE, sizeof(double),
+         MPI_MAX);
+  if (Rank == 0) {
+    write_profiling_bytes(&PTy, sizeof(int));
+    write_profiling_bytes(&NumElements, sizeof(uint64_t));
+    write_profiling_bytes(Range, 2 * Size);
+  }
+  free(Range);
+}
+
+/* reduce_counter_array - CounterArrayVisitor reducing one array. */
+static void reduce_counter_array(enum ProfilingType PT, void *Live,
+                                 uint64_t NumElements, int ElementSize) {
+  switch (PT) {
+  case EdgeInfo64:
+  case BlockInfo64: {
+    /* Per thread copies are folded first, the folded sums then replace the
+     * counters of rank 0. */
+    uint64_t *Folded = fold_profiling_counters(PT, (uint64_t*)Live,
+                                               NumElements);
+    uint64_t *Counters = Folded ? Folded : (uint64_t*)Live;
+    reduce(Counters, NumElements, MPI_UINT64_T, sizeof(uint64_t), MPI_SUM);
+    if (Folded) {
+      memcpy(Live, Folded, NumElements * sizeof(uint64_t));
+      free(Folded);
+    }
+    break;
+  }
+  case MPIFullInfo:
+    reduce(Live, NumElements, MPI_UNSIGNED, sizeof(unsigned), MPI_SUM);
+    break;
+  case OptEdgeInfo: {
+    MPI_Op SumCounted;
+    PMPI_Op_create(sum_counted, 1, &SumCounted);
+    reduce(Live, NumElements, MPI_UNSIGNED, sizeof(unsigned), SumCounted);
+    PMPI_Op_free(&SumCounted);
+    break;
+  }
+  case OptEdgeInfo64: {
+    MPI_Op SumCounted;
+    PMPI_Op_create(sum_counted64, 1, &SumCounted);
+    reduce(Live, NumElements, MPI_UINT64_T, sizeof(uint64_t), SumCounted);
+    PMPI_Op_free(&SumCounted);
+    break;
+  }
+  case MPITimeInfo:
+    reduce_time_range((double*)Live, NumElements);
+    reduce(Live, NumElements, MPI_DOUBLE, sizeof(double), MPI_SUM);
+    break;
+  case MPITimeCycleInfo: {
+    /* TSC cycles are reduced as seconds, the cycles of different ranks need
+     * not have the same frequency. */
+    double *Times = bank_time_cycles();
+    reduce_time_range(Times, NumElements);
+    reduce(Times, NumElements, MPI_DOUBLE, sizeof(double), MPI_SUM);
+    break;
+  }
+  case BlockInfoDouble:
+    reduce(Live, NumElements, MPI_DOUBLE, sizeof(double), MPI_SUM);
+    break;
+  default:
+    /* RankInfo and friends describe a rank, there is nothing to sum. */
+    break;
+  }
+}
+
+int MPI_Finalize(void) {
+  int Initialized = 0, Finalized = 0;
+  PMPI_Initialized(&Initialized);
+  PMPI_Finalized(&Finalized);
+  if (Initialized && !Finalized) {
+    PMPI_Comm_rank(MPI_COMM_WORLD, &Rank);
+    visit_counter_arrays(reduce_counter_array);
+    /* The shards are part of the reduced counters now. */
+    set_counter_folder(0);
+    set_ranks_reduced(Rank == 0);
+  }
+  return PMPI_Finalize();
+}
+
+/* mpi_finalize_ - The Fortran binding, which would otherwise bypass the C
+ * MPI_Finalize above.
+ */
+void mpi_finalize_(MPI_Fint *ierr) {
+  *ierr = MPI_Finalize();
+}
@@ -0,0 +1,128 @@
+/*===-- MappedCounters.c - Counters kept in the profile output file -------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the runtime side of -profiling-mmap-counters.  Each
+|* counter array is given a pre-sized region at the end of the output file,
+|* laid out as an ordinary llvmprof packet, and the instrumented code is
+|* redirected to count straight into a shared mapping of that region.  Nothing
+|* has to be copied at exit, and a process killed by the batch system or by
+|* MPI_Abort still leaves its counters behind in the file.
+|*
+|* Regions are allocated at the current end of the file, so every process
+|* needs its own output file (OUTPUT_HASPID, the default).
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Counter data starts on a cache line, which keeps 64 bit counters aligned. */
+#define COUNTER_ALIGN 64
+
+/* extend_output_file - Append a region for a packet with the given header and
+ * data sizes to the output file, under a file lock.  The counters are to
+ * start on COUNTER_ALIGN, *Pad receives the size of the PaddingInfo packet
+ * (at least its own header) filling the gap.  Returns the offset of the
+ * region, or -1.
+ */
+static off_t extend_output_file(int OutFile, size_t HeaderSize,
+                                size_t DataSize, size_t *Pad) {
+  struct flock Lock;
+  struct stat St;
+  off_t End = -1;
+
+  memset(&Lock, 0, sizeof(Lock));
+  Lock.l_type = F_WRLCK;
+  Lock.l_whence = SEEK_SET;
+  fcntl(OutFile, F_SETLKW, &Lock);
+  if (fstat(OutFile, &St) == 0) {
+    *Pad = (COUNTER_ALIGN - (St.st_size + HeaderSize) % COUNTER_ALIGN) %
+           COUNTER_ALIGN;
+    if (*Pad && *Pad < sizeof(int) + sizeof(unsigned)) *Pad += COUNTER_ALIGN;
+    if (ftruncate(OutFile, St.st_size + *Pad + HeaderSize + DataSize) == 0)
+      End = St.st_size;
+  }
+  Lock.l_type = F_UNLCK;
+  fcntl(OutFile, F_SETLK, &Lock);
+  return End;
+}
+
+/* llvm_map_counter_array - Called from main once the profiling runtime has
+ * been started.  *Base is the pointer the instrumented code counts through,
+ * it initially points at the NumElements counters of ElementSize bytes at
+ * Start.  On success the counters are copied into the file and *Base is
+ * pointed at them; on failure they simply stay in memory and are written at
+ * exit as usual.
+ */
+void llvm_map_counter_array(void **Base, void *Start, uint64_t NumElements,
+                            int ElementSize, int Kind) {
+  size_t HeaderSize = sizeof(int) +
+                      (ElementSize == 4 ? sizeof(unsigned) : sizeof(uint64_t));
+  size_t DataSize = NumElements * ElementSize;
+  size_t Pad, PageSize = sysconf(_SC_PAGESIZE);
+  off_t End, MapStart;
+  int OutFile, PTy = Kind;
+  char *Map, *P;
+
+  /* Counters which the MPI runtime reduces and only the root rank writes, of
+   * a rank which may not be the MASTER_RANK, or beyond the table of mapped
+   * arrays stay in memory. */
+  if (packets_reduced((enum ProfilingType)Kind) || !can_map_counters() ||
+      (counters_rank_restricted(Start) && getenv("MASTER_RANK")))
+    return;
+
+  /* The command line goes first, so even a file cut short by a crash starts
+   * like any other profile. */
+  write_profiling_arguments();
+  flush_profiling_data();
+  if ((OutFile = getOutFile()) == -1) return;
+
+  End = extend_output_file(OutFile, HeaderSize, DataSize, &Pad);
+  if (End == -1) {
+    perror("LLVM profiling runtime: unable to extend output file");
+    return;
+  }
+
+  MapStart = End & ~(off_t)(PageSize - 1);
+  Map = (char*)mmap(0, End - MapStart + Pad + HeaderSize + DataSize,
+                    PROT_READ | PROT_WRITE, MAP_SHARED, OutFile, MapStart);
+  if (Map == MAP_FAILED) {
+    perror("LLVM profiling runtime: unable to map counters");
+    return;
+  }
+
+  P = Map + (End - MapStart);
+  if (Pad) {
+    int PadTy = PaddingInfo;
+    unsigned PadLength = Pad - sizeof(int) - sizeof(unsigned);
+    memcpy(P, &PadTy, sizeof(int));
+    memcpy(P + sizeof(int), &PadLength, sizeof(unsigned));
+    memset(P + sizeof(int) + sizeof(unsigned), 0, PadLength);
+    P += Pad;
+  }
+  memcpy(P, &PTy, sizeof(int));
+  if (ElementSize == 4) {
+    unsigned Count = NumElements;
+    memcpy(P + sizeof(int), &Count, sizeof(unsigned));
+  } else {
+    memcpy(P + sizeof(int), &NumElements, sizeof(uint64_t));
+  }
+  P += HeaderSize;
+  memcpy(P, Start, DataSize);
+
+  *Base = P;
+  mark_counters_mapped(Start);
+  move_counter_array(Start, P);
+}
@@ -9,15 +9,15 @@
 |* 
 |* This file implements the call back routines for the edge profiling
 |* instrumentation pass.  This should be used with the
-|* -insert-opt-edge-profiling LLVM pass.
+|* -insert-optimal-edge-profiling LLVM pass.
 |*
 \*===----------------------------------------------------------------------===*/
 
 #include "Profiling.h"
 #include <stdlib.h>
 
-static unsigned *ArrayStart;
-static unsigned NumElements;
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
 
 /* OptEdgeProfAtExitHandler - When the program exits, just write out the
  * profiling data.
@@ -28,7 +28,7 @@ static void OptEdgeProfAtExitHandler(void) {
    * When loading this information the counters with value -1 have to be
    * recalculated, it is guaranteed that this is possible.
    */
-  write_profiling_data(OptEdgeInfo, ArrayStart, NumElements);
+  write_profiling_data_long(OptEdgeInfo64, ArrayStart, NumElements);
 }
 
 
@@ -36,10 +36,11 @@ static void OptEdgeProfAtExitHandler(void) {
  * profiling library.  It is responsible for setting up the atexit handler.
  */
 int llvm_start_opt_edge_profiling(int argc, const char **argv,
-                                  unsigned *arrayStart, unsigned numElements) {
+                                  uint64_t *arrayStart, uint64_t numElements) {
   int Ret = save_arguments(argc, argv);
   ArrayStart = arrayStart;
   NumElements = numElements;
+  register_counter_array(OptEdgeInfo64, ArrayStart, NumElements, 8);
   atexit(OptEdgeProfAtExitHandler);
   return Ret;
 }
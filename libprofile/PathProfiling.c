@@ -26,21 +26,64 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-/* note that this is used for functions with large path counts,
-         but it is unlikely those paths will ALL be executed */
-#define ARBITRARY_HASH_BIN_COUNT 100
+/* Functions with large path counts keep their counters in an open addressing
+   table, since it is unlikely those paths will ALL be executed.  Tables start
+   with INITIAL_HASH_CAPACITY slots and double when half full; all slots come
+   out of a bump arena which is only released at exit. */
+#define INITIAL_HASH_CAPACITY 64
+#define ARENA_CHUNK_SIZE (1 << 20)
 
 typedef struct pathHashEntry_s {
   uint32_t pathNumber;
-  uint32_t pathCount;
-  struct pathHashEntry_s* next;
+  uint32_t used;
+  uint64_t pathCount;
 } pathHashEntry_t;
 
 typedef struct pathHashTable_s {
-  pathHashEntry_t* hashBins[ARBITRARY_HASH_BIN_COUNT];
+  pathHashEntry_t* entries;
+  uint32_t capacity; /* a power of two */
   uint32_t pathCounts;
 } pathHashTable_t;
 
+typedef struct arenaChunk_s {
+  struct arenaChunk_s* next;
+  size_t used, size;
+} arenaChunk_t;
+
+static arenaChunk_t* arena;
+
+/* allocate zeroed memory from the arena */
+static void* arenaAlloc(size_t size) {
+  void* p;
+  size = (size + 15) & ~(size_t)15;
+  if( !arena || arena->size - arena->used < size ) {
+    size_t chunkSize = sizeof(arenaChunk_t) + 15 + size;
+    arenaChunk_t* chunk;
+    if( chunkSize < ARENA_CHUNK_SIZE )
+      chunkSize = ARENA_CHUNK_SIZE;
+    chunk = calloc(chunkSize, 1);
+    if( !chunk ) {
+      fprintf(stderr, "error: unable to allocate path counters.");
+      exit(0);
+    }
+    chunk->next = arena;
+    chunk->used = (sizeof(arenaChunk_t) + 15) & ~(size_t)15;
+    chunk->size = chunkSize;
+    arena = chunk;
+  }
+  p = (char*)arena + arena->used;
+  arena->used += size;
+  return p;
+}
+
+static void arenaRelease(void) {
+  while( arena ) {
+    arenaChunk_t* next = arena->next;
+    free(arena);
+    arena = next;
+  }
+}
+
 typedef struct {
   enum ProfilingStorageType type;
   uint32_t size;
@@ -51,144 +94,134 @@ typedef struct {
 ftEntry_t* ft;
 uint32_t ftSize;
 
-/* write an array table to file */
-void writeArrayTable(uint32_t fNumber, ftEntry_t* ft, uint32_t* funcCount) {
-  int outFile = getOutFile();
-  uint32_t arrayHeaderLocation = 0;
-  uint32_t arrayCurrentLocation = 0;
-  uint32_t arrayIterator = 0;
-  uint32_t functionUsed = 0;
-  uint32_t pathCounts = 0;
-
-  /* look through each entry in the array to determine whether the function
-     was executed at all */
+/* size of the output of one function */
+static size_t functionSize(uint32_t numEntries) {
+  return sizeof(PathProfileHeader) + numEntries * sizeof(PathProfileTableEntry64);
+}
+
+/* append an array table to the output buffer */
+static char* writeArrayTable(uint32_t fNumber, ftEntry_t* ft, char* out,
+                             uint32_t* funcCount) {
+  PathProfileHeader fHeader;
+  PathProfileTableEntry64* pte = (PathProfileTableEntry64*)(out + sizeof(fHeader));
+  uint32_t arrayIterator;
+
+  fHeader.fnNumber = fNumber;
+  fHeader.numEntries = 0;
   for( arrayIterator = 0; arrayIterator < ft->size; arrayIterator++ ) {
     uint32_t pc = ((uint32_t*)ft->array)[arrayIterator];
 
     /* was this path executed? */
     if( pc ) {
-      PathProfileTableEntry pte;
-      pte.pathNumber = arrayIterator;
-      pte.pathCounter = pc;
-      pathCounts++;
-
-      /* one-time initialization stuff */
-      if(!functionUsed) {
-        arrayHeaderLocation = lseek(outFile, 0, SEEK_CUR);
-        lseek(outFile, sizeof(PathProfileHeader), SEEK_CUR);
-        functionUsed = 1;
-        (*funcCount)++;
-      }
-
-      /* write path data */
-      if (write(outFile, &pte, sizeof(PathProfileTableEntry)) < 0) {
-        fprintf(stderr, "error: unable to write path entry to output file.\n");
-        return;
-      }
+      pte->pathNumber = arrayIterator;
+      pte->reserved = 0;
+      pte->pathCounter = pc;
+      ++pte;
+      fHeader.numEntries++;
     }
   }
 
-  /* If this function was executed, write the header */
-  if( functionUsed ) {
-    PathProfileHeader fHeader;
-    fHeader.fnNumber = fNumber;
-    fHeader.numEntries = pathCounts;
-
-    arrayCurrentLocation = lseek(outFile, 0, SEEK_CUR);
-    lseek(outFile, arrayHeaderLocation, SEEK_SET);
-
-    if (write(outFile, &fHeader, sizeof(PathProfileHeader)) < 0) {
-      fprintf(stderr,
-              "error: unable to write function header to output file.\n");
-      return;
-    }
-
-    lseek(outFile, arrayCurrentLocation, SEEK_SET);
-  }
+  /* skip functions which were not executed at all */
+  if( !fHeader.numEntries )
+    return out;
+  memcpy(out, &fHeader, sizeof(fHeader));
+  (*funcCount)++;
+  return (char*)pte;
 }
 
-static uint32_t hash (uint32_t key) {
-  /* this may benefit from a proper hash function */
-  return key%ARBITRARY_HASH_BIN_COUNT;
-}
-
-/* output a specific function's hash table to the profile file */
-void writeHashTable(uint32_t functionNumber, pathHashTable_t* hashTable) {
-  int outFile = getOutFile();
+/* append a specific function's hash table to the output buffer */
+static char* writeHashTable(uint32_t functionNumber, pathHashTable_t* hashTable,
+                            char* out) {
   PathProfileHeader header;
+  PathProfileTableEntry64* pte = (PathProfileTableEntry64*)(out + sizeof(header));
   uint32_t i;
 
   header.fnNumber = functionNumber;
   header.numEntries = hashTable->pathCounts;
-
-  if (write(outFile, &header, sizeof(PathProfileHeader)) < 0) {
-    fprintf(stderr, "error: unable to write function header to output file.\n");
-    return;
+  memcpy(out, &header, sizeof(header));
+
+  for (i = 0; i < hashTable->capacity; i++) {
+    pathHashEntry_t* hashEntry = &hashTable->entries[i];
+    if( !hashEntry->used )
+      continue;
+    pte->pathNumber = hashEntry->pathNumber;
+    pte->reserved = 0;
+    pte->pathCounter = hashEntry->pathCount;
+    ++pte;
   }
+  return (char*)pte;
+}
 
-  for (i = 0; i < ARBITRARY_HASH_BIN_COUNT; i++) {
-    pathHashEntry_t* hashEntry = hashTable->hashBins[i];
-
-    while (hashEntry) {
-      pathHashEntry_t* temp;
-
-      PathProfileTableEntry pte;
-      pte.pathNumber = hashEntry->pathNumber;
-      pte.pathCounter = hashEntry->pathCount;
+static uint32_t hash (uint32_t key, uint32_t capacity) {
+  /* Fibonacci hashing, path numbers of one function are dense */
+  return (uint32_t)(key * 2654435761U) & (capacity - 1);
+}
 
-      if (write(outFile, &pte, sizeof(PathProfileTableEntry)) < 0) {
-        fprintf(stderr, "error: unable to write path entry to output file.\n");
-        return;
-      }
+/* find the slot of pathNumber, or the free slot it belongs in */
+static pathHashEntry_t* findSlot(pathHashTable_t* hashTable,
+                                 uint32_t pathNumber) {
+  uint32_t mask = hashTable->capacity - 1;
+  uint32_t index = hash(pathNumber, hashTable->capacity);
 
-      temp = hashEntry;
-      hashEntry = hashEntry->next;
-      free (temp);
+  while( hashTable->entries[index].used &&
+         hashTable->entries[index].pathNumber != pathNumber )
+    index = (index + 1) & mask;
+  return &hashTable->entries[index];
+}
 
-    }
-  }
+/* double the capacity of a table, the old slots stay in the arena */
+static void growHashTable(pathHashTable_t* hashTable) {
+  pathHashEntry_t* old = hashTable->entries;
+  uint32_t oldCapacity = hashTable->capacity, i;
+
+  hashTable->capacity = oldCapacity * 2;
+  hashTable->entries =
+    arenaAlloc(hashTable->capacity * sizeof(pathHashEntry_t));
+  for( i = 0; i < oldCapacity; i++ )
+    if( old[i].used )
+      *findSlot(hashTable, old[i].pathNumber) = old[i];
 }
 
 /* Return a pointer to this path's specific path counter */
-static uint32_t* getPathCounter(uint32_t functionNumber,
-                                       uint32_t pathNumber) {
+static uint64_t* getPathCounter(uint32_t functionNumber,
+                                uint32_t pathNumber) {
   pathHashTable_t* hashTable;
   pathHashEntry_t* hashEntry;
-  uint32_t index = hash(pathNumber);
 
-  if( ft[functionNumber-1].array == 0)
-    ft[functionNumber-1].array = calloc(sizeof(pathHashTable_t), 1);
+  if( ft[functionNumber-1].array == 0) {
+    hashTable = arenaAlloc(sizeof(pathHashTable_t));
+    hashTable->capacity = INITIAL_HASH_CAPACITY;
+    hashTable->entries =
+      arenaAlloc(INITIAL_HASH_CAPACITY * sizeof(pathHashEntry_t));
+    ft[functionNumber-1].array = hashTable;
+  }
 
   hashTable = (pathHashTable_t*)((ftEntry_t*)ft)[functionNumber-1].array;
-  hashEntry = hashTable->hashBins[index];
-
-  while (hashEntry) {
-    if (hashEntry->pathNumber == pathNumber) {
-      return &hashEntry->pathCount;
-    }
-
-    hashEntry = hashEntry->next;
+  hashEntry = findSlot(hashTable, pathNumber);
+  if( hashEntry->used )
+    return &hashEntry->pathCount;
+
+  /* keep the load factor at or below one half */
+  if( 2 * (hashTable->pathCounts + 1) > hashTable->capacity ) {
+    growHashTable(hashTable);
+    hashEntry = findSlot(hashTable, pathNumber);
   }
-
-  hashEntry = malloc(sizeof(pathHashEntry_t));
   hashEntry->pathNumber = pathNumber;
+  hashEntry->used = 1;
   hashEntry->pathCount = 0;
-  hashEntry->next = hashTable->hashBins[index];
-  hashTable->hashBins[index] = hashEntry;
   hashTable->pathCounts++;
   return &hashEntry->pathCount;
 }
 
 /* Increment a specific path's count */
 void llvm_increment_path_count (uint32_t functionNumber, uint32_t pathNumber) {
-  uint32_t* pathCounter = getPathCounter(functionNumber, pathNumber);
-  if( *pathCounter < 0xffffffff )
-    (*pathCounter)++;
+  uint64_t* pathCounter = getPathCounter(functionNumber, pathNumber);
+  (*pathCounter)++;
 }
 
 /* Increment a specific path's count */
 void llvm_decrement_path_count (uint32_t functionNumber, uint32_t pathNumber) {
-  uint32_t* pathCounter = getPathCounter(functionNumber, pathNumber);
+  uint64_t* pathCounter = getPathCounter(functionNumber, pathNumber);
   (*pathCounter)--;
 }
 
@@ -202,59 +235,59 @@ void llvm_decrement_path_count (uint32_t functionNumber, uint32_t pathNumber) {
  *      +-----------------+-----------------+
  * 0x08 | functionNum     | profileEntries  |  // function 1
  *      +-----------------+-----------------+
- * 0x10 | pathNumber      | pathCounter     |  // entry 1.1
+ * 0x10 | pathNumber      | reserved        |  // entry 1.1
  *      +-----------------+-----------------+
- * 0x18 | pathNumber      | pathCounter     |  // entry 1.2
+ * 0x18 | pathCounter (64 bits)             |
  *      +-----------------+-----------------+
  *  ... |       ...       |       ...       |  // entry 1.n
  *      +-----------------+-----------------+
  *  ... | functionNum     | profileEntries  |  // function 2
  *      +-----------------+-----------------+
- *  ... | pathNumber      | pathCounter     |  // entry 2.1
- *      +-----------------+-----------------+
- *  ... | pathNumber      | pathCounter     |  // entry 2.2
- *      +-----------------+-----------------+
  *  ... |       ...       |       ...       |  // entry 2.n
  *      +-----------------+-----------------+
  *
+ * The whole packet is assembled in memory and written at once.
  */
 static void pathProfAtExitHandler(void) {
-  int outFile = getOutFile();
   uint32_t i;
-  uint32_t header[2] = { PathInfo, 0 };
-  uint32_t headerLocation;
-  uint32_t currentLocation;
+  uint32_t header[2] = { PathInfo64, 0 };
+  size_t size = sizeof(header);
+  char *buffer, *out;
 
-  /* skip over the header for now */
-  headerLocation = lseek(outFile, 0, SEEK_CUR);
-  lseek(outFile, 2*sizeof(uint32_t), SEEK_CUR);
+  for( i = 0; i < ftSize; i++ ) {
+    if( ft[i].type == ProfilingArray )
+      size += functionSize(ft[i].size);
+    else if( ft[i].type == ProfilingHash && ft[i].array )
+      size += functionSize(((pathHashTable_t*)ft[i].array)->pathCounts);
+  }
+
+  buffer = malloc(size);
+  if( !buffer ) {
+    fprintf(stderr, "error: unable to allocate path profiling output.");
+    return;
+  }
+  out = buffer + sizeof(header);
 
   /* Iterate through each function */
   for( i = 0; i < ftSize; i++ ) {
     if( ft[i].type == ProfilingArray ) {
-      writeArrayTable(i+1,&ft[i],header + 1);
+      out = writeArrayTable(i+1,&ft[i],out,header + 1);
 
     } else if( ft[i].type == ProfilingHash ) {
       /* If the hash exists, write it to file */
       if( ft[i].array ) {
-        writeHashTable(i+1,ft[i].array);
+        out = writeHashTable(i+1,ft[i].array,out);
         header[1]++;
-        free(ft[i].array);
+        ft[i].array = 0;
       }
     }
   }
 
   /* Setup and write the path profile header */
-  currentLocation = lseek(outFile, 0, SEEK_CUR);
-  lseek(outFile, headerLocation, SEEK_SET);
-
-  if (write(outFile, header, sizeof(header)) < 0) {
-    fprintf(stderr,
-            "error: unable to write path profile header to output file.\n");
-    return;
-  }
-
-  lseek(outFile, currentLocation, SEEK_SET);
+  memcpy(buffer, header, sizeof(header));
+  write_profiling_bytes(buffer, out - buffer);
+  free(buffer);
+  arenaRelease();
 }
 /* llvm_start_path_profiling - This is the main entry point of the path
  * profiling library.  It is responsible for setting up the atexit handler.
@@ -14,6 +14,7 @@ int llvm_start_pred_block_profiling(int argc, const char** argv,
   int Ret = save_arguments(argc, argv);
   ArrayStart = arrayStart;
   NumElements = numElements;
+  register_counter_array(BlockInfo64, ArrayStart, NumElements, 8);
   atexit(PredBlockProfAtExitHandler);
   return Ret;
 }
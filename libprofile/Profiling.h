@@ -16,6 +16,7 @@
 #define PROFILING_H
 
 #include "ProfileDataTypes.h" /* for enum ProfilingType */
+#include <stddef.h>
 #include <stdint.h>
 
 /* save_arguments - Save argc and argv as passed into the program for the file
@@ -24,10 +25,37 @@
 int save_arguments(int argc, const char **argv);
 
 /*
- * Retrieves the file descriptor for the profile file.
+ * Retrieves the file descriptor for the profile file.  Packets should go
+ * through the write functions below rather than straight to this descriptor.
  */
 int getOutFile();
 
+/* write_profiling_arguments - Make sure the ArgumentInfo packet opening the
+ * output of this process is buffered.  Done implicitly by every write.
+ */
+void write_profiling_arguments(void);
+/* flush_profiling_arguments - Make sure the ArgumentInfo packet is in OutFile,
+ * before a packet is appended to it with append_profiling_output.
+ */
+void flush_profiling_arguments(int OutFile);
+/* write_profiling_bytes - Append raw bytes to the packet being written, for
+ * packets with a layout of their own.
+ */
+void write_profiling_bytes(const void* Data, size_t Size);
+/* reserve_profiling_bytes - Reserve Size bytes of output, returning their
+ * offset for a later patch_profiling_bytes once their content is known.
+ */
+size_t reserve_profiling_bytes(size_t Size);
+void patch_profiling_bytes(size_t Offset, const void* Data, size_t Size);
+/* flush_profiling_data - Output all buffered packets as one piece.
+ * Happens automatically at exit.
+ */
+void flush_profiling_data(void);
+/* append_profiling_output - Append Size bytes to the output file OutFile as
+ * one piece, under the file lock every writer takes.  Returns -1 on failure.
+ */
+int append_profiling_output(int OutFile, const void* Data, size_t Size);
+
 /* write_profiling_data - Write out a typed packet of profiling data to the
  * current output file.
  */
@@ -38,4 +66,94 @@ void write_profiling_data_long(enum ProfilingType PT, uint64_t* Start,
 //add by haomeng
 void write_profiling_data_double(enum ProfilingType PT, double* Start,
                                uint64_t NumElements);
+void write_edge_rank_profiling_data_long(enum ProfilingType PT,
+                                         uint64_t* Start, uint64_t NumElements,
+                                         int* StartRank, int NumRankElements);
+void write_time_rank_profiling_data_double(enum ProfilingType PT,
+                                           double* Start, uint64_t NumElements,
+                                           int* StartRank,
+                                           int NumRankElements);
+void write_mpitime_profiling_data_double(enum ProfilingType PT, double* Start,
+                                         uint64_t NumElements);
+
+/* read_time_cycles - Convert the TSC cycle counters of MPITimeCycleInfo to
+ * seconds, without touching them.
+ */
+void read_time_cycles(const uint64_t* Cycles, double* Seconds,
+                      uint64_t NumCycles);
+/* bank_time_cycles - Move the TSC cycle counters into seconds, which are
+ * returned and are written out at exit instead of the counters.
+ */
+double* bank_time_cycles(void);
+
+/* CounterFolder - Returns a malloc'ed copy of the 64 bit counters at Start
+ * with every other per thread copy of the same array added in, or NULL when
+ * there is nothing to add.  Installed by the sharded counter runtime.
+ */
+typedef uint64_t* (*CounterFolder)(enum ProfilingType PT, uint64_t* Start,
+                                   uint64_t NumElements);
+void set_counter_folder(CounterFolder Folder);
+/* fold_profiling_counters - Apply the installed CounterFolder, if any. */
+uint64_t* fold_profiling_counters(enum ProfilingType PT, uint64_t* Start,
+                                  uint64_t NumElements);
+
+/* register_counter_array - Tell the snapshot runtime about a counter array of
+ * NumElements counters of ElementSize (4 or 8) bytes, written as PT packets.
+ */
+void register_counter_array(enum ProfilingType PT, void* Start,
+                            uint64_t NumElements, int ElementSize);
+/* move_counter_array - The counters registered as Start now live at Live. */
+void move_counter_array(const void* Start, void* Live);
+/* visit_counter_arrays - Call Visit with the current location of every
+ * registered counter array.
+ */
+typedef void (*CounterArrayVisitor)(enum ProfilingType PT, void* Live,
+                                    uint64_t NumElements, int ElementSize);
+void visit_counter_arrays(CounterArrayVisitor Visit);
+
+/* mark_packets_reduced - The MPI reduction runtime sums the PT packets of all
+ * ranks into the root at MPI_Finalize.
+ */
+void mark_packets_reduced(enum ProfilingType PT);
+int packets_reduced(enum ProfilingType PT);
+
+/* set_ranks_reduced - The counters of all MPI ranks have been reduced into the
+ * root rank.  From now on the root ignores MASTER_RANK, and every other rank
+ * discards its packets of the reduced kinds, see profiling_packet_discarded.
+ */
+void set_ranks_reduced(int IsRoot);
+int profiling_packet_discarded(enum ProfilingType PT);
+
+/* mark_counters_mapped - The counter array at Start is kept in the output file
+ * by the mmap runtime, its packet must not be written again at exit.  Returns
+ * 0 when no more arrays can be mapped, see can_map_counters.
+ */
+int mark_counters_mapped(const void* Start);
+int can_map_counters(void);
+
+/* mark_counters_rank_restricted - The counter array at Start is only written
+ * by the rank selected with MASTER_RANK, which is not known before the end.
+ */
+void mark_counters_rank_restricted(const void* Start);
+int counters_rank_restricted(const void* Start);
+
+/* copy_counter_array - Copy the counters of the array registered as Start to
+ * Dest like they are written out.  Returns the kind of packet they are written
+ * as, or 0 if Start is not registered.
+ */
+int copy_counter_array(const void* Start, void* Dest);
+
+/* counters_indexed - The counter array at Start is written as part of the
+ * IndexedInfo packet, see llvm_index_counter_array.  Its own packet must not
+ * be written.
+ */
+int counters_indexed(const void* Start);
+
+/* ValueSliceWriter - Write the counts of the NumSites value profiling sites
+ * from First, then their contents, laid out like a ValueInfo packet, with
+ * write_profiling_bytes.  Returns the kind of packet they are laid out as.
+ * Installed by the value profiling runtime.
+ */
+typedef int (*ValueSliceWriter)(uint64_t First, uint64_t NumSites);
+void set_value_slice_writer(ValueSliceWriter Writer);
 #endif
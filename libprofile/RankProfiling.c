@@ -1,19 +1,20 @@
 #include "Profiling.h"
 #include <stdlib.h>
 
-static uint64_t *ArrayStart;
-static uint64_t NumElements;
+static unsigned *ArrayStart;
+static unsigned NumElements;
 
 static void RankProfAtExitHandler(void) {
   write_profiling_data(RankInfo, ArrayStart, NumElements);
 }
 
 int llvm_start_rank_profiling(int argc, const char** argv,
-                                    uint64_t* arrayStart, uint64_t numElements)
+                                    unsigned* arrayStart, unsigned numElements)
 {
   int Ret = save_arguments(argc, argv);
   ArrayStart = arrayStart;
   NumElements = numElements;
+  register_counter_array(RankInfo, ArrayStart, NumElements, 4);
   atexit(RankProfAtExitHandler);
   return Ret;
 }
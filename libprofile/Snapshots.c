@@ -0,0 +1,319 @@
+/*===-- Snapshots.c - Periodic profile snapshots of running programs ------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements snapshots of the registered counter arrays for
+|* programs which run for a long time or never exit cleanly.  A background
+|* thread appends a SnapshotInfo packet to the output file every
+|* LLVMPROF_SNAPSHOT_INTERVAL seconds and, when LLVMPROF_SNAPSHOT_SIGNAL is
+|* set, whenever the process receives SIGUSR1.  Snapshots are cumulative, or
+|* hold the counts since the previous snapshot when LLVMPROF_SNAPSHOT_MODE is
+|* "delta".  The final counters are still written at exit as usual.
+|*
+|* A SnapshotInfo packet looks like
+|*
+|*   int type, unsigned flags, uint64_t sequence, double timestamp,
+|*   uint64_t payload size, payload of ordinary counter packets
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_COUNTER_ARRAYS 32
+
+typedef struct CounterArray {
+  enum ProfilingType Kind;
+  const void *Start;    /* the array as handed to the runtime */
+  void *Live;           /* where the counters are now, see mmap'ed counters */
+  uint64_t NumElements;
+  int ElementSize;
+  void *Previous;       /* counts at the previous delta snapshot */
+} CounterArray;
+
+static CounterArray Arrays[MAX_COUNTER_ARRAYS];
+static unsigned NumArrays = 0;
+static pthread_mutex_t ArraysLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int SnapshotPipe[2] = { -1, -1 };
+static int SnapshotInterval = 0;
+static int SnapshotDelta = 0;
+static uint64_t SnapshotSequence = 0;
+
+static void start_profiling_snapshots(void);
+
+/* register_counter_array - Make a counter array part of the snapshots.  The
+ * first registration starts the snapshot thread if the environment asks for
+ * snapshots; the output file name is known by then.
+ */
+void register_counter_array(enum ProfilingType PT, void *Start,
+                            uint64_t NumElements, int ElementSize) {
+  static pthread_once_t Started = PTHREAD_ONCE_INIT;
+  pthread_once(&Started, start_profiling_snapshots);
+  pthread_mutex_lock(&ArraysLock);
+  if (NumArrays != MAX_COUNTER_ARRAYS) {
+    CounterArray *A = &Arrays[NumArrays++];
+    A->Kind = PT;
+    A->Start = A->Live = Start;
+    A->NumElements = NumElements;
+    A->ElementSize = ElementSize;
+    A->Previous = 0;
+  }
+  pthread_mutex_unlock(&ArraysLock);
+}
+
+/* move_counter_array - The counters registered as Start are now kept at
+ * Live.
+ */
+void move_counter_array(const void *Start, void *Live) {
+  unsigned i;
+  pthread_mutex_lock(&ArraysLock);
+  for (i = 0; i != NumArrays; ++i)
+    if (Arrays[i].Start == Start) Arrays[i].Live = Live;
+  pthread_mutex_unlock(&ArraysLock);
+}
+
+/* visit_counter_arrays - Call Visit on every registered counter array. */
+void visit_counter_arrays(CounterArrayVisitor Visit) {
+  unsigned i;
+  pthread_mutex_lock(&ArraysLock);
+  for (i = 0; i != NumArrays; ++i)
+    Visit(Arrays[i].Kind, Arrays[i].Live, Arrays[i].NumElements,
+          Arrays[i].ElementSize);
+  pthread_mutex_unlock(&ArraysLock);
+}
+
+/* append - Grow the snapshot being assembled by Size bytes. */
+static char *append(char **Buffer, size_t *Size, size_t *Capacity,
+                    size_t Len) {
+  if (*Size + Len > *Capacity) {
+    size_t NewCapacity = *Capacity ? *Capacity : 4096;
+    while (NewCapacity < *Size + Len) NewCapacity *= 2;
+    *Buffer = (char*)realloc(*Buffer, NewCapacity);
+    if (!*Buffer) return 0;
+    *Capacity = NewCapacity;
+  }
+  *Size += Len;
+  return *Buffer + *Size - Len;
+}
+
+/* copy_counters - Copy the counters of A as they are written out to Dest,
+ * which need not be aligned: folded over the per thread copies, and TSC
+ * cycles converted to seconds.
+ */
+static int copy_counters(CounterArray *A, void *Dest) {
+  size_t DataSize = A->NumElements * A->ElementSize;
+  uint64_t *Folded = 0;
+  if (A->Kind == MPITimeCycleInfo) {
+    double *Seconds = (double*)malloc(DataSize + 1);
+    if (!Seconds) return 0;
+    read_time_cycles((const uint64_t*)A->Live, Seconds, A->NumElements);
+    memcpy(Dest, Seconds, DataSize);
+    free(Seconds);
+    return 1;
+  }
+  if (A->ElementSize == 8 && A->Kind != BlockInfoDouble &&
+      A->Kind != MPITimeInfo)
+    Folded = fold_profiling_counters(A->Kind, (uint64_t*)A->Live,
+                                     A->NumElements);
+  memcpy(Dest, Folded ? (void*)Folded : A->Live, DataSize);
+  free(Folded);
+  return 1;
+}
+
+/* copy_counter_array - Copy the counters of the array registered as Start to
+ * Dest, like they are written out.  Returns the kind of packet they are
+ * written as, or 0 if Start is not registered.
+ */
+int copy_counter_array(const void *Start, void *Dest) {
+  int PTy = 0;
+  unsigned i;
+  pthread_mutex_lock(&ArraysLock);
+  for (i = 0; i != NumArrays; ++i)
+    if (Arrays[i].Start == Start) {
+      if (copy_counters(&Arrays[i], Dest))
+        PTy = Arrays[i].Kind == MPITimeCycleInfo ? MPITimeInfo
+                                                 : Arrays[i].Kind;
+      break;
+    }
+  pthread_mutex_unlock(&ArraysLock);
+  return PTy;
+}
+
+/* snapshot_array - Append the packet of one counter array to the snapshot. */
+static int snapshot_array(CounterArray *A, char **Buffer, size_t *Size,
+                          size_t *Capacity) {
+  size_t CountSize = A->ElementSize == 4 ? sizeof(unsigned) : sizeof(uint64_t);
+  size_t DataSize = A->NumElements * A->ElementSize;
+  int PTy = A->Kind == MPITimeCycleInfo ? MPITimeInfo : A->Kind;
+  uint64_t i;
+  char *P = append(Buffer, Size, Capacity, sizeof(int) + CountSize + DataSize);
+  if (!P) return 0;
+
+  memcpy(P, &PTy, sizeof(int));
+  if (A->ElementSize == 4) {
+    unsigned Count = A->NumElements;
+    memcpy(P + sizeof(int), &Count, sizeof(unsigned));
+  } else {
+    memcpy(P + sizeof(int), &A->NumElements, sizeof(uint64_t));
+  }
+  P += sizeof(int) + CountSize;
+
+  if (!copy_counters(A, P)) return 0;
+  if (!SnapshotDelta) return 1;
+
+  if (!A->Previous) {
+    if (!(A->Previous = calloc(1, DataSize + 1))) return 0;
+  }
+  for (i = 0; i != A->NumElements; ++i) {
+    if (A->ElementSize == 4) {
+      unsigned V, Prev;
+      memcpy(&V, P + i * 4, 4);
+      memcpy(&Prev, (char*)A->Previous + i * 4, 4);
+      memcpy((char*)A->Previous + i * 4, &V, 4);
+      /* ~0 marks an optimal edge counter which is never incremented */
+      if (PTy != OptEdgeInfo || V != ~0U) V -= Prev;
+      memcpy(P + i * 4, &V, 4);
+    } else if (PTy == BlockInfoDouble || PTy == MPITimeInfo) {
+      double V, Prev;
+      memcpy(&V, P + i * 8, 8);
+      memcpy(&Prev, (char*)A->Previous + i * 8, 8);
+      memcpy((char*)A->Previous + i * 8, &V, 8);
+      V -= Prev;
+      memcpy(P + i * 8, &V, 8);
+    } else {
+      uint64_t V, Prev;
+      memcpy(&V, P + i * 8, 8);
+      memcpy(&Prev, (char*)A->Previous + i * 8, 8);
+      memcpy((char*)A->Previous + i * 8, &V, 8);
+      if (PTy != OptEdgeInfo64 || V != ~(uint64_t)0) V -= Prev;
+      memcpy(P + i * 8, &V, 8);
+    }
+  }
+  return 1;
+}
+
+/* write_snapshot - Append one SnapshotInfo packet to the output file as one
+ * piece, so it never interleaves with the output of other processes.
+ */
+static void write_snapshot(void) {
+  char *Buffer = 0, *P;
+  size_t Size = 0, Capacity = 0;
+  const size_t HeaderSize = 2 * sizeof(int) + 2 * sizeof(uint64_t) +
+                            sizeof(double);
+  int PTy = SnapshotInfo, OutFile;
+  unsigned Flags = SnapshotDelta ? SNAPSHOT_DELTA : 0, i;
+  uint64_t PayloadSize;
+  struct timespec Now;
+  double Timestamp;
+
+  clock_gettime(CLOCK_REALTIME, &Now);
+  Timestamp = Now.tv_sec + Now.tv_nsec * 1e-9;
+
+  if (!append(&Buffer, &Size, &Capacity, HeaderSize)) return;
+  pthread_mutex_lock(&ArraysLock);
+  /* Once the MPI ranks are reduced, only the root keeps the reduced kinds. */
+  for (i = 0; i != NumArrays; ++i)
+    if (!profiling_packet_discarded(Arrays[i].Kind) &&
+        !snapshot_array(&Arrays[i], &Buffer, &Size, &Capacity)) break;
+  pthread_mutex_unlock(&ArraysLock);
+  if (i != NumArrays || Size == HeaderSize) {
+    free(Buffer);
+    return;
+  }
+
+  P = Buffer;
+  PayloadSize = Size - HeaderSize;
+  memcpy(P, &PTy, sizeof(int));
+  memcpy(P + sizeof(int), &Flags, sizeof(unsigned));
+  memcpy(P + 2 * sizeof(int), &SnapshotSequence, sizeof(uint64_t));
+  memcpy(P + 2 * sizeof(int) + sizeof(uint64_t), &Timestamp, sizeof(double));
+  memcpy(P + 2 * sizeof(int) + sizeof(uint64_t) + sizeof(double),
+         &PayloadSize, sizeof(uint64_t));
+  ++SnapshotSequence;
+
+  if ((OutFile = getOutFile()) != -1) {
+    flush_profiling_arguments(OutFile);
+    if (append_profiling_output(OutFile, Buffer, Size))
+      fprintf(stderr, "error: unable to write profile snapshot.");
+  }
+  free(Buffer);
+}
+
+static void snapshot_signal_handler(int Sig) {
+  int SavedErrno = errno;
+  char Byte = 0;
+  if (write(SnapshotPipe[1], &Byte, 1) < 0) { /* a wakeup is pending */ }
+  errno = SavedErrno;
+}
+
+static void *snapshot_thread(void *Arg) {
+  struct pollfd Wakeup;
+  char Bytes[64];
+  Wakeup.fd = SnapshotPipe[0];
+  Wakeup.events = POLLIN;
+  for (;;) {
+    int Ret = poll(&Wakeup, 1, SnapshotInterval > 0 ? SnapshotInterval * 1000
+                                                    : -1);
+    if (Ret < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (Ret > 0 && read(SnapshotPipe[0], Bytes, sizeof(Bytes)) < 0)
+      continue;
+    write_snapshot();
+  }
+  return 0;
+}
+
+/* start_profiling_snapshots - Start the snapshot thread if the environment
+ * asks for snapshots.
+ */
+static void start_profiling_snapshots(void) {
+  const char *Interval = getenv("LLVMPROF_SNAPSHOT_INTERVAL");
+  const char *Signal = getenv("LLVMPROF_SNAPSHOT_SIGNAL");
+  const char *Mode = getenv("LLVMPROF_SNAPSHOT_MODE");
+  pthread_attr_t Attr;
+  pthread_t Thread;
+
+  SnapshotInterval = Interval ? atoi(Interval) : 0;
+  if (SnapshotInterval <= 0 && !Signal) return;
+  SnapshotDelta = Mode && !strcmp(Mode, "delta");
+
+  if (pipe(SnapshotPipe)) {
+    perror("LLVM profiling runtime: unable to start snapshots");
+    return;
+  }
+  /* The signal handler must never block on a full pipe. */
+  fcntl(SnapshotPipe[1], F_SETFL, O_NONBLOCK);
+  if (getOutFile() == -1) return;
+
+  if (Signal) {
+    struct sigaction Action;
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = snapshot_signal_handler;
+    Action.sa_flags = SA_RESTART;
+    sigemptyset(&Action.sa_mask);
+    sigaction(SIGUSR1, &Action, 0);
+  }
+
+  pthread_attr_init(&Attr);
+  pthread_attr_setdetachstate(&Attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&Thread, &Attr, snapshot_thread, 0))
+    perror("LLVM profiling runtime: unable to start snapshots");
+  pthread_attr_destroy(&Attr);
+}
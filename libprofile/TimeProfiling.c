@@ -1,5 +1,9 @@
 #include "Profiling.h"
+#include "CpuFreq.h"
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static double *ArrayStart;
 static uint64_t NumElements;
@@ -18,6 +22,75 @@ int llvm_start_time_profiling(int argc, const char** argv,
   ArrayRankStart = arrayRankStart;
   NumElements = numElements;
   NumRankElements = numRankElements;
+  register_counter_array(MPITimeInfo, ArrayStart, NumElements, 8);
+  mark_counters_rank_restricted(ArrayStart);
   atexit(TimeProfAtExitHandler);
   return Ret;
 }
+
+/* With -time-profiling-timer=tsc or tscp the instrumented code accumulates
+ * TSC cycles in 64 bit counters.  They are converted to seconds only when the
+ * data is written out, and written as ordinary MPITimeInfo packets.
+ * LLVMPROF_TSC_FREQ gives the TSC frequency in Hz, otherwise the cpu
+ * frequency is used like in the timing tools.
+ */
+static uint64_t *CycleStart;
+static double *Banked;  /* seconds of the cycles moved out of CycleStart */
+static double SecondsPerCycle;
+static pthread_once_t CalibrateOnce = PTHREAD_ONCE_INIT;
+
+static void calibrate_tsc(void) {
+  const char *Freq = getenv("LLVMPROF_TSC_FREQ");
+  double Hz = Freq ? atof(Freq) : 0;
+  if (Hz <= 0) Hz = get_cpu_freq();
+  if (Hz <= 0) {
+    fprintf(stderr, "error: unable to find the TSC frequency, "
+                    "set LLVMPROF_TSC_FREQ.");
+    exit(0);
+  }
+  SecondsPerCycle = 1.0 / Hz;
+}
+
+/* read_time_cycles - Convert the cycle counters at Cycles to seconds. */
+void read_time_cycles(const uint64_t* Cycles, double* Seconds,
+                      uint64_t NumCycles) {
+  uint64_t i;
+  pthread_once(&CalibrateOnce, calibrate_tsc);
+  for (i = 0; i != NumCycles; ++i)
+    Seconds[i] = (Banked ? Banked[i] : 0) + Cycles[i] * SecondsPerCycle;
+}
+
+/* bank_time_cycles - Move the counted cycles into seconds, which are returned
+ * and from then on can be changed in place, like the MPI reduction does.
+ */
+double* bank_time_cycles(void) {
+  if (!Banked && !(Banked = (double*)calloc(NumElements + 1, sizeof(double)))) {
+    fprintf(stderr, "error: unable to allocate MPI times.");
+    exit(0);
+  }
+  read_time_cycles(CycleStart, Banked, NumElements);
+  memset(CycleStart, 0, NumElements * sizeof(uint64_t));
+  return Banked;
+}
+
+static void TimeTSCProfAtExitHandler(void) {
+  if (counters_indexed(CycleStart)) return;
+  write_time_rank_profiling_data_double(MPITimeInfo, bank_time_cycles(),
+                                        NumElements, ArrayRankStart,
+                                        NumRankElements);
+}
+
+int llvm_start_time_tsc_profiling(int argc, const char** argv,
+                                  uint64_t* arrayStart, uint64_t numElements,
+                                  int* arrayRankStart, int numRankElements)
+{
+  int Ret = save_arguments(argc, argv);
+  CycleStart = arrayStart;
+  ArrayRankStart = arrayRankStart;
+  NumElements = numElements;
+  NumRankElements = numRankElements;
+  register_counter_array(MPITimeCycleInfo, CycleStart, NumElements, 8);
+  mark_counters_rank_restricted(CycleStart);
+  atexit(TimeTSCProfAtExitHandler);
+  return Ret;
+}
@@ -29,44 +29,125 @@ typedef struct ValueHead{
 
 static ValueHead* ValueLink = NULL;
 
-void ValueProfAtExitHandler(void)
+/* Histogram mode, LLVMPROF_VALUE_HISTOGRAM=<n>: instead of tracing every
+ * value, each site counts its values in a fixed open addressing table of
+ * HistSlots entries, all carved out of one arena.  Values which find no free
+ * slot within MAX_PROBE probes go to the site's "other" bucket, and only the
+ * n most frequent values are written at exit.  Memory stays bounded however
+ * long the program runs. */
+#define MAX_PROBE 8
+typedef struct ValueSlot{
+	int value;
+	unsigned count; // 0 means the slot is free
+}ValueSlot;
+
+static unsigned HistTopN = 0; // 0: trace every value
+static unsigned HistBits = 0;
+static ValueSlot* HistArena = NULL;
+static unsigned* HistOther = NULL;
+
+static int slot_count_greater(const void* L, const void* R)
 {
-#define EXIT_ON_ERROR {\
-	fprintf(stderr,"error: unable to write to output file.");\
-	exit(0); }
+	unsigned LC = ((const ValueSlot*)L)->count, RC = ((const ValueSlot*)R)->count;
+	return LC < RC ? 1 : LC > RC ? -1 : 0;
+}
+
+static void write_value_histogram(int i)
+{
+	unsigned Slots = 1U << HistBits;
+	ValueSlot* Table = HistArena + (size_t)i * Slots;
+	unsigned Other = HistOther[i], Kept = 0, j;
+	int flags = ValueLink[i].flags;
+	unsigned writeCount;
+	qsort(Table, Slots, sizeof(ValueSlot), slot_count_greater);
+	for(j=0;j<Slots && Table[j].count;j++){
+		if(j < HistTopN) ++Kept;
+		else Other += Table[j].count;
+	}
+	writeCount = 2 + 2 * Kept; // flags, other and the value, count pairs
+	write_profiling_bytes(&writeCount,sizeof(unsigned));
+	write_profiling_bytes(&flags,sizeof(int));
+	write_profiling_bytes(&Other,sizeof(unsigned));
+	write_profiling_bytes(Table,sizeof(ValueSlot)*Kept);
+}
+
+static void ValueHistAtExitHandler(void)
+{
+	int i;
+	if(counters_indexed(ArrayStart)) return;
+	write_profiling_data(ValueHistInfo, ArrayStart, NumElements);
+	for(i=0;i<NumElements;i++)
+		write_value_histogram(i);
+}
+
+static void trap_value_histogram(int index,int value)
+{
+	ValueSlot* Table = HistArena + ((size_t)index << HistBits);
+	unsigned Mask = (1U << HistBits) - 1;
+	unsigned h = ((unsigned)value * 2654435761U) >> (32 - HistBits), n;
+	for(n=0;n<MAX_PROBE;n++,h=(h+1)&Mask){
+		if(Table[h].count == 0){
+			Table[h].value = value;
+			Table[h].count = 1;
+			return;
+		}
+		if(Table[h].value == value){
+			++Table[h].count;
+			return;
+		}
+	}
+	++HistOther[index];
+}
 
+static void write_value_content(int i)
+{
 	int* buffer = NULL;
-	int OutFile = getOutFile();
-	write_profiling_data(ValueInfo, ArrayStart, NumElements);
-	int i=0;
-	for(i=0;i<NumElements;i++){
-		unsigned writeCount = ValueLink[i].count+1;// extra flags size;
-		int flags = ValueLink[i].flags;// on 64bit enum is long type
-		write(OutFile,&writeCount,sizeof(unsigned));
-		write(OutFile,&flags,sizeof(int));
-		size_t len = sizeof(int)*ValueLink[i].count;
-		if(len==0) continue;
-		buffer = malloc0(len);
-		ValueItem* item = NULL;
-		ValueEntry* entry = &ValueLink[i].entry;
-		int* w = buffer+ValueLink[i].count;
-		SLIST_FOREACH(item, entry, next){
-			if(item == SLIST_FIRST(entry)){
-				int size = ValueLink[i].pos;
-				memcpy(w-size,item->value,sizeof(int)*size);
-				w-=size;
-			}else{
-				memcpy(w-trunk_size,item->value,sizeof(int)*trunk_size);
-				w-=trunk_size;
-			}
+	unsigned writeCount = ValueLink[i].count+1;// extra flags size;
+	int flags = ValueLink[i].flags;// on 64bit enum is long type
+	write_profiling_bytes(&writeCount,sizeof(unsigned));
+	write_profiling_bytes(&flags,sizeof(int));
+	size_t len = sizeof(int)*ValueLink[i].count;
+	if(len==0) return;
+	buffer = malloc0(len);
+	ValueItem* item = NULL;
+	ValueEntry* entry = &ValueLink[i].entry;
+	int* w = buffer+ValueLink[i].count;
+	SLIST_FOREACH(item, entry, next){
+		if(item == SLIST_FIRST(entry)){
+			int size = ValueLink[i].pos;
+			memcpy(w-size,item->value,sizeof(int)*size);
+			w-=size;
+		}else{
+			memcpy(w-trunk_size,item->value,sizeof(int)*trunk_size);
+			w-=trunk_size;
 		}
-		assert(w==buffer);
-		if(write(OutFile,buffer,len)<0)
-			EXIT_ON_ERROR;
-		free(buffer);
 	}
-	close(OutFile);
-#undef EXIT_ON_ERROR
+	assert(w==buffer);
+	write_profiling_bytes(buffer,len);
+	free(buffer);
+}
+
+void ValueProfAtExitHandler(void)
+{
+	int i=0;
+	if(counters_indexed(ArrayStart)) return;
+	write_profiling_data(ValueInfo, ArrayStart, NumElements);
+	for(i=0;i<NumElements;i++)
+		write_value_content(i);
+}
+
+/* write_value_slice - ValueSliceWriter of the indexed profile, writes the
+ * counts and contents of the sites First to First + NumSites.
+ */
+static int write_value_slice(uint64_t First, uint64_t NumSites)
+{
+	uint64_t i;
+	write_profiling_bytes(ArrayStart + First, sizeof(unsigned) * NumSites);
+	for(i=First;i<First+NumSites;i++){
+		if(HistTopN) write_value_histogram(i);
+		else write_value_content(i);
+	}
+	return HistTopN ? ValueHistInfo : ValueInfo;
 }
 
 void llvm_profiling_trap_value(int index,int value,int isConstant)
@@ -76,6 +157,10 @@ void llvm_profiling_trap_value(int index,int value,int isConstant)
 		ValueLink[index].flags |= CONSTANT_COMPRESS;
 		return;
 	}
+	if(HistTopN){
+		trap_value_histogram(index, value);
+		return;
+	}
 	int* _pos = &ValueLink[index].pos;
 #define pos (*_pos)
 	ValueEntry* entry = &ValueLink[index].entry;
@@ -107,12 +192,27 @@ int llvm_start_value_profiling(int argc, const char **argv,
   ArrayStart = arrayStart;
   NumElements = numElements;
   ValueLink = malloc0(sizeof(*ValueLink)*NumElements);
+  const char* Hist = getenv("LLVMPROF_VALUE_HISTOGRAM");
+  if(Hist && atoi(Hist) > 0){
+	  HistTopN = atoi(Hist);
+	  // twice as many slots as reported values keeps the probe chains short
+	  for(HistBits = 1; HistBits < 16 && (1U << HistBits) < 2 * HistTopN;
+			  ++HistBits);
+	  HistArena = calloc((size_t)NumElements << HistBits, sizeof(ValueSlot));
+	  HistOther = calloc(NumElements, sizeof(unsigned));
+	  if(!HistArena || !HistOther){
+		  fprintf(stderr, "error: unable to allocate value histograms.");
+		  exit(0);
+	  }
+  }
   int i=0;
   for(i=0;i<NumElements;++i){
+	  if(HistTopN) ValueLink[i].flags |= VALUE_HISTOGRAM;
 #ifdef ENABLE_COMPRESS
-	  ValueLink[i].flags |= RUN_LENGTH_COMPRESS;
+	  else ValueLink[i].flags |= RUN_LENGTH_COMPRESS;
 #endif
   }
-  atexit(ValueProfAtExitHandler);
+  set_value_slice_writer(write_value_slice);
+  atexit(HistTopN ? ValueHistAtExitHandler : ValueProfAtExitHandler);
   return Ret;
 }
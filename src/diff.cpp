@@ -0,0 +1,207 @@
+#include "passes.h"
+#include <ProfileInfo.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include "ValueUtils.h"
+#include "ProfileDataTypes.h"
+
+using namespace llvm;
+
+namespace {
+   cl::opt<double> DiffThreshold("diff-threshold", cl::init(0.05),
+         cl::value_desc("ratio"),
+         cl::desc("Ignore changes smaller than this fraction of the old cost"));
+   cl::opt<double> DiffMinDelta("diff-min-delta", cl::init(0),
+         cl::value_desc("cost"),
+         cl::desc("Ignore changes not larger than this absolute cost"));
+   cl::opt<unsigned> DiffTop("diff-top", cl::init(20), cl::value_desc("N"),
+         cl::desc("Number of regressions listed by -diff, 0 for all"));
+}
+
+static double ignoreMissing(double w) {
+   if (w == ProfileInfo::MissingValue) return 0;
+   return w;
+}
+
+char ProfileCostCollector::ID = 0;
+void ProfileCostCollector::getAnalysisUsage(AnalysisUsage &AU) const
+{
+   AU.setPreservesAll();
+   AU.addRequired<ProfileInfo>();
+}
+
+bool ProfileCostCollector::runOnModule(Module &M)
+{
+   ProfileInfo& PI = getAnalysis<ProfileInfo>();
+   // like -timing, the first source of every kind is used
+   BBlockTiming* BT = NULL;
+   MPITiming* MT = NULL;
+   LibCallTiming* CT = NULL;
+   for(TimingSource* S : Sources){
+      if(isa<BBlockTiming>(S) && !BT) BT = cast<BBlockTiming>(S);
+      if(isa<MPITiming>(S) && !MT) MT = cast<MPITiming>(S);
+      if(isa<LibCallTiming>(S) && !CT) CT = cast<LibCallTiming>(S);
+   }
+
+   // the cost of every block, from the instruction groups when it is linear
+   std::vector<double> BlockCosts;
+   std::unique_ptr<BlockHistogram> H;
+   if(BT && BT->isLinear()){
+      H.reset(new BlockHistogram(M, BT->getNumGroups()));
+      for(unsigned N = 0, NE = H->getNumBlocks(); N != NE; ++N)
+         BT->countGroups(*H, N);
+      BT->blockCosts(*H, BlockCosts);
+   }
+
+   for(Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F){
+      if(F->isDeclaration()) continue;
+      ProfileCost& FC = Costs[F];
+      FC.Count = ignoreMissing(PI.getExecutionCount(F));
+      for(Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB){
+         ProfileCost& BC = Costs[BB];
+         BC.Count = ignoreMissing(PI.getExecutionCount(BB));
+         if(H) BC.Time = BC.Count * BlockCosts[H->getBlockNumber(BB)];
+         else if(BT) BC.Time = BC.Count * BT->count(*BB);
+         if(CT)
+            for(BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I)
+               if(CallInst* CI = dyn_cast<CallInst>(&*I))
+                  BC.Time += CT->count(*CI, BC.Count);
+         FC.Time += BC.Time;
+      }
+   }
+
+   for(ProfilingType PT : MPITrapTypes)
+   for(auto I : PI.getTrapSites(PT)){
+      const CallInst* CI = cast<CallInst>(I);
+      const BasicBlock* BB = CI->getParent();
+      ProfileCost& C = Costs[CI];
+      C.Count = ignoreMissing(PI.getExecutionCount(BB));
+      C.Volume = ignoreMissing(PI.getExecutionCount(CI));
+      if(MT) C.Time = MT->count(*CI, C.Count, C.Volume);
+      ProfileCost& FC = Costs[BB->getParent()];
+      FC.Volume += C.Volume;
+      FC.Time += C.Time;
+   }
+   return false;
+}
+
+namespace {
+   struct DiffRow {
+      const char* Kind;
+      std::string Name;
+      ProfileCost Old, New;
+      double Delta;  // of the ranking cost
+   };
+}
+
+static ProfileCost findCost(const ProfileCostMap& Costs, const Value* V)
+{
+   ProfileCostMap::const_iterator Found = Costs.find(V);
+   return Found == Costs.end() ? ProfileCost() : Found->second;
+}
+
+static std::string blockName(const BasicBlock* BB, unsigned Index)
+{
+   std::string Name = BB->getParent()->getName().str() + ":";
+   if(BB->hasName()) return Name + BB->getName().str();
+   return Name + "%" + std::to_string(Index);
+}
+
+static bool DeltaGreater(const DiffRow& L, const DiffRow& R)
+{
+   return L.Delta > R.Delta;
+}
+
+static void printRelative(double Old, double New)
+{
+   if(Old != 0) outs()<<format("%.4g", (New - Old) / Old);
+   else outs()<<(New == 0 ? "0" : "inf");
+}
+
+static void printRow(const DiffRow& R)
+{
+   outs()<<R.Kind<<"\t"<<R.Name<<"\t"
+         <<format("%.0f\t%.0f\t%.0f\t", R.Old.Count, R.New.Count,
+                  R.New.Count - R.Old.Count);
+   printRelative(R.Old.Count, R.New.Count);
+   outs()<<format("\t%.0f\t%.0f\t%.0f\t", R.Old.Volume, R.New.Volume,
+                  R.New.Volume - R.Old.Volume);
+   printRelative(R.Old.Volume, R.New.Volume);
+   outs()<<format("\t%.6g\t%.6g\t%.6g\t", R.Old.Time, R.New.Time,
+                  R.New.Time - R.Old.Time);
+   printRelative(R.Old.Time, R.New.Time);
+   outs()<<"\n";
+}
+
+void llvm::printProfileDiff(Module& M, const ProfileCostMap& Old,
+                            const ProfileCostMap& New, bool Timed)
+{
+   std::vector<DiffRow> Rows;
+   DiffRow Total;
+   Total.Kind = "total";
+   Total.Name = M.getModuleIdentifier();
+   for(Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F){
+      if(F->isDeclaration()) continue;
+      DiffRow R;
+      R.Kind = "function";
+      R.Name = F->getName().str();
+      R.Old = findCost(Old, F);
+      R.New = findCost(New, F);
+      Rows.push_back(R);
+      Total.Old.Volume += R.Old.Volume;
+      Total.New.Volume += R.New.Volume;
+      Total.Old.Time += R.Old.Time;
+      Total.New.Time += R.New.Time;
+
+      unsigned Index = 0;
+      for(Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB, ++Index){
+         R.Kind = "block";
+         R.Name = blockName(BB, Index);
+         R.Old = findCost(Old, BB);
+         R.New = findCost(New, BB);
+         Rows.push_back(R);
+         Total.Old.Count += R.Old.Count;
+         Total.New.Count += R.New.Count;
+         for(BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I){
+            if(!Old.count(&*I) && !New.count(&*I)) continue;
+            const CallInst* CI = cast<CallInst>(&*I);
+            const Value* CV = const_cast<CallInst*>(CI)->getCalledValue();
+            const Function* Callee = dyn_cast<Function>(lle::castoff(const_cast<Value*>(CV)));
+            R.Kind = "mpi";
+            R.Name = blockName(BB, Index) + ":" +
+               (Callee ? Callee->getName().str() : std::string("?")) + "#" +
+               std::to_string(std::distance(BB->begin(), I));
+            R.Old = findCost(Old, CI);
+            R.New = findCost(New, CI);
+            Rows.push_back(R);
+         }
+      }
+   }
+
+   // keep the regressions above the noise, the largest first
+   std::vector<DiffRow> Regressions;
+   for(DiffRow& R : Rows){
+      double OldCost = Timed ? R.Old.Time : R.Old.Count;
+      double NewCost = Timed ? R.New.Time : R.New.Count;
+      R.Delta = NewCost - OldCost;
+      if(R.Delta <= DiffMinDelta || R.Delta <= 0) continue;
+      if(OldCost != 0 && R.Delta / OldCost < DiffThreshold) continue;
+      Regressions.push_back(R);
+   }
+   std::stable_sort(Regressions.begin(), Regressions.end(), DeltaGreater);
+   if(DiffTop && Regressions.size() > DiffTop)
+      Regressions.resize(DiffTop);
+
+   outs()<<"kind\tname"
+         <<"\told_count\tnew_count\tdelta_count\trel_count"
+         <<"\told_volume\tnew_volume\tdelta_volume\trel_volume"
+         <<"\told_time\tnew_time\tdelta_time\trel_time\n";
+   printRow(Total);
+   for(const DiffRow& R : Regressions)
+      printRow(R);
+}
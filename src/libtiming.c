@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
+#include "CpuFreq.h"
 
 /* the define for inst_template.
  * use a template to generate instruction 
@@ -27,48 +28,6 @@
  */
 int inst_template(const char* templ, ...);
 
-/** @return Hz **/
-static unsigned long get_cpu_freq_by_sys()
-{
-   const char* file = "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq";
-   FILE* f = fopen(file,"r");
-   if(f==NULL){
-      perror("Unable Find CPU freq sys file:");
-      fprintf(stderr, "%s\n", file);
-      return 0;
-   }
-   unsigned long freq = 0;
-   fscanf(f, "%lu", &freq);
-   if(freq==0)
-      perror("Unable Read CPU freq:");
-   fclose(f);
-   return freq * 1E3; //convert KHz to Hz
-}
-
-static unsigned long get_cpu_freq_by_proc()
-{
-   const char* file = "/proc/cpuinfo";
-   FILE* f = fopen(file, "r");
-   if(f==NULL){
-      perror("Unable Find /proc/cpuinfo File:");
-      return 0;
-   }
-   char line[256] = {0};
-   unsigned long freq = 0L;
-   while(fgets(line, sizeof(line), f)){
-      double mhz = 0.0L;
-      if (sscanf(line, "cpu MHz\t: %lf", &mhz) == 1){
-         freq = mhz * 1E6; // convert MHz to Hz
-         break;
-      }
-   }
-   if(freq==0)
-      perror("Unable Read CPU freq:");
-   fclose(f);
-   return freq;
-}
-
-
 #if (defined TIMING_tsc) || (defined TIMING_tscp)
 
 
@@ -107,8 +66,7 @@ static inline hp_timing_t _timing(void)
 
 double timing_res() 
 {
-   unsigned long freq = get_cpu_freq_by_sys();
-   if(freq == 0) freq = get_cpu_freq_by_proc();
+   unsigned long freq = get_cpu_freq();
    if(freq == 0) exit(-1);
    return 1.0E9 /*nanosecond*/ / freq;
 }
@@ -145,7 +145,7 @@ namespace {
   ProfileDataFile(cl::Positional, cl::desc("<llvmprof.out file>"),
                   cl::Optional, cl::init("llvmprof.out"));
 
-  cl::opt<bool> DiffMode("diff",cl::desc("Compare two out file"));
+  cl::opt<bool> DiffMode("diff",cl::desc("Compare two out file, or rank the regressions between two profiles of a bitcode"));
   cl::opt<bool> CommMode("print-comm-size",cl::desc("Print the comm size of every communication operation"));
 
   static void printHelpStr(StringRef HelpStr, size_t Indent,
@@ -165,18 +165,22 @@ namespace {
         size_t end;
         StringRef TimingValue = ArgValue;
         do {
-           end = TimingValue.find(':');
-           StringRef TimingKind = TimingValue.substr(0, end);
-           TimingSource *TS = TimingSource::Construct(TimingKind);
-           if (TS)
+           // sources are split by ':' or ',', a source may name its file as
+           // kind@file
+           end = TimingValue.find_first_of(":,");
+           std::pair<StringRef, StringRef> KindFile = TimingValue.substr(0, end).split('@');
+           TimingSource *TS = TimingSource::Construct(KindFile.first);
+           if (TS){
+             TS->setFile(KindFile.second);
              Val.push_back(TS);
+           }
         }while(end!=TimingValue.npos && (TimingValue = TimingValue.substr(end+1))!="");
         return false;
      }
      void printOptionInfo(const cl::Option& O, size_t GlobalWidth) const {
         if (O.hasArgStr()) {
-           outs() << "  -" << O.ArgStr << "=source1:source2:...";
-           printHelpStr(O.HelpStr, GlobalWidth, std::strlen(O.ArgStr) + 26);
+           outs() << "  -" << O.ArgStr << "=source1[@file]:source2[@file]:...";
+           printHelpStr(O.HelpStr, GlobalWidth, std::strlen(O.ArgStr) + 40);
 
            for(auto& E : TimingSource::Avail()){
               size_t NumSpaces = GlobalWidth-E.Name.size()-8;
@@ -190,18 +194,27 @@ namespace {
   enum MergeAlgo {
      MERGE_NONE,
      MERGE_SUM,
-     MERGE_AVG
+     MERGE_AVG,
+     MERGE_MAX,
+     MERGE_MIN,
+     MERGE_STATS
   };
   cl::opt<MergeAlgo> Merge("merge",cl::desc("Merge the Profile info"), cl::values(
         clEnumValN(MERGE_NONE, "none", "do not merge"),
         clEnumValN(MERGE_SUM, "sum", "cacluate sum of total"),
         clEnumValN(MERGE_AVG, "avg", "caculate averange of total"),
+        clEnumValN(MERGE_MAX, "max", "keep the maximum of every counter"),
+        clEnumValN(MERGE_MIN, "min", "keep the minimum of every counter"),
+        clEnumValN(MERGE_STATS, "stats", "calculate sum of total and the distribution of every counter over the inputs"),
         clEnumValEnd), 
      cl::init(MERGE_NONE));
+  cl::opt<unsigned> MergeJobs("merge-jobs", cl::init(0), cl::value_desc("N"),
+        cl::desc("Number of threads merging the profiles, 0 for one per core"));
 
   cl::list<std::string> MergeFile(cl::Positional,cl::desc("<Merge file list>"),cl::ZeroOrMore);
 
   cl::opt<bool> Convert("to-block", cl::desc("Convert Profiling Types to BasicBlockInfo Type"));
+  cl::opt<bool> ConvertIndexed("to-indexed", cl::desc("Convert the edge and block counts to an indexed profile"));
 }
 
 namespace llvm {
@@ -213,14 +226,6 @@ namespace cl{
 }
 }
 
-struct AvgAcc{
-   size_t N;
-   unsigned operator()(unsigned Lhs, unsigned Rhs){ 
-      ++N;
-      return Lhs+Rhs;
-   }
-};
-
 int main(int argc, char **argv) {
   // Print a stack trace if we signal out.
   sys::PrintStackTraceOnErrorSignal();
@@ -235,7 +240,7 @@ int main(int argc, char **argv) {
   std::string ErrorMessage;
   error_code ec;
   Module *M = 0;
-  if(DiffMode) {
+  if(DiffMode && MergeFile.empty()) {
      ProfileInfoLoader PIL1(argv[0], BitcodeFile);
      ProfileInfoLoader PIL2(argv[0], ProfileDataFile);
      
@@ -249,31 +254,15 @@ int main(int argc, char **argv) {
       *  output.out  input1.out      other-input.out 
       **/
 
-     // Add the ProfileDataFile arg to MergeFile, it blongs to the MergeFile
-     MergeFile.push_back(std::string(ProfileDataFile.getValue()));
-     if(MergeFile.size()==0){
-        errs()<<"No merge file!";
-        return 0;
-     }
-
-     //Initialize the ProfileInfoMerge class using one of merge files
-     ProfileInfoLoader AHS(argv[0], MergeFile.back());
-     ProfileInfoMerge MergeClass(std::string(argv[0]), BitcodeFile, AHS);
+     // The ProfileDataFile arg is the first of the merge files
+     MergeFile.insert(MergeFile.begin(), std::string(ProfileDataFile.getValue()));
 
-     for (std::vector<std::string>::iterator merIt = MergeFile.begin(),
-                                             END = MergeFile.end() - 1;
-          merIt != END; ++merIt) {
-        //errs()<<*merIt<<"\n";
-       ProfileInfoLoader THS(argv[0], *merIt);
-       MergeClass.addProfileInfo(THS);
-     }
-     if (Merge == MERGE_SUM) {
-       MergeClass.writeTotalFile();
-     } else if (Merge == MERGE_AVG) {
-       /** avg = sum/N **/
-       MergeClass.writeTotalFile(
-           std::bind2nd(std::divides<unsigned>(), MergeFile.size()));
-     }
+     ProfileInfoMerge::MergeMode Mode = ProfileInfoMerge::MergeSum;
+     if (Merge == MERGE_AVG) Mode = ProfileInfoMerge::MergeAvg;
+     else if (Merge == MERGE_MAX) Mode = ProfileInfoMerge::MergeMax;
+     else if (Merge == MERGE_MIN) Mode = ProfileInfoMerge::MergeMin;
+     else if (Merge == MERGE_STATS) Mode = ProfileInfoMerge::MergeStats;
+     mergeProfiles(argv[0], MergeFile, BitcodeFile, Mode, MergeJobs);
      return 0;
   }
 #if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR==4
@@ -302,6 +291,33 @@ int main(int argc, char **argv) {
      return 1;
   }
 
+  if(DiffMode) {
+     /** argument alignment:
+      *  BitcodeFile ProfileDataFile MergeFile
+      *  bitcode     old.out         new.out timing-files...
+      **/
+     TimingSourceList Sources = std::move(Timing.getValue());
+     if(countTimingMachines(Sources) > 1){
+        errs()<<"-diff compares the profiles on one machine, give every kind "
+                "of timing source once\n";
+        return 1;
+     }
+     initTimingSources(Sources, std::vector<std::string>(MergeFile.begin() + 1,
+                                                         MergeFile.end()));
+     ProfileCostMap Old, New;
+     PassManager OldMgr, NewMgr;
+     OldMgr.add(createProfileLoaderPass(ProfileDataFile));
+     OldMgr.add(new ProfileCostCollector(Sources, Old));
+     OldMgr.run(*M);
+     NewMgr.add(createProfileLoaderPass(MergeFile.front()));
+     NewMgr.add(new ProfileCostCollector(Sources, New));
+     NewMgr.run(*M);
+     printProfileDiff(*M, Old, New, !Sources.empty());
+     for(auto S : Sources)
+        delete S;
+     return 0;
+  }
+
   // Run the printer pass.
   PassManager PassMgr;
   PassMgr.add(createProfileLoaderPass(ProfileDataFile));
@@ -315,8 +331,18 @@ int main(int argc, char **argv) {
      Require3rdArg("no output file");
      ProfileInfoWriter PIW(argv[0], MergeFile.front());
      PassMgr.add(new ProfileInfoConverter(PIW));
+  }else if(ConvertIndexed){
+     Require3rdArg("no output file");
+     ProfileInfoLoader PIL(argv[0], ProfileDataFile);
+     ProfileInfoWriter PIW(argv[0], MergeFile.front());
+     PassMgr.add(new ProfileIndexConverter(PIL, PIW));
+     PassMgr.run(*M);
+     return 0;
   }else if(Timing.size() != 0){
-     Require3rdArg("no timing source file");
+     for(TimingSource* S : Timing.getValue())
+        if(S->getFile().empty()){
+           Require3rdArg("no timing source file");
+        }
      PassMgr.add(new ProfileTimingPrint(std::move(Timing.getValue()), MergeFile));
   }else{
      // Read the profiling information. This is redundant since we load it again
@@ -15,9 +15,8 @@
  *      if(isa<MPITiming>(S) && MpiTiming < DBL_EPSILON)//Only enter this if statement once
  *      {
  *          auto MT = cast<MPITiming>(S);
- *          auto S = PI.getAllTrapedValues(MPIFullInfo);//this S is not the same as the above S
  *          ...
- *          for(auto I : S)//for each MPI instruction I, get I's time
+ *          for(auto I : PI.getTrapSites(MPIFullInfo))//for each MPI instruction I, get I's time
  *          {
  *              ...
  *  ------------double timing = MT->count(*I, PI.getExecutionCount(BB), PI.getExecutionCount(CI));
@@ -47,8 +46,13 @@
 #include <llvm/Support/CommandLine.h>
 #include <fstream>
 #include <iterator>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <float.h>
 #include "ValueUtils.h"
+#include "ProfileDataTypes.h"
 
 using namespace llvm;
 
@@ -59,8 +63,45 @@ namespace {
    cl::opt<std::string> TimingIgnore("timing-ignore",
                                      cl::desc("ignore list for timing mode"),
                                      cl::init(""));
+   cl::opt<unsigned> TimingJobs("timing-jobs", cl::init(0), cl::value_desc("N"),
+         cl::desc("Number of threads estimating the timing, 0 for one per core"));
 };
 
+/// parallelFor - Run Body(i) for every i below N in Jobs threads, which take
+/// the indices in chunks.
+template<class BodyT>
+static void parallelFor(size_t N, unsigned Jobs, BodyT Body)
+{
+   static const size_t Chunk = 64;
+   std::atomic<size_t> Next(0);
+   auto Work = [&]() {
+      for(size_t Begin; (Begin = Next.fetch_add(Chunk)) < N; )
+         for(size_t i = Begin, E = std::min(Begin + Chunk, N); i != E; ++i)
+            Body(i);
+   };
+   Jobs = std::min<size_t>(Jobs, (N + Chunk - 1) / Chunk);
+   std::vector<std::thread> Workers;
+   for(unsigned t = 1; t < Jobs; ++t)
+      Workers.push_back(std::thread(Work));
+   Work();
+   for(std::thread& W : Workers)
+      W.join();
+}
+
+/// collectTerms - Let Body append the terms of every function of Functions to
+/// its vector in Terms, in Jobs threads.  The caller adds the terms up in
+/// order, so the sums do not depend on the number of threads and are those
+/// of a serial walk.
+template<class TermT, class BodyT>
+static void collectTerms(const std::vector<Function*>& Functions, unsigned Jobs,
+                         std::vector<std::vector<TermT> >& Terms, BodyT Body)
+{
+   Terms.assign(Functions.size(), std::vector<TermT>());
+   parallelFor(Functions.size(), Jobs, [&](size_t i) {
+      Body(*Functions[i], Terms[i]);
+   });
+}
+
 char ProfileInfoConverter::ID = 0;
 void ProfileInfoConverter::getAnalysisUsage(AnalysisUsage &AU) const
 {
@@ -85,6 +126,60 @@ bool ProfileInfoConverter::runOnModule(Module &M)
    return false;
 }
 
+char ProfileIndexConverter::ID = 0;
+bool ProfileIndexConverter::runOnModule(Module &M)
+{
+   if(PIL.hasFunctionRecords()){
+      errs()<<"ERROR: "<<PIL.getFileName()<<" is already indexed\n";
+      exit(1);
+   }
+   ArrayRef<uint64_t> Edges = PIL.getRawEdgeCounts();
+   ArrayRef<uint64_t> Blocks = PIL.getRawBlockCounts();
+   std::vector<ProfileInfoWriter::IndexedRecord> Records;
+   uint64_t NumEdges = 0, NumBlocks = 0;
+   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+      if (F->isDeclaration()) continue;
+      ProfileInfoWriter::IndexedRecord R;
+      R.Name = F->getName().str();
+      R.Checksum = FunctionCFGChecksum(F);
+      // the edge counter layout of -insert-edge-profiling: the entry edge,
+      // then the successors of every block
+      uint64_t FunctionEdges = 1;
+      for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+         FunctionEdges += BB->getTerminator()->getNumSuccessors();
+      if(!Edges.empty() && NumEdges + FunctionEdges <= Edges.size()){
+         ProfileInfoWriter::IndexedSlice S;
+         S.Kind = EdgeInfo64;
+         S.First = NumEdges;
+         S.Counters.assign(Edges.begin() + NumEdges,
+                           Edges.begin() + NumEdges + FunctionEdges);
+         R.Slices.push_back(S);
+      }
+      if(!Blocks.empty() && NumBlocks + F->size() <= Blocks.size()){
+         ProfileInfoWriter::IndexedSlice S;
+         S.Kind = BlockInfo64;
+         S.First = NumBlocks;
+         S.Counters.assign(Blocks.begin() + NumBlocks,
+                           Blocks.begin() + NumBlocks + F->size());
+         R.Slices.push_back(S);
+      }
+      NumEdges += FunctionEdges;
+      NumBlocks += F->size();
+      if(!R.Slices.empty()) Records.push_back(R);
+   }
+   if((!Edges.empty() && NumEdges != Edges.size()) ||
+      (!Blocks.empty() && NumBlocks != Blocks.size()))
+      errs()<<"WARNING: profile information is inconsistent with "
+            <<"the current program!\n";
+   if(!PIL.getRawValueCounts().empty() || !PIL.getRawMPIFullCounts().empty() ||
+      !PIL.getRawTimeMess().empty())
+      errs()<<"WARNING: only edge and block counts are converted\n";
+
+   for(unsigned i = 0; i != PIL.getNumExecutions(); ++i)
+      Writer.write(PIL.getExecution(i));
+   Writer.writeIndexed(Records);
+   return false;
+}
 
 bool ProfileInfoCompare::run()
 {
@@ -121,11 +216,9 @@ void ProfileInfoComm::getAnalysisUsage(AnalysisUsage &AU) const
 bool ProfileInfoComm::runOnModule(Module &M)
 {
    ProfileInfo& PI = getAnalysis<ProfileInfo>();
-   auto S = PI.getAllTrapedValues(MPIFullInfo);
-   auto U = PI.getAllTrapedValues(MPInfo);
-   if(U.size()>0) outs()<<"Notice: Old Mpi Profiling Format\n";
-   S.insert(S.end(), U.begin(), U.end());
-   for(auto I : S){
+   if(!PI.getTrapSites(MPInfo).empty()) outs()<<"Notice: Old Mpi Profiling Format\n";
+   for(ProfilingType PT : MPITrapTypes)
+   for(auto I : PI.getTrapSites(PT)){
       const CallInst* CI = cast<CallInst>(I);
       const BasicBlock* BB = CI->getParent();
       size_t BFreq = PI.getExecutionCount(BB);
@@ -146,6 +239,220 @@ bool ProfileInfoComm::runOnModule(Module &M)
 }
 
 
+/// buildHistogram - The instruction groups of BT in every block of M,
+/// classified in Jobs threads.
+static std::unique_ptr<BlockHistogram> buildHistogram(Module& M, const BBlockTiming* BT,
+                                                      unsigned Jobs)
+{
+   std::unique_ptr<BlockHistogram> H(new BlockHistogram(M, BT->getNumGroups()));
+   parallelFor(H->getNumBlocks(), Jobs, [&](size_t N) {
+      BT->countGroups(*H, N);
+   });
+   return H;
+}
+
+namespace {
+   /// MachineTiming - The timing sources of one machine.
+   struct MachineTiming {
+      BBlockTiming* BT;
+      MPITiming* MT;
+      LibCallTiming* CT;
+      std::string Name;
+      MachineTiming():BT(NULL), MT(NULL), CT(NULL) {}
+   };
+   /// MPISite - A traped mpi call, with the counts of its block and of its
+   /// communication.
+   struct MPISite {
+      const Instruction* I;
+      unsigned Row;
+      double BFreq, Volume;
+   };
+}
+
+/// mixesKinds - Whether the sources of a category are not all of one kind.
+template<class SourceT>
+static bool mixesKinds(const std::vector<SourceT*>& Sources)
+{
+   for(SourceT* S : Sources)
+      if(S->getKind() != Sources.front()->getKind()) return true;
+   return false;
+}
+
+unsigned llvm::countTimingMachines(const std::vector<TimingSource*>& Sources)
+{
+   std::map<TimingSource::Kind, unsigned> KindCount;
+   unsigned NumMachines = 1;
+   for(TimingSource* S : Sources)
+      NumMachines = std::max(NumMachines, ++KindCount[S->getKind()]);
+   if(NumMachines < 2) return 1;
+
+   std::vector<BBlockTiming*> BTs;
+   std::vector<MPITiming*> MTs;
+   std::vector<LibCallTiming*> CTs;
+   for(TimingSource* S : Sources){
+      if(isa<BBlockTiming>(S)) BTs.push_back(cast<BBlockTiming>(S));
+      if(isa<MPITiming>(S)) MTs.push_back(cast<MPITiming>(S));
+      if(isa<LibCallTiming>(S)) CTs.push_back(cast<LibCallTiming>(S));
+   }
+   if(mixesKinds(BTs) || mixesKinds(MTs) || mixesKinds(CTs)){
+      errs()<<"Timing sources of several machines must be of one kind per "
+              "block, mpi and library call category\n";
+      exit(-1);
+   }
+   return NumMachines;
+}
+
+/// printMachineTimings - When a kind of timing source is given several times,
+/// print a tab separated table of the estimated time of every function on
+/// every machine, machine i being costed by the i-th source of every kind, or
+/// by the last one of a kind given fewer times.  The instruction histograms
+/// and the mpi and library call sites are gathered once for all machines.
+/// Returns false, printing nothing, for a single machine.
+static bool printMachineTimings(Module& M, ProfileInfo& PI,
+                                const std::vector<TimingSource*>& Sources,
+                                const std::set<std::string>& Ignore,
+                                unsigned Jobs)
+{
+   size_t NumMachines = countTimingMachines(Sources);
+   if(NumMachines < 2) return false;
+
+   // one kind per category, as countTimingMachines checked
+   std::vector<BBlockTiming*> BTs;
+   std::vector<MPITiming*> MTs;
+   std::vector<LibCallTiming*> CTs;
+   for(TimingSource* S : Sources){
+      if(isa<BBlockTiming>(S)) BTs.push_back(cast<BBlockTiming>(S));
+      if(isa<MPITiming>(S)) MTs.push_back(cast<MPITiming>(S));
+      if(isa<LibCallTiming>(S)) CTs.push_back(cast<LibCallTiming>(S));
+   }
+
+   std::vector<MachineTiming> Machines(NumMachines);
+   for(size_t m = 0; m != NumMachines; ++m){
+      MachineTiming& Mach = Machines[m];
+      if(!BTs.empty()) Mach.BT = BTs[std::min(m, BTs.size() - 1)];
+      if(!MTs.empty()) Mach.MT = MTs[std::min(m, MTs.size() - 1)];
+      if(!CTs.empty()) Mach.CT = CTs[std::min(m, CTs.size() - 1)];
+      // named by the files which differ between the machines
+      auto AddName = [&Mach](TimingSource* S, size_t Num) {
+         if(!S || Num < 2) return;
+         if(!Mach.Name.empty()) Mach.Name += "+";
+         Mach.Name += S->getFile();
+      };
+      AddName(Mach.BT, BTs.size());
+      AddName(Mach.MT, MTs.size());
+      AddName(Mach.CT, CTs.size());
+   }
+
+   std::vector<Function*> Rows;
+   DenseMap<const Function*, unsigned> RowOf;
+   for(Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F){
+      if(F->isDeclaration() || Ignore.count(F->getName())) continue;
+      RowOf[F] = Rows.size();
+      Rows.push_back(F);
+   }
+   // the time of function r on machine m
+   std::vector<double> Times(Rows.size() * NumMachines, 0.);
+
+   std::map<TimingSource::Kind, std::unique_ptr<BlockHistogram> > Histograms;
+   std::vector<double> Freqs;
+   std::vector<unsigned> BlockRow;
+   std::vector<MPISite> MPISites;
+   std::vector<std::vector<std::pair<const CallInst*, double> > > CallSites;
+   if(!MTs.empty()){
+      for(ProfilingType PT : MPITrapTypes)
+      for(auto I : PI.getTrapSites(PT)){
+         const CallInst* CI = cast<CallInst>(I);
+         const BasicBlock* BB = CI->getParent();
+         auto Row = RowOf.find(BB->getParent());
+         if(Row == RowOf.end()) continue;
+         MPISite Site = { I, Row->second, PI.getExecutionCount(BB),
+                          PI.getExecutionCount(CI) };
+         MPISites.push_back(Site);
+      }
+   }
+   if(!CTs.empty())
+      collectTerms(Rows, Jobs, CallSites,
+                   [&](Function& F, std::vector<std::pair<const CallInst*, double> >& T) {
+         for(auto& BB : F)
+            for(auto& I : BB)
+               if(CallInst* CI = dyn_cast<CallInst>(&I))
+                  T.push_back(std::make_pair(CI, PI.getExecutionCount(&BB)));
+      });
+
+   for(size_t m = 0; m != NumMachines; ++m){
+      MachineTiming& Mach = Machines[m];
+      if(Mach.BT && Mach.BT->isLinear()){
+         std::unique_ptr<BlockHistogram>& H = Histograms[Mach.BT->getKind()];
+         if(!H) H = buildHistogram(M, Mach.BT, Jobs);
+         // every histogram numbers the blocks of M in the same order
+         if(BlockRow.empty()){
+            BlockRow.assign(H->getNumBlocks(), ~0U);
+            Freqs.assign(H->getNumBlocks(), 0.);
+            for(unsigned N = 0, NE = H->getNumBlocks(); N != NE; ++N){
+               auto Row = RowOf.find(H->getBlock(N)->getParent());
+               if(Row == RowOf.end()) continue;
+               BlockRow[N] = Row->second;
+               Freqs[N] = PI.getExecutionCount(H->getBlock(N));
+            }
+         }
+         std::vector<double> Costs;
+         Mach.BT->blockCosts(*H, Costs);
+         for(unsigned N = 0, NE = H->getNumBlocks(); N != NE; ++N)
+            if(BlockRow[N] != ~0U)
+               Times[BlockRow[N] * NumMachines + m] += Freqs[N] * Costs[N];
+      }else if(Mach.BT){
+         BBlockTiming* BT = Mach.BT;
+         parallelFor(Rows.size(), Jobs, [&](size_t r) {
+            for(Function::iterator BB = Rows[r]->begin(), BBE = Rows[r]->end(); BB != BBE; ++BB)
+               Times[r * NumMachines + m] += PI.getExecutionCount(BB) * BT->count(*BB);
+         });
+      }
+      if(Mach.MT)
+         for(const MPISite& Site : MPISites)
+            Times[Site.Row * NumMachines + m] +=
+               Mach.MT->count(*Site.I, Site.BFreq, Site.Volume);
+      if(Mach.CT){
+         LibCallTiming* CT = Mach.CT;
+         parallelFor(Rows.size(), Jobs, [&](size_t r) {
+            for(auto& Site : CallSites[r])
+               Times[r * NumMachines + m] += CT->count(*Site.first, Site.second);
+         });
+      }
+   }
+
+   std::vector<double> Total(NumMachines, 0.);
+   for(size_t r = 0; r != Rows.size(); ++r)
+      for(size_t m = 0; m != NumMachines; ++m)
+         Total[m] += Times[r * NumMachines + m];
+   outs()<<"function";
+   for(const MachineTiming& Mach : Machines)
+      outs()<<"\t"<<Mach.Name;
+   outs()<<"\ntotal";
+   for(double T : Total)
+      outs()<<"\t"<<T;
+   outs()<<"\n";
+   for(size_t r = 0; r != Rows.size(); ++r){
+      const double* Row = &Times[r * NumMachines];
+      if(std::all_of(Row, Row + NumMachines, [](double T) { return T == 0.; }))
+         continue;
+      outs()<<Rows[r]->getName();
+      for(size_t m = 0; m != NumMachines; ++m)
+         outs()<<"\t"<<Row[m];
+      outs()<<"\n";
+   }
+   return true;
+}
+
+namespace {
+   /// MPICallTerm - The real time of a mpi call, or a call without a known
+   /// callee.
+   struct MPICallTerm {
+      enum KindTy { NoCallee, Call, Wait } Kind;
+      double Time;
+      MPICallTerm(double Time, KindTy Kind):Kind(Kind), Time(Time) {}
+   };
+}
+
 char ProfileTimingPrint::ID = 0;
 void ProfileTimingPrint::getAnalysisUsage(AnalysisUsage &AU) const
 {
@@ -166,13 +473,21 @@ bool ProfileTimingPrint::runOnModule(Module &M)
    double RealWaitTime = 0.0;//add by haomeng. The real wait time of mpi
    std::map<std::string, double> InstNum;
    std::map<std::string, double> InstTime;
+   std::vector<Function*> Functions;
+   for(Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F)
+      Functions.push_back(F);
+   // without the dense index the counts are computed, and cached, on demand
+   unsigned Jobs = TimingJobs ? TimingJobs : std::thread::hardware_concurrency();
+   if(!PI.hasDenseIndex() || Jobs == 0) Jobs = 1;
+   if(printMachineTimings(M, PI, Sources, Ignore, Jobs)) return false;
    for(TimingSource* S : Sources){
       if (isa<BBlockTiming>(S)
           && BlockTiming < DBL_EPSILON) { // BlockTiming is Zero
          auto BT = cast<BBlockTiming>(S);
+#ifndef NDEBUG
+         // serial, it gathers the per instruction statistics and prints
          for(Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F){
             if(Ignore.count(F->getName())) continue;
-#ifndef NDEBUG
             double FuncTiming = 0.;
             size_t MaxTimes = 0;
             double MaxCount = 0.;
@@ -220,46 +535,74 @@ bool ProfileTimingPrint::runOnModule(Module &M)
                      << "max=" << MaxTimes << "*" << MaxCount << "\t" << MaxName
                      << "\t" << F->getName() << "\n";
             BlockTiming += FuncTiming;
+         }
 #else
-            for(Function::iterator BB = F->begin(), BBE = F->end(); BB != BBE; ++BB){
-               BlockTiming += PI.getExecutionCount(BB) * S->count(*BB);
+         if(BT->isLinear()){
+            // classify every instruction once, then the whole program is a
+            // product of the group counts with the params
+            std::unique_ptr<BlockHistogram> H = buildHistogram(M, BT, Jobs);
+            std::vector<double> Freqs(H->getNumBlocks(), 0.);
+            for(unsigned N = 0, NE = H->getNumBlocks(); N != NE; ++N){
+               BasicBlock* BB = H->getBlock(N);
+               if(!Ignore.count(BB->getParent()->getName()))
+                  Freqs[N] = PI.getExecutionCount(BB);
             }
-#endif
+            BlockTiming += BT->count(*H, Freqs);
+         }else{
+            std::vector<std::vector<double> > Terms;
+            collectTerms(Functions, Jobs, Terms, [&](Function& F, std::vector<double>& T) {
+               if(Ignore.count(F.getName())) return;
+               for(Function::iterator BB = F.begin(), BBE = F.end(); BB != BBE; ++BB)
+                  T.push_back(PI.getExecutionCount(BB) * BT->count(*BB));
+            });
+            for(auto& T : Terms)
+               for(double Timing : T)
+                  BlockTiming += Timing;
          }
+#endif
       }
       if(isa<MPITiming>(S) && MpiTiming < DBL_EPSILON){ // MpiTiming is Zero
          auto MT = cast<MPITiming>(S);
-         auto S = PI.getAllTrapedValues(MPIFullInfo);
-         auto U = PI.getAllTrapedValues(MPInfo);
-         if(U.size()>0) outs()<<"Notice: Old Mpi Profiling Format\n";
-         S.insert(S.end(), U.begin(), U.end());
+         if(!PI.getTrapSites(MPInfo).empty()) outs()<<"Notice: Old Mpi Profiling Format\n";
 //add by haomeng. Calculate the real time of mpi
-         for(Module::iterator F = M.begin(), E = M.end(); F!= E; ++F){
-            for(Function::iterator BB = F->begin(), BE = F->end(); BB!= BE; ++BB){
+         std::vector<std::vector<MPICallTerm> > Terms;
+         collectTerms(Functions, Jobs, Terms, [&](Function& F, std::vector<MPICallTerm>& T) {
+            for(Function::iterator BB = F.begin(), BE = F.end(); BB!= BE; ++BB){
                for(BasicBlock::iterator I = BB->begin(), IE = BB->end(); I!= IE; ++I){
                   CallInst* CI = dyn_cast<CallInst>(&*I);
                   if(CI == NULL) continue;
+                  // not castoff, which makes an instruction of a constant
+                  // cast and so adds a use to the callee from every thread
                   Value* CV = const_cast<CallInst*>(CI)->getCalledValue();
-                  Function* func = dyn_cast<Function>(lle::castoff(CV));
-                  if(func == NULL)
-		  {
-                     errs()<<"No func!\n";
-		     continue;
-	          }
+                  Function* func = dyn_cast<Function>(CV->stripPointerCasts());
+                  if(func == NULL){
+                     T.push_back(MPICallTerm(0., MPICallTerm::NoCallee));
+                     continue;
+                  }
                   StringRef str = func->getName();
                   if(str.startswith("mpi_")){
                      if(str.startswith("mpi_init_")||str.startswith("mpi_comm_rank_")||str.startswith("mpi_comm_size_"))
                         continue;
-                    RealMpiTime += PI.getMPITime(CI);
-                    if(str.startswith("mpi_wait_")||str.startswith("mpi_barrier_")||str.startswith("mpi_waitall_"))
-                       RealWaitTime += PI.getMPITime(CI);
+                     bool Wait = str.startswith("mpi_wait_")||str.startswith("mpi_barrier_")||str.startswith("mpi_waitall_");
+                     T.push_back(MPICallTerm(PI.getMPITime(CI), Wait ? MPICallTerm::Wait : MPICallTerm::Call));
                   }
                }
             }
-         }
+         });
+         for(auto& T : Terms)
+            for(const MPICallTerm& C : T){
+               if(C.Kind == MPICallTerm::NoCallee){
+                  errs()<<"No func!\n";
+                  continue;
+               }
+               RealMpiTime += C.Time;
+               if(C.Kind == MPICallTerm::Wait)
+                  RealWaitTime += C.Time;
+            }
 
 
-         for(auto I : S){
+         for(ProfilingType PT : MPITrapTypes)
+         for(auto I : PI.getTrapSites(PT)){
             const CallInst* CI = cast<CallInst>(I);
             const BasicBlock* BB = CI->getParent();
             if(Ignore.count(BB->getParent()->getName())) continue;
@@ -291,15 +634,19 @@ bool ProfileTimingPrint::runOnModule(Module &M)
       }
       if(isa<LibCallTiming>(S) && CallTiming < DBL_EPSILON){
          auto CT = cast<LibCallTiming>(S);
-         for(auto& F : M){
+         std::vector<std::vector<double> > Terms;
+         collectTerms(Functions, Jobs, Terms, [&](Function& F, std::vector<double>& T) {
             for(auto& BB : F){
                for(auto& I : BB){
                   if(CallInst* CI = dyn_cast<CallInst>(&I)){
-                     CallTiming += CT->count(*CI, PI.getExecutionCount(&BB));
+                     T.push_back(CT->count(*CI, PI.getExecutionCount(&BB)));
                   }
                }
             }
-         }
+         });
+         for(auto& T : Terms)
+            for(double Timing : T)
+               CallTiming += Timing;
       }
    }
    AbsoluteTiming = BlockTiming + MpiTiming/*MpiTiming */+ CallTiming;
@@ -563,13 +910,32 @@ bool ProfileTimingPrint::runOnModule(Module &M)
    return false;
 }
 
+void llvm::initTimingSources(std::vector<TimingSource*>& Sources,
+                             const std::vector<std::string>& Files)
+{
+   // the sources without a kind@file take the files in order
+   unsigned NextFile = 0;
+   for(unsigned i = 0; i < Sources.size(); ++i){
+      if(Sources[i]->getFile().empty()){
+         if(NextFile == Files.size()){
+            errs()<<"No Enough File to initialize Timing Source\n";
+            exit(-1);
+         }
+         Sources[i]->setFile(Files[NextFile++]);
+      }
+      Sources[i]->init_with_file(Sources[i]->getFile().c_str());
+#ifndef NDEBUG
+      if(TimingDebug){
+         outs()<<"parsed "<<Sources[i]->getFile()<<" file's content:\n";
+         Sources[i]->print(outs());
+      }
+#endif
+   }
+}
+
 ProfileTimingPrint::ProfileTimingPrint(std::vector<TimingSource*>&& TS,
       std::vector<std::string>& Files):ModulePass(ID), Sources(TS)
 {
-   if(Sources.size() > Files.size()){
-      errs()<<"No Enough File to initialize Timing Source\n";
-      exit(-1);
-   }
    if(TimingIgnore!=""){
       std::ifstream IgnoreFile(TimingIgnore);
       if(!IgnoreFile.is_open()){
@@ -581,15 +947,7 @@ ProfileTimingPrint::ProfileTimingPrint(std::vector<TimingSource*>&& TS,
                 std::inserter(Ignore, Ignore.end()));
       IgnoreFile.close();
    }
-   for(unsigned i = 0; i < Sources.size(); ++i){
-      Sources[i]->init_with_file(Files[i].c_str());
-#ifndef NDEBUG
-      if(TimingDebug){
-         outs()<<"parsed "<<Files[i]<<" file's content:\n";
-         Sources[i]->print(outs());
-      }
-#endif
-   }
+   initTimingSources(Sources, Files);
 }
 
 ProfileTimingPrint::~ProfileTimingPrint()
@@ -3,6 +3,7 @@
 #include <llvm/Pass.h>
 #include "TimingSource.h"
 #include "ProfileInfoWriter.h"
+#include <map>
 #include <set>
 #include <vector>
 namespace llvm{
@@ -35,6 +36,7 @@ namespace llvm{
       void printMPICounts(ProfilingType Info);
       void printRankInfo(ProfilingType Info);
       void printMPITime(ProfilingType Info, std::map<const CallInst*, int>& MPICallNum);
+      void printImbalance(Module& M);
       virtual const char* getPassName() const {
          return "Print Profile Info";
       }
@@ -48,6 +50,18 @@ namespace llvm{
       void getAnalysisUsage(AnalysisUsage& AU) const;
       bool runOnModule(Module& M);
    };
+   /// ProfileIndexConverter - Rewrite the edge and block counts of an
+   /// ordinary profile of the module as an indexed profile, see -to-indexed.
+   class ProfileIndexConverter: public ModulePass
+   {
+      ProfileInfoLoader& PIL;
+      ProfileInfoWriter& Writer;
+      public:
+      static char ID;
+      ProfileIndexConverter(ProfileInfoLoader& L, ProfileInfoWriter& PIW)
+         :ModulePass(ID), PIL(L), Writer(PIW) {}
+      bool runOnModule(Module& M) override;
+   };
    class ProfileInfoCompare
    {
       ProfileInfoLoader& Lhs;
@@ -57,6 +71,43 @@ namespace llvm{
          :Lhs(LHS), Rhs(RHS) {}
       bool run();
    };
+   /// ProfileCost - What a function, block or mpi call cost in one profile:
+   /// how often it ran, the mpi volume it moved and the time estimated by the
+   /// timing sources.
+   struct ProfileCost {
+      double Count, Volume, Time;
+      ProfileCost():Count(0), Volume(0), Time(0) {}
+   };
+   typedef std::map<const Value*, ProfileCost> ProfileCostMap;
+   /// ProfileCostCollector - Record the costs of the functions, blocks and mpi
+   /// calls of the module in the profile loaded before it, see -diff.
+   class ProfileCostCollector: public ModulePass
+   {
+      const std::vector<TimingSource*>& Sources;
+      ProfileCostMap& Costs;
+      public:
+      static char ID;
+      ProfileCostCollector(const std::vector<TimingSource*>& S, ProfileCostMap& C)
+         :ModulePass(ID), Sources(S), Costs(C) {}
+      void getAnalysisUsage(AnalysisUsage& AU) const override;
+      bool runOnModule(Module& M) override;
+   };
+   /// printProfileDiff - Print the total and the top regressions from the costs
+   /// Old to New of the module as a tab separated table.  They are ranked by
+   /// estimated time when Timed, by execution count otherwise.
+   void printProfileDiff(Module& M, const ProfileCostMap& Old,
+                         const ProfileCostMap& New, bool Timed);
+   /// initTimingSources - Read the parameters of every timing source from the
+   /// file at the same position in Files.
+   void initTimingSources(std::vector<TimingSource*>& Sources,
+                          const std::vector<std::string>& Files);
+   /// countTimingMachines - The number of machines the sources cost: the most
+   /// times a kind of source is given.  Exits when several machines are given
+   /// with different kinds in a category.
+   unsigned countTimingMachines(const std::vector<TimingSource*>& Sources);
+   /// MPITrapTypes - The profiling types whose traped instructions are mpi
+   /// calls, for PI.getTrapSites.  MPInfo is the old format.
+   static const ProfilingType MPITrapTypes[] = { MPIFullInfo, MPInfo };
    class ProfileInfoComm: public ModulePass
    {
       public:
@@ -57,27 +57,31 @@ void ProfileInfoPrinterPass::getAnalysisUsage(AnalysisUsage& AU) const
 void ProfileInfoPrinterPass::printValueContent()
 {
 	ProfileInfo &PI = getAnalysis<ProfileInfo>();
-	std::vector<const Instruction*> Calls = PI.getAllTrapedValues(ValueInfo);
+	ArrayRef<const Instruction*> Calls = PI.getTrapSites(ValueInfo);
 	outs()<<"No.\t\tType\t\tContent\n";
-	for(std::vector<const Instruction*>::const_iterator I = Calls.begin(), E = Calls.end(); I!=E; ++I){
+	for(ArrayRef<const Instruction*>::iterator I = Calls.begin(), E = Calls.end(); I!=E; ++I){
 		const CallInst* CI = dyn_cast<CallInst>(*I);
-		std::vector<int> Contents = PI.getValueContents(CI);
+		ValueRuns Runs = PI.getValueRuns(CI);
 		const Value* traped = PI.getTrapedTarget(CI);
 		outs()<<PI.getTrapedIndex(CI)<<". \t";
 		if(isa<Constant>(traped))outs()<<"Constant";
 		else outs()<<"Variable";
 		outs()<<"("<<(unsigned)PI.getExecutionCount(CI)<<"):\t";
-		std::vector<int>::iterator II = Contents.begin(),EE=Contents.end(),BND;
+		// adjacent runs of the same value are printed as one
+		ValueRuns::iterator II = Runs.begin(), EE = Runs.end();
 		while(II!=EE){
-			BND = std::upper_bound(II, EE, *II);
-			size_t len = BND-II;
+			int value = (*II).Value;
+			uint64_t len = 0;
+			for(; II!=EE && (*II).Value == value; ++II)
+				len += (*II).Count;
 			if (len>5)
-				outs()<<*II<<"<repeat "<<len<<" times>,";
+				outs()<<value<<"<repeat "<<len<<" times>,";
 			else
 				for(unsigned i=0;i<len;i++)
-					outs()<<*II<<",";
-			II=BND;
+					outs()<<value<<",";
 		}
+		if(unsigned Other = PI.getValueOtherCount(CI))
+			outs()<<"<"<<Other<<" other values>,";
 		outs()<<"\n";
 	}
 }
@@ -96,6 +100,9 @@ void ProfileInfoPrinterPass::printExecutionCommands()
 		if (e != 1) outs() << i+1 << ". ";
 		outs() << PIL.getExecution(i) << "\n";
 	}
+	if (PIL.getNumSnapshots())
+		outs() << "  " << PIL.getNumSnapshots()
+			<< " snapshot packets, select one with -profile-snapshot\n";
 }
 
 void ProfileInfoPrinterPass::printFunctionCounts(
@@ -175,7 +182,7 @@ ProfileInfoPrinterPass::printBasicBlockCounts(
 void ProfileInfoPrinterPass::printValueCounts()
 {
 	ProfileInfo& PI = getAnalysis<ProfileInfo>();
-	std::vector<const Instruction*> trapes = PI.getAllTrapedValues(ValueInfo);
+	ArrayRef<const Instruction*> trapes = PI.getTrapSites(ValueInfo);
 	if(trapes.empty()) return;
 
 	std::vector<std::pair<const CallInst*,double> > ValueCounts;
@@ -217,7 +224,7 @@ void ProfileInfoPrinterPass::printValueCounts()
 void ProfileInfoPrinterPass::printSLGCounts()
 {
 	ProfileInfo& PI = getAnalysis<ProfileInfo>();
-	std::vector<const Instruction*> trapes = PI.getAllTrapedValues(SLGInfo);
+	ArrayRef<const Instruction*> trapes = PI.getTrapSites(SLGInfo);
 	if(trapes.empty()) return;
 
 	outs() << "\n===" << std::string(73, '-') << "===\n";
@@ -250,7 +257,7 @@ void ProfileInfoPrinterPass::printSLGCounts()
 void ProfileInfoPrinterPass::printMPICounts(ProfilingType Info)
 {
 	ProfileInfo& PI = getAnalysis<ProfileInfo>();
-	auto trapes = PI.getAllTrapedValues(Info);
+	ArrayRef<const Instruction*> trapes = PI.getTrapSites(Info);
 	if(trapes.empty()) return;
 
 	outs() << "\n===" << std::string(73, '-') << "===\n";
@@ -282,7 +289,7 @@ void ProfileInfoPrinterPass::printRankInfo(ProfilingType Info)
 void ProfileInfoPrinterPass::printMPITime(ProfilingType Info, std::map<const CallInst*, int>& MPICallNum )
 {
 	ProfileInfo& PI = getAnalysis<ProfileInfo>();
-	auto trapes = PI.getAllTrapedValues(Info);
+	ArrayRef<const Instruction*> trapes = PI.getTrapSites(Info);
 	if(trapes.empty()) return;
 	outs() << "\n===" << std::string(73, '-') << "===\n";
 	outs() << "mpi time profiling information:\n\n";
@@ -336,6 +343,129 @@ void ProfileInfoPrinterPass::printMPITime(ProfilingType Info, std::map<const Cal
 	outs() << "Total mpi time:\t" << alltime <<"\n";
 }
 
+namespace {
+	// Imbalance - A counter of a -merge=stats profile, scored by how much its
+	// slowest rank exceeds the mean.
+	struct Imbalance {
+		double Score;
+		const CounterStats* Stats;
+		const BasicBlock* From;  // the block, or the source of an edge
+		const BasicBlock* To;    // the destination of an edge
+		const CallInst* Call;
+	};
+}
+
+static bool ImbalanceGreater(const Imbalance& L, const Imbalance& R)
+{
+	return L.Score > R.Score;
+}
+
+static Imbalance makeImbalance(const CounterStats& S, double Cost,
+		const BasicBlock* From, const BasicBlock* To, const CallInst* Call)
+{
+	Imbalance I = { (S.max - S.mean) * Cost, &S, From, To, Call };
+	return I;
+}
+
+static void printImbalanceTable(std::vector<Imbalance>& Rows)
+{
+	if(!Unsort)
+		std::stable_sort(Rows.begin(), Rows.end(), ImbalanceGreater);
+	outs() <<" ##   Imbalance\t      Mean     Stddev        P50        P90"
+		"        P99        Max(rank)\tWhere\n";
+	unsigned RowsToPrint = Rows.size();
+	if (!ListAll && RowsToPrint > 20) RowsToPrint = 20;
+	for (unsigned i = 0; i != RowsToPrint; ++i) {
+		const Imbalance& I = Rows[i];
+		const CounterStats& S = *I.Stats;
+		outs() << format("%3d", i+1) << ". "
+			<< format("%10.4g", I.Score) << "\t"
+			<< format("%10.4g %10.4g %10.4g %10.4g %10.4g %10.4g", S.mean,
+					S.stddev, S.p50, S.p90, S.p99, S.max)
+			<< "(" << S.argmaxRank << ")\t";
+		if (I.Call) {
+			const BasicBlock* BB = I.Call->getParent();
+			Value* CV = const_cast<CallInst*>(I.Call)->getCalledValue();
+			outs() << lle::castoff(CV)->getName() << "\t"
+				<< BB->getParent()->getName() << ":\"" << BB->getName() << "\"\n";
+		} else if (I.To) {
+			outs() << I.To->getParent()->getName() << "() - "
+				<< (I.From ? I.From->getName() : StringRef("0")) << " -> "
+				<< I.To->getName() << "\n";
+		} else {
+			outs() << I.From->getParent()->getName() << "() - "
+				<< I.From->getName() << "\n";
+		}
+	}
+}
+
+// printImbalance - The blocks, or edges, and the mpi calls whose counters vary
+// the most over the ranks of a -merge=stats profile, ranked by (max - mean)
+// times their estimated cost: the instructions of a block, one for the
+// seconds of a mpi call.
+void ProfileInfoPrinterPass::printImbalance(Module& M)
+{
+	ProfileInfo& PI = getAnalysis<ProfileInfo>();
+	ArrayRef<CounterStats> BlockStats = PIL.getRawStats(BlockInfo64);
+	ArrayRef<CounterStats> EdgeStats = PIL.getRawStats(EdgeInfo64);
+	std::vector<Imbalance> Rows;
+	unsigned Index = 0;
+	for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+		if (F->isDeclaration()) continue;
+		if (!BlockStats.empty()) {
+			for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+				if (Index < BlockStats.size()) {
+					Rows.push_back(makeImbalance(BlockStats[Index++], BB->size(),
+								&*BB, 0, 0));
+				}
+			continue;
+		}
+		// edges come in the order of the edge profiling
+		const BasicBlock* Entry = &F->getEntryBlock();
+		if (Index < EdgeStats.size())
+			Rows.push_back(makeImbalance(EdgeStats[Index++], Entry->size(), 0,
+						Entry, 0));
+		for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+			const TerminatorInst* TI = BB->getTerminator();
+			for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s)
+				if (Index < EdgeStats.size()) {
+					const BasicBlock* Succ = TI->getSuccessor(s);
+					Rows.push_back(makeImbalance(EdgeStats[Index++], Succ->size(),
+								&*BB, Succ, 0));
+				}
+		}
+	}
+	if (!Rows.empty()) {
+		outs() << "\n===" << std::string(73, '-') << "===\n";
+		outs() << "Most imbalanced " << (BlockStats.empty() ? "edges" : "blocks")
+			<< " over " << Rows[0].Stats->numRanks
+			<< " ranks, (max - mean) x instructions:\n\n";
+		printImbalanceTable(Rows);
+	}
+
+	// mpi calls by their time if there is one, otherwise by their count
+	ArrayRef<CounterStats> TimeStats = PIL.getRawStats(MPITimeInfo);
+	ArrayRef<CounterStats> CountStats = PIL.getRawStats(MPIFullInfo);
+	bool ByTime = !TimeStats.empty();
+	Rows.clear();
+	ArrayRef<const Instruction*> Calls =
+		PI.getTrapSites(ByTime ? MPITimeInfo : MPIFullInfo);
+	for (unsigned i = 0, e = Calls.size(); i != e; ++i) {
+		const CallInst* CI = cast<CallInst>(Calls[i]);
+		unsigned Idx = ByTime ? PI.getMPITimeIndex(CI) : PI.getTrapedIndex(CI);
+		ArrayRef<CounterStats> Stats = ByTime ? TimeStats : CountStats;
+		if (Idx < Stats.size())
+			Rows.push_back(makeImbalance(Stats[Idx], 1, 0, 0, CI));
+	}
+	if (!Rows.empty()) {
+		outs() << "\n===" << std::string(73, '-') << "===\n";
+		outs() << "Most imbalanced mpi calls over " << Rows[0].Stats->numRanks
+			<< " ranks, (max - mean) of the " << (ByTime ? "time" : "count")
+			<< ":\n\n";
+		printImbalanceTable(Rows);
+	}
+}
+
 namespace {
 	class ProfileAnnotator : public AssemblyAnnotationWriter {
 		ProfileInfo &PI;
@@ -525,6 +655,7 @@ bool ProfileInfoPrinterPass::runOnModule(Module &M) {
 		printMPICounts(MPIFullInfo);
 		printAnnotatedCode(FunctionToPrint,M);
 		printMPITime(MPITimeInfo, MPICallNum);
+		printImbalance(M);
 		//printStaticBlockFrequency(StaticCounts);
 
 	}
@@ -0,0 +1,125 @@
+/*===-- MPIReduceTest.c - Test of the libprofile_rt_mpi reduction ---------===*\
+|*
+|* Run on several ranks, every rank counts into the same edge and mpi time
+|* arrays and traps its rank as a value.  Run as "MPIReduceTest -check
+|* <file>..." it checks that the files hold the counters reduced over 4 ranks
+|* once, and the value profile of every rank.  See mpi-reduce-test.sh.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "ProfileDataTypes.h"
+#include <mpi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RANKS 4
+
+int llvm_start_edge_profiling(int argc, const char **argv,
+                              uint64_t *arrayStart, uint64_t numElements);
+int llvm_start_time_profiling(int argc, const char **argv, double *arrayStart,
+                              uint64_t numElements, int *arrayRankStart,
+                              int numRankElements);
+int llvm_start_value_profiling(int argc, const char **argv,
+                               unsigned *arrayStart, unsigned numElements);
+void llvm_profiling_trap_value(int index, int value, int isConstant);
+
+static uint64_t Edges[3];
+static double Times[2];
+static int Rank[1];
+static unsigned Values[1];
+
+static int fail(const char *What) {
+  fprintf(stderr, "MPIReduceTest: %s\n", What);
+  return 1;
+}
+
+/* check - Check one output file, counting the packets seen in *Seen. */
+static int check(const char *File, int *SeenEdges, int *SeenTimes,
+                 int *SeenRange, unsigned *SeenRanks) {
+  FILE *F = fopen(File, "rb");
+  int Type;
+  if (!F) return fail("no output file");
+
+  while (fread(&Type, sizeof(int), 1, F) == 1) {
+    uint64_t N;
+    unsigned Len;
+    if (Type == ArgumentInfo) {
+      if (fread(&Len, sizeof(Len), 1, F) != 1) return fail("truncated");
+      fseek(F, (Len + 3) & ~3U, SEEK_CUR);
+      continue;
+    }
+    if (Type == ValueInfo) {
+      /* one site holding one trapped value, maybe run length compressed */
+      unsigned Count[2];
+      int Flags, Value;
+      if (fread(&Len, sizeof(Len), 1, F) != 1 || Len != 1 ||
+          fread(Count, sizeof(Count), 1, F) != 1 || Count[0] != 1 ||
+          fread(&Flags, sizeof(Flags), 1, F) != 1 || Count[1] < 2 ||
+          fread(&Value, sizeof(Value), 1, F) != 1)
+        return fail("bad values");
+      fseek(F, (Count[1] - 2) * sizeof(int), SEEK_CUR);
+      if (Value < 0 || Value >= RANKS || (*SeenRanks & 1U << Value))
+        return fail("wrong or duplicated rank value");
+      *SeenRanks |= 1U << Value;
+      continue;
+    }
+    if (fread(&N, sizeof(N), 1, F) != 1) return fail("truncated");
+    if (Type == EdgeInfo64) {
+      uint64_t E[3];
+      if (N != 3 || fread(E, sizeof(E), 1, F) != 1) return fail("bad edges");
+      /* every rank counts 1, its rank and 100 */
+      if (E[0] != RANKS || E[1] != RANKS * (RANKS - 1) / 2 ||
+          E[2] != 100 * RANKS)
+        return fail("edge counters not summed");
+      ++*SeenEdges;
+    } else if (Type == MPITimeInfo) {
+      double T[2];
+      if (N != 2 || fread(T, sizeof(T), 1, F) != 1) return fail("bad times");
+      if (T[0] != RANKS * 0.5 + RANKS * (RANKS - 1) / 2 || T[1] != 2 * RANKS)
+        return fail("times not summed");
+      ++*SeenTimes;
+    } else if (Type == MPITimeRangeInfo) {
+      double R[4];
+      if (N != 2 || fread(R, sizeof(R), 1, F) != 1) return fail("bad range");
+      if (R[0] != 0.5 || R[1] != 2 || R[2] != RANKS - 0.5 || R[3] != 2)
+        return fail("wrong time range");
+      ++*SeenRange;
+    } else {
+      return fail("unexpected packet");
+    }
+  }
+  fclose(F);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc >= 3 && !strcmp(argv[1], "-check")) {
+    int SeenEdges = 0, SeenTimes = 0, SeenRange = 0, i;
+    unsigned SeenRanks = 0;
+    for (i = 2; i != argc; ++i)
+      if (check(argv[i], &SeenEdges, &SeenTimes, &SeenRange, &SeenRanks))
+        return 1;
+    if (SeenEdges != 1 || SeenTimes != 1 || SeenRange != 1)
+      return fail("missing or duplicated packets");
+    /* the values are not reduced, every rank keeps its own */
+    if (SeenRanks != (1U << RANKS) - 1)
+      return fail("value profile of a rank lost");
+    return 0;
+  }
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &Rank[0]);
+  llvm_start_edge_profiling(argc, (const char**)argv, Edges, 3);
+  llvm_start_time_profiling(argc, (const char**)argv, Times, 2, Rank, 1);
+  llvm_start_value_profiling(argc, (const char**)argv, Values, 1);
+  llvm_profiling_trap_value(0, Rank[0], 0);
+
+  Edges[0] = 1;
+  Edges[1] = Rank[0];
+  Edges[2] = 100;
+  Times[0] = Rank[0] + 0.5;
+  Times[1] = 2;
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * OptimalEdgeTest.c - a program with loops, switches, early returns and
+ * recursion, profiled by optimal-edge-test.sh with both the plain and the
+ * optimal edge profiling.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+static int collatz(unsigned long n) {
+  int steps = 0;
+  while (n != 1) {
+    if (n & 1)
+      n = 3 * n + 1;
+    else
+      n /= 2;
+    ++steps;
+  }
+  return steps;
+}
+
+static int classify(int v) {
+  switch (v % 7) {
+  case 0: return 3;
+  case 1:
+  case 2: return v > 50 ? 2 : 1;
+  case 4: if (v & 8) break; return 5;
+  default: break;
+  }
+  return 0;
+}
+
+static int fib(int n) {
+  if (n < 2) return n;
+  return fib(n - 1) + fib(n - 2);
+}
+
+int main(int argc, char **argv) {
+  long sum = 0;
+  int i, j;
+  for (i = 1; i < 300; ++i) {
+    sum += collatz(i);
+    for (j = 0; j < i % 13; ++j) {
+      if (classify(i + j) == 2) continue;
+      sum += classify(j);
+    }
+    if (sum < 0) return 1;
+  }
+  sum += fib(15);
+  printf("%ld\n", sum);
+  return 0;
+}
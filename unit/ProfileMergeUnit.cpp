@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "ProfileInfoMerge.h"
+
+using namespace llvm;
+
+static const unsigned NumInputs = 7;
+
+// the profile of rank r, with edge counts above 2^32
+static std::string WriteInput(unsigned r)
+{
+   char Name[64];
+   snprintf(Name, sizeof(Name), "merge-unit-%u.out", r);
+   ProfileInfoWriter W("unit-test", Name);
+   W.write("rank " + std::to_string(r));
+   uint64_t Rare = r == 2 ? 1 : ProfileInfoLoader::Uncounted;
+   W.write(EdgeInfo64, std::vector<uint64_t>{5000000000ULL * r, r, Rare});
+   W.write(BlockInfo64, std::vector<uint64_t>{1, 3000000000ULL});
+   W.write(MPIFullInfo, std::vector<unsigned>{r, 1});
+   W.write(RankInfo, std::vector<unsigned>{r});
+   W.write(MPITimeInfo, std::vector<double>{0.25 * r, 1.5});
+   W.writeValues(ValueInfo, std::vector<unsigned>{1},
+                 std::vector<std::vector<int> >{{0, int(r)}});
+   ProfileInfoLoader::PathCountMap Paths;
+   Paths[1][r % 3] = 10000000000ULL;
+   Paths[2][0] = r;
+   W.writePaths(Paths);
+   return Name;
+}
+
+TEST(ProfileMerge, SumOfInputs)
+{
+   std::vector<std::string> Inputs;
+   for(unsigned r = 0; r < NumInputs; ++r)
+      Inputs.push_back(WriteInput(r));
+   std::string Output = "merge-unit-total.out";
+   mergeProfiles("unit-test", Inputs, Output, ProfileInfoMerge::MergeSum, 3);
+
+   ProfileInfoLoader Total("unit-test", Output);
+   std::vector<uint64_t> Edges(3, ProfileInfoLoader::Uncounted), Blocks(2);
+   std::vector<unsigned> MPIFull(2);
+   std::vector<double> Times(2), Min(2, 1e300), Max(2, -1e300);
+   ProfileInfoLoader::PathCountMap Paths;
+   for(unsigned r = 0; r < NumInputs; ++r){
+      ProfileInfoLoader In("unit-test", Inputs[r]);
+      EXPECT_EQ(Total.getExecution(r), In.getExecution(0));
+      for(unsigned i = 0; i < 3; ++i)
+         if(In.getRawEdgeCounts()[i] != ProfileInfoLoader::Uncounted)
+            Edges[i] = (Edges[i] == ProfileInfoLoader::Uncounted ? 0 : Edges[i])
+                       + In.getRawEdgeCounts()[i];
+      for(unsigned i = 0; i < 2; ++i){
+         Blocks[i] += In.getRawBlockCounts()[i];
+         MPIFull[i] += In.getRawMPIFullCounts()[i];
+         Times[i] += In.getRawTimeMess()[i];
+         Min[i] = std::min(Min[i], In.getRawTimeMess()[i]);
+         Max[i] = std::max(Max[i], In.getRawTimeMess()[i]);
+      }
+      const ProfileInfoLoader::PathCountMap& P = In.getRawPathCounts();
+      for(ProfileInfoLoader::PathCountMap::const_iterator F = P.begin(); F != P.end(); ++F)
+         for(std::map<unsigned, uint64_t>::const_iterator I = F->second.begin();
+             I != F->second.end(); ++I)
+            Paths[F->first][I->first] += I->second;
+   }
+
+   EXPECT_EQ(Total.getNumExecutions(), NumInputs);
+   EXPECT_EQ(Total.getRawEdgeCounts().vec(), Edges);
+   EXPECT_EQ(Total.getRawBlockCounts().vec(), Blocks);
+   EXPECT_EQ(Total.getRawMPIFullCounts().vec(), MPIFull);
+   EXPECT_EQ(Total.getRawTimeMess().vec(), Times);
+   EXPECT_EQ(Total.getRawTimeMin().vec(), Min);
+   EXPECT_EQ(Total.getRawTimeMax().vec(), Max);
+   EXPECT_EQ(Total.getRawRankCounts()[0], 0u);
+   EXPECT_EQ(Total.getRawValueCounts()[0], NumInputs);
+   EXPECT_EQ(Total.getRawValueContent(0).size(), NumInputs + 1);
+   EXPECT_EQ(Total.getRawPathCounts(), Paths);
+
+   for(unsigned r = 0; r < NumInputs; ++r)
+      remove(Inputs[r].c_str());
+   remove(Output.c_str());
+}
+
+TEST(ProfileMerge, CapsNarrowCounters)
+{
+   std::vector<std::string> Inputs;
+   for(unsigned r = 0; r < 2; ++r){
+      Inputs.push_back("merge-unit-narrow-" + std::to_string(r) + ".out");
+      ProfileInfoWriter W("unit-test", Inputs.back());
+      W.write(MPIFullInfo, std::vector<unsigned>{3000000000U, 1});
+   }
+   std::string Output = "merge-unit-narrow.out";
+   mergeProfiles("unit-test", Inputs, Output, ProfileInfoMerge::MergeSum, 2);
+   ProfileInfoLoader Total("unit-test", Output);
+   EXPECT_EQ(Total.getRawMPIFullCounts()[0], ~0U - 1);
+   EXPECT_EQ(Total.getRawMPIFullCounts()[1], 2u);
+
+   for(unsigned r = 0; r < 2; ++r)
+      remove(Inputs[r].c_str());
+   remove(Output.c_str());
+}
+
+TEST(ProfileMerge, Stats)
+{
+   std::vector<std::string> Inputs;
+   for(unsigned r = 0; r < NumInputs; ++r){
+      Inputs.push_back("merge-unit-stats-" + std::to_string(r) + ".out");
+      ProfileInfoWriter W("unit-test", Inputs.back());
+      // listed in reverse, the ranks come from the RankInfo packets
+      unsigned Rank = NumInputs - 1 - r;
+      W.write(RankInfo, std::vector<unsigned>{Rank});
+      W.write(EdgeInfo64, std::vector<uint64_t>{10 * Rank, 5});
+      W.write(MPITimeInfo, std::vector<double>{Rank == 3 ? 2.0 : 1.0});
+   }
+   std::string Output = "merge-unit-stats.out";
+   mergeProfiles("unit-test", Inputs, Output, ProfileInfoMerge::MergeStats, 3);
+   ProfileInfoLoader Total("unit-test", Output);
+
+   EXPECT_EQ(Total.getRawEdgeCounts()[0], 210u);
+   ArrayRef<CounterStats> Edges = Total.getRawStats(EdgeInfo64);
+   ASSERT_EQ(Edges.size(), 2u);
+   EXPECT_EQ(Edges[0].numRanks, NumInputs);
+   EXPECT_EQ(Edges[0].min, 0);
+   EXPECT_EQ(Edges[0].max, 60);
+   EXPECT_EQ(Edges[0].argmaxRank, NumInputs - 1);
+   EXPECT_DOUBLE_EQ(Edges[0].mean, 30);
+   EXPECT_DOUBLE_EQ(Edges[0].stddev, 20);
+   EXPECT_NEAR(Edges[0].p50, 30, 30 * 0.1);
+   EXPECT_NEAR(Edges[0].p99, 60, 60 * 0.1);
+   EXPECT_EQ(Edges[1].stddev, 0);
+   EXPECT_EQ(Edges[1].argmaxRank, 0u);
+
+   ArrayRef<CounterStats> Times = Total.getRawStats(MPITimeInfo);
+   ASSERT_EQ(Times.size(), 1u);
+   EXPECT_EQ(Times[0].argmaxRank, 3u);
+   EXPECT_EQ(Times[0].max, 2.0);
+   EXPECT_NEAR(Times[0].p50, 1.0, 0.1);
+   EXPECT_TRUE(Total.getRawStats(BlockInfo64).empty());
+
+   for(unsigned r = 0; r < NumInputs; ++r)
+      remove(Inputs[r].c_str());
+   remove(Output.c_str());
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+# mpi-reduce-test.sh MPIEXEC TEST - run TEST on 4 ranks in an empty directory
+# and check that they left the reduced counters once and every rank's values.
+MPIEXEC=$1
+TEST=$2
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+"$MPIEXEC" -np 4 "$TEST" || exit 1
+set -- llvmprof.out*
+if [ ! -e "$1" ]; then
+  echo "mpi-reduce-test: no output file" >&2
+  exit 1
+fi
+"$TEST" -check "$@"
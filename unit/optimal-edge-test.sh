@@ -0,0 +1,34 @@
+#!/bin/sh
+# optimal-edge-test.sh CLANG OPT PLUGIN RUNTIME LLVM-PROF SOURCE - profile
+# SOURCE once with -insert-edge-profiling and once with
+# -insert-optimal-edge-profiling.  The edge counts reconstructed from the
+# optimal profile must pass -profile-verifier and give the same block counts
+# as the plain profile.
+CLANG=$1
+OPT=$2
+PLUGIN=$3
+RUNTIME=$4
+LLVMPROF=$5
+SOURCE=$6
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+"$CLANG" -O1 -emit-llvm -c "$SOURCE" -o test.bc || exit 1
+for MODE in edge optimal-edge; do
+  mkdir $MODE || exit 1
+  "$OPT" -load "$PLUGIN" -insert-$MODE-profiling test.bc -o $MODE/test.bc &&
+  "$CLANG" $MODE/test.bc "$RUNTIME" -lpthread -o $MODE/test &&
+  (cd $MODE && ./test > /dev/null) || exit 1
+  set -- $MODE/llvmprof.out*
+  mv "$1" $MODE.out || exit 1
+done
+
+"$OPT" -load "$PLUGIN" -profile-loader -profile-info-file=optimal-edge.out \
+  -profile-verifier test.bc -o /dev/null || exit 1
+"$LLVMPROF" -to-block test.bc edge.out edge.block &&
+"$LLVMPROF" -to-block test.bc optimal-edge.out optimal-edge.block || exit 1
+if ! cmp -s edge.block optimal-edge.block; then
+  echo "optimal-edge-test: optimal edge profile differs from edge profile" >&2
+  exit 1
+fi